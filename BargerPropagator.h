@@ -18,6 +18,15 @@
 // or through sphere's of varying radial density.
 
 
+// Caller owned structure-of-arrays buffer filled by propagateLinearBatch(...)
+// Prob[In][Out] points to an array with (at least) one entry per batch point
+// In, Out  - 0:e 1:mu 2:tau  (same meaning as GetProb, for both nu and nu_bar)
+// A null column is simply not stored, so only the needed channels cost memory
+struct BargerProbabilityBuffer
+{
+      double * Prob[3][3];
+};
+
 class BargerPropagator : public NeutrinoPropagator
 {
   public:
@@ -39,6 +48,18 @@ class BargerPropagator : public NeutrinoPropagator
       // specify Path length in the matter
       // specify density of the matter
       virtual void propagateLinear( int , double, double );
+
+      // batched driving routine for oscillations through linear media of constant density
+      // replaces the SetMNS(...) + propagateLinear(...) + GetProb(...) sequence for n points
+      // the mixing parameters are shared by the whole batch, while for every point k
+      // the Energy [GeV], d_cp, neutrino type and Path length [km] are read from the arrays
+      // The MNS matrix is only rebuilt when the (Energy, d_cp, type) triplet changes,
+      // the full 3x3 probability matrix of point k is stored in buffer.Prob[In][Out][k]
+      //                      n  ,  x12  ,  x13  ,  x23  ,  dm21 ,  dm32 , T: sin^2(x) F: sin^2(2x)
+      //                      Energy[], d_cp[], type[], Path[], density, buffer
+      void propagateLinearBatch( int, double, double, double, double, double, bool,
+                                 const double *, const double *, const int *, const double *,
+                                 double, BargerProbabilityBuffer & );
       
       // driving routine for oscillations in vaccuum!
       // called after SetMNS(...)
@@ -126,6 +147,28 @@ class BargerPropagator : public NeutrinoPropagator
       bool kOneDominantMass   ;  
       
 };
+
+
+inline void BargerPropagator::propagateLinearBatch( int n, double x12, double x13, double x23,
+                                                     double dm21, double dm32, bool kSquared,
+                                                     const double * energy, const double * d_cp,
+                                                     const int * nuType, const double * path,
+                                                     double density, BargerProbabilityBuffer & buffer )
+{
+      int i, j, k;
+
+      for( k = 0; k < n; k++ )
+      {
+            // Explicit qualification avoids the virtual dispatch on every point
+            if( k == 0 || energy[k] != energy[k-1] || d_cp[k] != d_cp[k-1] || nuType[k] != nuType[k-1] )
+                  BargerPropagator::SetMNS( x12, x13, x23, dm21, dm32, d_cp[k], energy[k], kSquared, nuType[k] );
+            BargerPropagator::propagateLinear( nuType[k], path[k], density );
+
+            for( i = 0; i < 3; i++ )
+                  for( j = 0; j < 3; j++ )
+                        if( buffer.Prob[i][j] ) buffer.Prob[i][j][k] = Probability[i][j];
+      }
+}
       
 #endif
       
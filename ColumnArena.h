@@ -0,0 +1,111 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _ColumnArena_
+#define _ColumnArena_
+
+// C includes
+#include <stddef.h>
+#include <sys/mman.h>
+
+// C++ includes
+#include <sstream>
+#include <stdexcept>
+
+/* A single block of memory holding the columns of a scan (energies, delta
+   values, probabilities, ...), all with the same number of rows.
+
+   The block lives on the heap (an anonymous mapping, so pages that are never
+   written are never used) and is only reallocated when a larger layout is
+   requested, so the same arena can be reused for scans of any size without
+   any allocation per scan or per scenario. With shared true the block is
+   also visible to the parallel workers (see WorkerPool.h).
+
+   Every column starts on a 64 byte boundary, which is the width of an
+   AVX-512 register. */
+class ColumnArena
+{
+  public:
+
+      ColumnArena( bool shared = false )
+	: block(NULL), capacity(0), stride(0), n_rows(0), n_columns(0),
+	  shared(shared) {}
+     ~ColumnArena( ) { Release(); }
+
+      // lay out n_columns columns of n_rows doubles each; the content of the
+      // columns is lost only if the block has to be reallocated
+      void Reserve( size_t new_n_columns, size_t new_n_rows )
+      {
+	const size_t new_stride = (new_n_rows + 7) / 8 * 8;
+	const size_t size = new_n_columns * new_stride;
+	if (size > capacity) {
+	  Release();
+	  void * p = mmap(NULL, size * sizeof(double), PROT_READ | PROT_WRITE,
+			  (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS, -1, 0);
+	  if (p == MAP_FAILED) {
+	    std::ostringstream message;
+	    message << "cannot allocate " << new_n_columns << " columns of "
+		    << new_n_rows << " points";
+	    throw std::runtime_error(message.str());
+	  }
+	  block = (double *) p;
+	  capacity = size;
+	}
+	stride = new_stride;
+	n_rows = new_n_rows;
+	n_columns = new_n_columns;
+      }
+
+      double * Column( size_t c ) { return block + c * stride; }
+
+      size_t GetNRows()    const { return n_rows; }
+      size_t GetNColumns() const { return n_columns; }
+
+  private:
+
+      ColumnArena( const ColumnArena & );
+      ColumnArena & operator=( const ColumnArena & );
+
+      void Release( )
+      {
+	if (block) munmap((void *) block, capacity * sizeof(double));
+	block = NULL;
+	capacity = 0;
+      }
+
+      double * block;
+      size_t   capacity;  // allocated size in doubles
+      size_t   stride;    // distance between two columns in doubles
+      size_t   n_rows;
+      size_t   n_columns;
+      bool     shared;
+};
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
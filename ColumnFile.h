@@ -0,0 +1,271 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _ColumnFile_
+#define _ColumnFile_
+
+// C includes
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// C++ includes
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* A ROOT-free binary file of named double columns (--format columns).
+
+   The file starts with a table of named parameters (the oscillation
+   parameters of the run) and a table of columns, followed by the columns
+   themselves. Every column is a contiguous array of doubles starting on a 64
+   byte boundary, so once the file is mapped in memory the columns can be
+   used in place, without reading or copying them (see ColumnFile below and
+   nva_columns.py for numpy).
+
+   File layout (native endianness, all the records are 64 bytes long):
+     char     magic[8]        "NVACOLS"
+     uint64_t version         1
+     uint64_t n_parameters
+     uint64_t n_columns
+     char     padding[32]
+     n_parameters times:
+       char     name[56]      zero-terminated
+       double   value
+     n_columns times:
+       char     name[48]      zero-terminated
+       uint64_t offset        of the first double, in bytes from the start
+       uint64_t n             number of doubles
+     then the columns.
+
+   The names of the columns of a graph are "<graph>/x" and "<graph>/y", those
+   of a histogram "<histogram>/edges" (n_bins+1 values) and
+   "<histogram>/content" (n_bins+2 values, underflow and overflow included). */
+
+#define COLUMN_FILE_VERSION    1
+#define COLUMN_FILE_ALIGN      64
+#define COLUMN_PARAMETER_NAME  56
+#define COLUMN_NAME            48
+
+/* Collects the parameters and the columns of a file and writes them.
+   The columns are not copied: their data must stay valid until Write. */
+class ColumnFileWriter
+{
+  public:
+
+      void AddParameter( const std::string & name, double value )
+      {
+	CheckName(name, COLUMN_PARAMETER_NAME);
+	parameter_name.push_back(name);
+	parameter_value.push_back(value);
+      }
+
+      void AddColumn( const std::string & name, const double * data, size_t n )
+      {
+	CheckName(name, COLUMN_NAME);
+	column_name.push_back(name);
+	column_data.push_back(data);
+	column_size.push_back(n);
+      }
+
+      void Write( const std::string & file_name ) const
+      {
+	size_t i;
+	FILE * file = fopen(file_name.c_str(), "wb");
+	if (!file) throw std::runtime_error("cannot open " + file_name);
+
+	char record[COLUMN_FILE_ALIGN];
+	memset(record, 0, sizeof(record));
+	uint64_t header[4] = { 0, COLUMN_FILE_VERSION, parameter_name.size(),
+			       column_name.size() };
+	memcpy(header, "NVACOLS", 8);
+	memcpy(record, header, sizeof(header));
+	bool ok = fwrite(record, sizeof(record), 1, file) == 1;
+
+	for (i = 0; i < parameter_name.size(); i++) {
+	  memset(record, 0, sizeof(record));
+	  strncpy(record, parameter_name[i].c_str(), COLUMN_PARAMETER_NAME - 1);
+	  memcpy(record + COLUMN_PARAMETER_NAME, &parameter_value[i], sizeof(double));
+	  ok = ok && fwrite(record, sizeof(record), 1, file) == 1;
+	}
+
+	uint64_t offset = (1 + parameter_name.size() + column_name.size())
+	  * COLUMN_FILE_ALIGN;
+	std::vector<uint64_t> column_offset(column_name.size());
+	for (i = 0; i < column_name.size(); i++) {
+	  column_offset[i] = offset;
+	  uint64_t location[2] = { offset, column_size[i] };
+	  memset(record, 0, sizeof(record));
+	  strncpy(record, column_name[i].c_str(), COLUMN_NAME - 1);
+	  memcpy(record + COLUMN_NAME, location, sizeof(location));
+	  ok = ok && fwrite(record, sizeof(record), 1, file) == 1;
+	  offset += Align(column_size[i] * sizeof(double));
+	}
+
+	memset(record, 0, sizeof(record));
+	for (i = 0; i < column_name.size(); i++) {
+	  const size_t bytes = column_size[i] * sizeof(double);
+	  if (column_size[i] > 0)
+	    ok = ok && fwrite(column_data[i], sizeof(double), column_size[i], file)
+	      == column_size[i];
+	  const size_t padding = Align(bytes) - bytes;
+	  if (padding > 0)
+	    ok = ok && fwrite(record, 1, padding, file) == padding;
+	}
+
+	if (fclose(file) != 0 || !ok)
+	  throw std::runtime_error("cannot write to " + file_name);
+      }
+
+  private:
+
+      static uint64_t Align( uint64_t bytes )
+      { return (bytes + COLUMN_FILE_ALIGN - 1) / COLUMN_FILE_ALIGN * COLUMN_FILE_ALIGN; }
+
+      static void CheckName( const std::string & name, size_t size )
+      {
+	if (name.empty() || name.size() >= size)
+	  throw std::runtime_error("invalid column file name \"" + name + "\"");
+      }
+
+      std::vector<std::string> parameter_name;
+      std::vector<double> parameter_value;
+      std::vector<std::string> column_name;
+      std::vector<const double *> column_data;
+      std::vector<size_t> column_size;
+};
+
+/* Read-only view of a column file. The file is mapped in memory and the
+   columns are returned as pointers into the mapping, valid as long as the
+   ColumnFile object exists. */
+class ColumnFile
+{
+  public:
+
+      ColumnFile( const std::string & file_name )
+	: map(NULL), map_size(0)
+      {
+	int fd = open(file_name.c_str(), O_RDONLY);
+	if (fd < 0) throw std::runtime_error("cannot open " + file_name);
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < COLUMN_FILE_ALIGN) {
+	  close(fd);
+	  throw std::runtime_error(file_name + " is not a column file");
+	}
+	map_size = st.st_size;
+	void * p = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) throw std::runtime_error("cannot map " + file_name);
+	map = (const char *) p;
+
+	/* The counts and the sizes of the header are compared with what fits
+	   in the file before multiplying them, since a corrupted header could
+	   make the products overflow */
+	uint64_t header[4];
+	memcpy(header, map, sizeof(header));
+	const uint64_t n_records = map_size / COLUMN_FILE_ALIGN;
+	if (memcmp(map, "NVACOLS", 8) != 0 || header[1] != COLUMN_FILE_VERSION ||
+	    header[2] > n_records - 1 || header[3] > n_records - 1 - header[2]) {
+	  Release();
+	  throw std::runtime_error(file_name + " is not a column file");
+	}
+	n_parameters = header[2];
+	n_columns = header[3];
+	for (size_t c = 0; c < n_columns; c++) {
+	  const uint64_t offset = GetColumnOffset(c);
+	  if (offset % sizeof(double) != 0 || offset > map_size ||
+	      GetColumnSize(c) > (map_size - offset) / sizeof(double)) {
+	    Release();
+	    throw std::runtime_error(file_name + " is truncated");
+	  }
+	}
+      }
+     ~ColumnFile( ) { Release(); }
+
+      size_t      GetNParameters() const { return n_parameters; }
+      std::string GetParameterName( size_t i ) const
+	{ return std::string(Record(1 + i), strnlen(Record(1 + i), COLUMN_PARAMETER_NAME)); }
+      double      GetParameterValue( size_t i ) const
+	{ double x; memcpy(&x, Record(1 + i) + COLUMN_PARAMETER_NAME, sizeof(x)); return x; }
+
+      // the value of the named parameter, an exception if there is none
+      double GetParameter( const std::string & name ) const
+      {
+	for (size_t i = 0; i < n_parameters; i++)
+	  if (GetParameterName(i) == name) return GetParameterValue(i);
+	throw std::runtime_error("no parameter " + name + " in the column file");
+      }
+
+      size_t      GetNColumns() const { return n_columns; }
+      std::string GetColumnName( size_t c ) const
+	{ return std::string(ColumnRecord(c), strnlen(ColumnRecord(c), COLUMN_NAME)); }
+      size_t      GetColumnSize( size_t c ) const { return Location(c, 1); }
+      const double * GetColumn( size_t c ) const
+	{ return (const double *) (map + GetColumnOffset(c)); }
+
+      // the named column and its size, NULL if there is none
+      const double * FindColumn( const std::string & name, size_t * n = NULL ) const
+      {
+	for (size_t c = 0; c < n_columns; c++) {
+	  if (GetColumnName(c) != name) continue;
+	  if (n) *n = GetColumnSize(c);
+	  return GetColumn(c);
+	}
+	return NULL;
+      }
+
+  private:
+
+      ColumnFile( const ColumnFile & );
+      ColumnFile & operator=( const ColumnFile & );
+
+      const char * Record( size_t r ) const { return map + r * COLUMN_FILE_ALIGN; }
+      const char * ColumnRecord( size_t c ) const { return Record(1 + n_parameters + c); }
+      uint64_t Location( size_t c, int k ) const
+	{ uint64_t x; memcpy(&x, ColumnRecord(c) + COLUMN_NAME + 8*k, sizeof(x)); return x; }
+      uint64_t GetColumnOffset( size_t c ) const { return Location(c, 0); }
+
+      void Release( )
+      {
+	if (map) munmap((void *) map, map_size);
+	map = NULL;
+      }
+
+      const char * map;
+      size_t map_size;
+      size_t n_parameters;
+      size_t n_columns;
+};
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
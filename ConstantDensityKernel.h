@@ -0,0 +1,567 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _ConstantDensityKernel_
+#define _ConstantDensityKernel_
+
+// C includes
+#include <math.h>
+
+// C++ includes
+#include <algorithm>
+#include <vector>
+
+// Prob3++ includes (only for BargerProbabilityBuffer)
+#include "BargerPropagator.h"
+
+/* Vectorized three flavour oscillations through matter of constant density.
+
+   This is an independent implementation of what Prob3++ does in
+   SetMNS(...) + propagateLinear(...), with the same physical constants and
+   conventions (sin^2 or sin^2(2x) angles, IH input meaning DM31, delta ->
+   -delta and opposite matter potential for anti-neutrinos, 0.5 electrons per
+   nucleon), so the two agree to rounding.
+
+   The Hamiltonian H = U diag(0, DM21, DM31) U^+ + diag(A, 0, 0) is shifted to
+   be traceless, G = H - tr(H)/3, so that its eigenvalues x_k are the roots of
+   x^3 + p x + q = 0 and are found in closed form (Barger et al. PRD 22, 2718).
+   The evolution operator then follows from Sylvester's formula
+
+     S = sum_k exp(-i x_k L/2E) (G^2 + x_k G + (x_k^2 + p)) / (3 x_k^2 + p)
+
+   up to an irrelevant global phase, without any eigenvector. When two
+   eigenvalues (or all three) get closer than KERNEL_DEGENERATE times their
+   spread the denominators vanish, and the same S = C2 G^2 + C1 G + C0 is
+   found instead from Newton's divided differences of exp(-i x L/2E), which
+   have a finite limit (see KernelDegenerateCoefficients).
+
+   The points are processed in blocks of KERNEL_LANES lanes (energies, delta
+   values or path lengths) stored in arrays, so that the compiler turns each
+   step into vector instructions. The block is compiled for AVX-512, AVX2 and
+   the baseline instruction set, and the best version for the CPU is chosen
+   at run time. The same code with a single lane is the scalar path. Only the
+   transcendental functions (one acos, cos, sin and three sincos per point)
+   are still evaluated lane by lane.
+
+   The vacuum part of H only depends on delta and on the neutrino type, and
+   KernelPropagator builds it once for all the points sharing them, so along
+   an energy (or path, or density) scan only the matter dependent part is
+   computed for every point. */
+
+#define KERNEL_LANES 8
+
+#define KERNEL_TWORTTWOGF      1.52588e-4 // 2 sqrt(2) G_F N_A in eV^2 / (GeV g/cm^3), as in mosc.c
+#define KERNEL_LOEFAC          2.534      // dm^2 [eV^2] L [Km] / 2E [GeV] phase, as in mosc.c
+#define KERNEL_DENSITY_CONVERT 0.5        // electrons per nucleon, default of BargerPropagator
+#define KERNEL_DEGENERATE      1e-2       // relative gap of degenerate eigenvalues
+
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+#define KERNEL_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define KERNEL_TARGET_CLONES
+#endif
+
+/* Fused multiply-adds would round differently in the vectorized and in the
+   scalar path, and the large phases of low energy points amplify that up to
+   1e-11 in the probabilities. With contraction disabled both paths perform
+   exactly the same operations. */
+#if defined(__GNUC__) && !defined(__clang__)
+#define KERNEL_NO_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define KERNEL_NO_CONTRACT
+#endif
+
+/* Energy independent part of the mixing: sines and cosines of the angles and
+   the mass splittings of the mass eigenstates with respect to m1 */
+struct KernelMixing
+{
+  double s12, c12, s13, c13, s23, c23;
+  double dm21, dm31;
+};
+
+// Same arguments of BargerPropagator::SetMNS (without delta, energy and type)
+inline KernelMixing SetKernelMixing(double x12, double x13, double x23,
+				    double dm21, double dm32, bool kSquared)
+{
+  KernelMixing mix;
+  // sin^2(2x) -> sin^2(x)
+  if (!kSquared) {
+    x12 = 0.5 * (1 - sqrt(1 - x12));
+    x13 = 0.5 * (1 - sqrt(1 - x13));
+    x23 = 0.5 * (1 - sqrt(1 - x23));
+  }
+  mix.s12 = sqrt(x12); mix.c12 = sqrt(1 - x12);
+  mix.s13 = sqrt(x13); mix.c13 = sqrt(1 - x13);
+  mix.s23 = sqrt(x23); mix.c23 = sqrt(1 - x23);
+  // Negative (IH) input is DM31, as in BargerPropagator::SetOneMassScaleMode
+  if (dm32 < 0) dm32 -= dm21;
+  mix.dm21 = dm21;
+  mix.dm31 = dm21 + dm32;
+  return mix;
+}
+
+/* Coefficients of the evolution operator S = C2 G^2 + C1 G + C0 */
+struct KernelCoefficients
+{
+  double c2r, c2i, c1r, c1i, c0r, c0i;
+};
+
+/* True if Sylvester's formula is not accurate for the eigenvalues
+   x0 >= x1 >= x2, because two of them are (nearly) equal */
+inline bool KernelDegenerate(double x0, double x1, double x2)
+{
+  return x0 - x1 <= KERNEL_DEGENERATE * (x0 - x2) ||
+    x1 - x2 <= KERNEL_DEGENERATE * (x0 - x2);
+}
+
+/* Coefficients of S for nearly degenerate eigenvalues x0 >= x1 >= x2, from
+   the Newton form of f(x) = exp(-i x phase) interpolated at the eigenvalues
+
+     S = f[x0] + f[x0,x1] (G - x0) + f[x0,x1,x2] (G - x0) (G - x1)
+
+   The first divided differences are written with sin(z)/z, which stays
+   finite for equal eigenvalues, and for three equal eigenvalues the second
+   one is its limit f''/2. */
+KERNEL_NO_CONTRACT
+inline KernelCoefficients KernelDegenerateCoefficients(double x0, double x1,
+						       double x2, double phase)
+{
+  const double x[3] = { x0, x1, x2 };
+  double dr[2], di[2]; // f[x0,x1] and f[x1,x2]
+  for (int k = 0; k < 2; k++) {
+    const double z = phase * (x[k + 1] - x[k]) / 2;
+    const double s = phase * (z == 0 ? 1 : sin(z) / z);
+    const double m = phase * (x[k] + x[k + 1]) / 2;
+    dr[k] = - s * sin(m);
+    di[k] = - s * cos(m);
+  }
+  const double f0r = cos(x0 * phase), f0i = - sin(x0 * phase);
+  double d2r, d2i;     // f[x0,x1,x2]
+  if (x2 == x0) {
+    d2r = - phase * phase / 2 * f0r;
+    d2i = - phase * phase / 2 * f0i;
+  }
+  else {
+    d2r = (dr[1] - dr[0]) / (x2 - x0);
+    d2i = (di[1] - di[0]) / (x2 - x0);
+  }
+
+  KernelCoefficients c;
+  c.c2r = d2r;
+  c.c2i = d2i;
+  c.c1r = dr[0] - d2r * (x0 + x1);
+  c.c1i = di[0] - d2i * (x0 + x1);
+  c.c0r = f0r - dr[0] * x0 + d2r * x0 * x1;
+  c.c0i = f0i - di[0] * x0 + d2i * x0 * x1;
+  return c;
+}
+
+/* Vacuum Hamiltonian U diag(0, DM21, DM31) U^+ (times 2E) in the flavour
+   basis for W lanes. It depends on delta and on the neutrino type but not on
+   the energy, the path or the density, so it is computed once and reused
+   along energy scans. Only the upper triangle of the Hermitian matrix. */
+template<int W>
+struct KernelVacuumLanes
+{
+  double h00[W], h11[W], h22[W];
+  double h01r[W], h01i[W], h02r[W], h02i[W], h12r[W], h12i[W];
+};
+
+template<int W>
+inline __attribute__((always_inline)) KERNEL_NO_CONTRACT
+void KernelVacuumBlock(const KernelMixing & mix,
+		       const double * __restrict d_cp,
+		       const int    * __restrict type,
+		       KernelVacuumLanes<W> & __restrict vac)
+{
+  int l;
+  double cd[W], sd[W];
+
+  // Lane by lane: the CP phase, with delta -> -delta for anti-neutrinos
+  for (l = 0; l < W; l++) {
+    cd[l] = cos(d_cp[l]);
+    sd[l] = (type[l] > 0 ? 1.0 : -1.0) * sin(d_cp[l]);
+  }
+
+  const double s12 = mix.s12, c12 = mix.c12, s13 = mix.s13, c13 = mix.c13;
+  const double s23 = mix.s23, c23 = mix.c23, m2 = mix.dm21, m3 = mix.dm31;
+  const double u01 = s12*c13, u12 = s23*c13, u22 = c23*c13;
+
+  for (l = 0; l < W; l++) {
+    // PMNS matrix, U02 = s13 exp(-i delta)
+    double u02r = s13*cd[l], u02i = - s13*sd[l];
+    double u11r = c12*c23 - s12*s23*s13*cd[l], u11i = - s12*s23*s13*sd[l];
+    double u21r = - c12*s23 - s12*c23*s13*cd[l], u21i = - s12*c23*s13*sd[l];
+
+    vac.h00[l] = m2*u01*u01 + m3*s13*s13;
+    vac.h11[l] = m2*(u11r*u11r + u11i*u11i) + m3*u12*u12;
+    vac.h22[l] = m2*(u21r*u21r + u21i*u21i) + m3*u22*u22;
+    vac.h01r[l] = m2*u01*u11r + m3*u02r*u12;
+    vac.h01i[l] = - m2*u01*u11i + m3*u02i*u12;
+    vac.h02r[l] = m2*u01*u21r + m3*u02r*u22;
+    vac.h02i[l] = - m2*u01*u21i + m3*u02i*u22;
+    vac.h12r[l] = m2*(u11r*u21r + u11i*u21i) + m3*u12*u22;
+    vac.h12i[l] = m2*(u11i*u21r - u11r*u21i);
+  }
+}
+
+/* Matter dependent part: compute the probability matrices of W points from
+   their vacuum Hamiltonians, prob[In][Out][lane] with In, Out  0:e 1:mu
+   2:tau. All the intermediate values are arrays over the lanes so that every
+   loop can be vectorized. */
+template<int W>
+inline __attribute__((always_inline)) KERNEL_NO_CONTRACT
+void ConstantDensityBlock(const KernelVacuumLanes<W> & __restrict vac,
+			  const double * __restrict energy,
+			  const int    * __restrict type,
+			  const double * __restrict path, double density,
+			  double (* __restrict prob)[3][W])
+{
+  int l;
+  double A[W], phase[W];
+
+  /***** Flavour basis Hamiltonian (times 2E) *****/
+
+  double g0[W], g1[W], g2[W];            // diagonal of G
+  double p[W], q[W];
+  const double * __restrict h01r = vac.h01r, * __restrict h01i = vac.h01i;
+  const double * __restrict h02r = vac.h02r, * __restrict h02i = vac.h02i;
+  const double * __restrict h12r = vac.h12r, * __restrict h12i = vac.h12i;
+
+  for (l = 0; l < W; l++) {
+    A[l] = (type[l] > 0 ? 1.0 : -1.0) * KERNEL_TWORTTWOGF * KERNEL_DENSITY_CONVERT * density * energy[l];
+    phase[l] = KERNEL_LOEFAC * path[l] / energy[l];
+
+    // H = U diag(0, m2, m3) U^+ + diag(A, 0, 0)
+    double h00 = vac.h00[l] + A[l];
+    double h11 = vac.h11[l];
+    double h22 = vac.h22[l];
+
+    // Traceless G and its characteristic polynomial x^3 + p x + q
+    double t3 = (h00 + h11 + h22) / 3.0;
+    g0[l] = h00 - t3;
+    g1[l] = h11 - t3;
+    g2[l] = h22 - t3;
+    double n01 = h01r[l]*h01r[l] + h01i[l]*h01i[l];
+    double n02 = h02r[l]*h02r[l] + h02i[l]*h02i[l];
+    double n12 = h12r[l]*h12r[l] + h12i[l]*h12i[l];
+    p[l] = g0[l]*g1[l] + g0[l]*g2[l] + g1[l]*g2[l] - n01 - n02 - n12;
+    // Re(h01 h12 h02^*)
+    double ar = h01r[l]*h12r[l] - h01i[l]*h12i[l];
+    double ai = h01r[l]*h12i[l] + h01i[l]*h12r[l];
+    double re3 = ar*h02r[l] + ai*h02i[l];
+    q[l] = - (g0[l]*g1[l]*g2[l] + 2*re3 - g0[l]*n12 - g1[l]*n02 - g2[l]*n01);
+  }
+
+  /***** Eigenvalues *****/
+
+  double r[W], arg[W], ct[W], st[W];
+  for (l = 0; l < W; l++) {
+    // p <= 0 for a Hermitian G, but rounds to either sign when G is ~0
+    r[l] = sqrt(std::max(- p[l] / 3.0, 0.0));
+    double r3 = r[l]*r[l]*r[l];
+    arg[l] = r3 > 0 ? - q[l] / (2 * r3) : 0;
+    arg[l] = arg[l] > 1 ? 1 : (arg[l] < -1 ? -1 : arg[l]);
+  }
+  for (l = 0; l < W; l++) { // lane by lane
+    double theta = acos(arg[l]) / 3.0;
+    ct[l] = cos(theta);
+    st[l] = sin(theta);
+  }
+
+  double x[3][W], ec[3][W], es[3][W];
+  for (l = 0; l < W; l++) {
+    x[0][l] = 2*r[l]*ct[l];
+    x[1][l] = r[l]*(- ct[l] + sqrt(3.0)*st[l]);
+    x[2][l] = r[l]*(- ct[l] - sqrt(3.0)*st[l]);
+  }
+  for (int k = 0; k < 3; k++)
+    for (l = 0; l < W; l++) { // lane by lane
+      ec[k][l] = cos(x[k][l] * phase[l]);
+      es[k][l] = - sin(x[k][l] * phase[l]);
+    }
+
+  /***** Evolution operator S = C2 G^2 + C1 G + C0 *****/
+
+  double c2r[W], c2i[W], c1r[W], c1i[W], c0r[W], c0i[W];
+  for (l = 0; l < W; l++) {
+    c2r[l] = c2i[l] = c1r[l] = c1i[l] = c0r[l] = c0i[l] = 0;
+    for (int k = 0; k < 3; k++) {
+      double w = 1.0 / (3*x[k][l]*x[k][l] + p[l]);
+      double w1 = w * x[k][l];
+      double w0 = w * (x[k][l]*x[k][l] + p[l]);
+      c2r[l] += w  * ec[k][l];  c2i[l] += w  * es[k][l];
+      c1r[l] += w1 * ec[k][l];  c1i[l] += w1 * es[k][l];
+      c0r[l] += w0 * ec[k][l];  c0i[l] += w0 * es[k][l];
+    }
+  }
+  for (l = 0; l < W; l++) { // lane by lane, only the degenerate ones
+    if (!KernelDegenerate(x[0][l], x[1][l], x[2][l])) continue;
+    KernelCoefficients c = KernelDegenerateCoefficients(x[0][l], x[1][l],
+							 x[2][l], phase[l]);
+    c2r[l] = c.c2r;  c2i[l] = c.c2i;
+    c1r[l] = c.c1r;  c1i[l] = c.c1i;
+    c0r[l] = c.c0r;  c0i[l] = c.c0i;
+  }
+
+  for (l = 0; l < W; l++) {
+    // Upper triangle of G^2 (Hermitian)
+    double k00 = g0[l]*g0[l] + h01r[l]*h01r[l] + h01i[l]*h01i[l] + h02r[l]*h02r[l] + h02i[l]*h02i[l];
+    double k11 = g1[l]*g1[l] + h01r[l]*h01r[l] + h01i[l]*h01i[l] + h12r[l]*h12r[l] + h12i[l]*h12i[l];
+    double k22 = g2[l]*g2[l] + h02r[l]*h02r[l] + h02i[l]*h02i[l] + h12r[l]*h12r[l] + h12i[l]*h12i[l];
+    // K01 = h01 (g0 + g1) + h02 h12^*
+    double k01r = h01r[l]*(g0[l] + g1[l]) + h02r[l]*h12r[l] + h02i[l]*h12i[l];
+    double k01i = h01i[l]*(g0[l] + g1[l]) + h02i[l]*h12r[l] - h02r[l]*h12i[l];
+    // K02 = h02 (g0 + g2) + h01 h12
+    double k02r = h02r[l]*(g0[l] + g2[l]) + h01r[l]*h12r[l] - h01i[l]*h12i[l];
+    double k02i = h02i[l]*(g0[l] + g2[l]) + h01r[l]*h12i[l] + h01i[l]*h12r[l];
+    // K12 = h12 (g1 + g2) + h01^* h02
+    double k12r = h12r[l]*(g1[l] + g2[l]) + h01r[l]*h02r[l] + h01i[l]*h02i[l];
+    double k12i = h12i[l]*(g1[l] + g2[l]) + h01r[l]*h02i[l] - h01i[l]*h02r[l];
+
+    // Diagonal: S_aa = C2 K_aa + C1 g_a + C0
+    double kd[3] = { k00, k11, k22 };
+    double gd[3] = { g0[l], g1[l], g2[l] };
+    for (int a = 0; a < 3; a++) {
+      double sr = c2r[l]*kd[a] + c1r[l]*gd[a] + c0r[l];
+      double si = c2i[l]*kd[a] + c1i[l]*gd[a] + c0i[l];
+      prob[a][a][l] = sr*sr + si*si;
+    }
+
+    // Off diagonal: S_ab = C2 K_ab + C1 G_ab and S_ba with the conjugates
+    double kr[3] = { k01r, k02r, k12r }, ki[3] = { k01i, k02i, k12i };
+    double gr[3] = { h01r[l], h02r[l], h12r[l] }, gi[3] = { h01i[l], h02i[l], h12i[l] };
+    const int ia[3] = { 0, 0, 1 }, ib[3] = { 1, 2, 2 };
+    for (int o = 0; o < 3; o++) {
+      double sr = c2r[l]*kr[o] - c2i[l]*ki[o] + c1r[l]*gr[o] - c1i[l]*gi[o];
+      double si = c2r[l]*ki[o] + c2i[l]*kr[o] + c1r[l]*gi[o] + c1i[l]*gr[o];
+      prob[ib[o]][ia[o]][l] = sr*sr + si*si; // S_ab is the ib -> ia amplitude
+      sr = c2r[l]*kr[o] + c2i[l]*ki[o] + c1r[l]*gr[o] + c1i[l]*gi[o];
+      si = - c2r[l]*ki[o] + c2i[l]*kr[o] - c1r[l]*gi[o] + c1i[l]*gr[o];
+      prob[ia[o]][ib[o]][l] = sr*sr + si*si;
+    }
+  }
+}
+
+// The vectorized blocks, compiled for several instruction sets
+KERNEL_TARGET_CLONES KERNEL_NO_CONTRACT
+inline void KernelVacuumBlockSIMD(const KernelMixing & mix,
+				  const double * __restrict d_cp,
+				  const int    * __restrict type,
+				  KernelVacuumLanes<KERNEL_LANES> & vac)
+{
+  KernelVacuumBlock<KERNEL_LANES>(mix, d_cp, type, vac);
+}
+
+KERNEL_TARGET_CLONES KERNEL_NO_CONTRACT
+inline void ConstantDensityBlockSIMD(const KernelVacuumLanes<KERNEL_LANES> & vac,
+				     const double * __restrict energy,
+				     const int    * __restrict type,
+				     const double * __restrict path, double density,
+				     double (* __restrict prob)[3][KERNEL_LANES])
+{
+  ConstantDensityBlock<KERNEL_LANES>(vac, energy, type, path, density, prob);
+}
+
+/* Name of the instruction set used by ConstantDensityBlockSIMD on this CPU */
+inline const char * KernelInstructionSet()
+{
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return "AVX-512";
+  if (__builtin_cpu_supports("avx2"))    return "AVX2";
+  return "SSE2";
+#else
+  return "generic";
+#endif
+}
+
+/* Propagator split in the same steps of an energy scan:
+
+     SetMixing   energy independent setup, once per set of angles and mass
+                 splittings
+     SetPhase    vacuum Hamiltonian for delta and the neutrino type, cached
+     Propagate*  only the matter dependent work for each energy, path and
+                 density
+
+   Propagate takes delta and the type of every point like
+   BargerPropagator::propagateLinearBatch and rebuilds the vacuum Hamiltonian
+   only when they change. PropagateEnergies uses the ones given to SetPhase.
+   With vectorized false every point goes through the scalar path, which gives
+   exactly the same results. */
+class KernelPropagator
+{
+public:
+  KernelPropagator() : vacuum_valid(false) {}
+
+  // Same arguments of BargerPropagator::SetMNS (without delta, energy and type)
+  void SetMixing(double x12, double x13, double x23,
+		 double dm21, double dm32, bool kSquared)
+  {
+    mix = SetKernelMixing(x12, x13, x23, dm21, dm32, kSquared);
+    vacuum_valid = false;
+  }
+
+  KERNEL_NO_CONTRACT
+  void SetPhase(double d_cp, int type)
+  {
+    if (vacuum_valid && d_cp == vacuum_d_cp && (type > 0) == (vacuum_type > 0))
+      return;
+    KernelVacuumLanes<1> one;
+    KernelVacuumBlock<1>(mix, &d_cp, &type, one);
+    for (int l = 0; l < KERNEL_LANES; l++) {
+      vacuum.h00[l] = one.h00[0];   vacuum.h11[l] = one.h11[0];
+      vacuum.h22[l] = one.h22[0];
+      vacuum.h01r[l] = one.h01r[0]; vacuum.h01i[l] = one.h01i[0];
+      vacuum.h02r[l] = one.h02r[0]; vacuum.h02i[l] = one.h02i[0];
+      vacuum.h12r[l] = one.h12r[0]; vacuum.h12i[l] = one.h12i[0];
+    }
+    vacuum_d_cp = d_cp;
+    vacuum_type = type;
+    vacuum_valid = true;
+  }
+
+  // Energy and path of n points with the delta and type of SetPhase
+  void PropagateEnergies(int n, const double * energy, const double * path,
+			 double density, BargerProbabilityBuffer & buffer,
+			 bool vectorized = true)
+  {
+    Propagate(n, energy, 0, 0, path, density, buffer, vectorized);
+  }
+
+  /* Same arguments of propagateLinearBatch after SetMixing. With d_cp and
+     nuType null the ones of SetPhase are used for all the points. */
+  KERNEL_NO_CONTRACT
+  void Propagate(int n, const double * energy, const double * d_cp,
+		 const int * nuType, const double * path, double density,
+		 BargerProbabilityBuffer & buffer, bool vectorized = true)
+  {
+    const int W = KERNEL_LANES;
+    int i, j, l;
+    KernelVacuumLanes<W> block_vacuum;
+    double e[W], d[W], L[W], prob[3][3][W];
+    int t[W];
+
+    for (int first = 0; first < n; first += W) {
+      const int n_lanes = std::min(W, n - first);
+      // The last block is padded with copies of its last point
+      bool uniform = true;
+      for (l = 0; l < W; l++) {
+	int k = first + std::min(l, n_lanes - 1);
+	e[l] = energy[k]; L[l] = path[k];
+	d[l] = d_cp ? d_cp[k] : vacuum_d_cp;
+	t[l] = nuType ? nuType[k] : vacuum_type;
+	uniform = uniform && d[l] == d[0] && (t[l] > 0) == (t[0] > 0);
+      }
+
+      if (vectorized) {
+	const KernelVacuumLanes<W> * vac = &vacuum;
+	if (uniform)
+	  SetPhase(d[0], t[0]);
+	else {
+	  KernelVacuumBlockSIMD(mix, d, t, block_vacuum);
+	  vac = &block_vacuum;
+	}
+	ConstantDensityBlockSIMD(*vac, e, t, L, density, prob);
+      }
+      else {
+	for (l = 0; l < n_lanes; l++) {
+	  SetPhase(d[l], t[l]);
+	  KernelVacuumLanes<1> one;
+	  one.h00[0] = vacuum.h00[0];   one.h11[0] = vacuum.h11[0];
+	  one.h22[0] = vacuum.h22[0];
+	  one.h01r[0] = vacuum.h01r[0]; one.h01i[0] = vacuum.h01i[0];
+	  one.h02r[0] = vacuum.h02r[0]; one.h02i[0] = vacuum.h02i[0];
+	  one.h12r[0] = vacuum.h12r[0]; one.h12i[0] = vacuum.h12i[0];
+	  double p1[3][3][1];
+	  ConstantDensityBlock<1>(one, e + l, t + l, L + l, density, p1);
+	  for (i = 0; i < 3; i++)
+	    for (j = 0; j < 3; j++) prob[i][j][l] = p1[i][j][0];
+	}
+      }
+
+      for (i = 0; i < 3; i++)
+	for (j = 0; j < 3; j++)
+	  if (buffer.Prob[i][j])
+	    for (l = 0; l < n_lanes; l++) buffer.Prob[i][j][first + l] = prob[i][j][l];
+    }
+  }
+
+  const KernelMixing & GetMixing() const { return mix; }
+
+private:
+  KernelMixing mix;
+  bool   vacuum_valid;
+  double vacuum_d_cp;
+  int    vacuum_type;
+  KernelVacuumLanes<KERNEL_LANES> vacuum; // the same Hamiltonian in all lanes
+};
+
+/* Drop-in replacement of BargerPropagator::propagateLinearBatch with the same
+   arguments. With vectorized false every point goes through the scalar path. */
+inline void PropagateLinearKernel(int n, double x12, double x13, double x23,
+				  double dm21, double dm32, bool kSquared,
+				  const double * energy, const double * d_cp,
+				  const int * nuType, const double * path,
+				  double density, BargerProbabilityBuffer & buffer,
+				  bool vectorized = true)
+{
+  KernelPropagator kernel;
+  kernel.SetMixing(x12, x13, x23, dm21, dm32, kSquared);
+  kernel.Propagate(n, energy, d_cp, nuType, path, density, buffer, vectorized);
+}
+
+/* Maximum difference between the vectorized and the scalar path over the
+   full probability matrices of a batch (same arguments of
+   PropagateLinearKernel). Both paths are expected to agree to 1e-12. */
+inline double KernelPathDeviation(int n, double x12, double x13, double x23,
+				  double dm21, double dm32, bool kSquared,
+				  const double * energy, const double * d_cp,
+				  const int * nuType, const double * path,
+				  double density)
+{
+  std::vector<double> vec(9 * n), sca(9 * n);
+  BargerProbabilityBuffer bvec, bsca;
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++) {
+      bvec.Prob[i][j] = &vec[(3*i + j) * n];
+      bsca.Prob[i][j] = &sca[(3*i + j) * n];
+    }
+  PropagateLinearKernel(n, x12, x13, x23, dm21, dm32, kSquared, energy, d_cp,
+			nuType, path, density, bvec, true);
+  PropagateLinearKernel(n, x12, x13, x23, dm21, dm32, kSquared, energy, d_cp,
+			nuType, path, density, bsca, false);
+  double deviation = 0;
+  for (size_t k = 0; k < vec.size(); k++)
+    deviation = std::max(deviation, fabs(vec[k] - sca[k]));
+  return deviation;
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
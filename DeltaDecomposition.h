@@ -0,0 +1,134 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _DeltaDecomposition_
+#define _DeltaDecomposition_
+
+// C includes
+#include <math.h>
+
+// C++ includes
+#include <vector>
+
+// Prob3++ includes
+#include "BargerPropagator.h"
+
+// nu-vs-antinu includes
+#include "Profiler.h"
+
+/* Closed-form dependence of the oscillation probabilities on delta_CP.
+
+   In the standard parametrization delta only enters the PMNS matrix through
+   the phase matrix diag(1, 1, exp(i delta)) sitting between the theta23 and
+   theta13 rotations. In matter of constant density the potential commutes
+   with both the theta23 rotation and the phase matrix, therefore the
+   amplitude of every transition is a + b exp(i delta) + c exp(-i delta) and
+   any probability is a trigonometric polynomial in delta:
+
+     P(delta) = a0 + sum_n ( a_n cos(n delta) + b_n sin(n delta) )
+
+   For P(nu_mu -> nu_e) only the first harmonic is present, so the whole
+   ellipse is known after three propagations. The disappearance channels and
+   the mu <-> tau ones also need the second harmonic (five propagations).
+
+   The coefficients are extracted from 2*order+1 equally spaced samples of
+   delta with a discrete Fourier transform, which is exact for a
+   trigonometric polynomial of degree not larger than order. */
+
+#define DELTA_MAX_ORDER 2
+
+struct DeltaHarmonics
+{
+  int    order;
+  double a[DELTA_MAX_ORDER+1]; // cos(n delta) coefficients, a[0] is the constant
+  double b[DELTA_MAX_ORDER+1]; // sin(n delta) coefficients, b[0] is always zero
+
+  // Probability for the CP violation phase delta (in radiants)
+  double Eval(double delta) const
+  {
+    double p = a[0];
+    for (int n = 1; n <= order; n++)
+      p += a[n] * cos(n * delta) + b[n] * sin(n * delta);
+    return p;
+  }
+};
+
+/* Harmonics up to order of the probabilities prob[k] sampled at
+   delta = 2 pi k / (2*order+1), k = 0 ... 2*order */
+inline DeltaHarmonics DeltaHarmonicsFromSamples(int order, const double * prob)
+{
+  int k, n;
+  DeltaHarmonics h;
+  h.order = order;
+  const int n_samples = 2 * order + 1;
+  for (n = 0; n <= DELTA_MAX_ORDER; n++) h.a[n] = h.b[n] = 0;
+  for (k = 0; k < n_samples; k++) {
+    const double delta = 2 * M_PI * k / (double) n_samples;
+    h.a[0] += prob[k] / n_samples;
+    for (n = 1; n <= order; n++) {
+      h.a[n] += 2 * prob[k] * cos(n * delta) / n_samples;
+      h.b[n] += 2 * prob[k] * sin(n * delta) / n_samples;
+    }
+  }
+  return h;
+}
+
+/* Extract the harmonics of P(nuIn -> nuOut) (same convention as GetProb)
+   with 2*order+1 propagations through constant density matter.
+   The remaining parameters are the same ones of propagateLinearBatch. Like
+   ProfileLinearBatch it must be called in a scope of PROFILE_PROPAGATION. */
+inline DeltaHarmonics ExtractDeltaHarmonics(BargerPropagator * bNu, int order,
+					    int nuIn, int nuOut,
+					    double x12, double x13, double x23,
+					    double dm21, double dm32, bool kSquared,
+					    double energy, int type,
+					    double path, double density)
+{
+  if (order < 1) order = 1;
+  if (order > DELTA_MAX_ORDER) order = DELTA_MAX_ORDER;
+
+  const int n_samples = 2 * order + 1;
+  std::vector<double> s_energy(n_samples, energy);
+  std::vector<double> s_path(n_samples, path);
+  std::vector<double> s_delta(n_samples);
+  std::vector<int>    s_type(n_samples, type);
+  std::vector<double> s_prob(n_samples);
+  for (int k = 0; k < n_samples; k++)
+    s_delta[k] = 2 * M_PI * k / (double) n_samples;
+
+  BargerProbabilityBuffer buffer = {};
+  buffer.Prob[abs(nuIn) - 1][abs(nuOut) - 1] = &s_prob[0];
+  ProfileLinearBatch( bNu, n_samples, x12, x13, x23, dm21, dm32, kSquared,
+		      &s_energy[0], &s_delta[0], &s_type[0], &s_path[0],
+		      density, buffer );
+  return DeltaHarmonicsFromSamples( order, &s_prob[0] );
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
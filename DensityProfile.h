@@ -0,0 +1,342 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _DensityProfile_
+#define _DensityProfile_
+
+// C includes
+#include <math.h>
+#include <stdlib.h>
+
+// C++ includes
+#include <algorithm>
+#include <complex>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Prob3++ includes (only for BargerProbabilityBuffer)
+#include "BargerPropagator.h"
+
+// nu-vs-antinu includes
+#include "ConstantDensityKernel.h"
+
+/* Propagation along a baseline made of segments of constant density.
+
+   The evolution operator of the whole path is the product of the operators
+   of the segments, S = S_N ... S_2 S_1, each one computed in closed form like
+   in ConstantDensityKernel.h (Cardano eigenvalues and Sylvester's formula)
+   and with the same physical constants, so that a profile of one segment
+   agrees with Prob3++ to rounding.
+
+   As explained in DeltaDecomposition.h the matter potential commutes with
+   O = R23 diag(1, 1, exp(i delta)), so in every segment H = O H' O^+ where
+   H' is the real Hamiltonian with theta23 = delta = 0. Therefore
+
+     S = O (S'_N ... S'_1) O^+
+
+   and the product of the segments S' only depends on theta12, theta13, the
+   mass splittings, the energy and the beam type. SegmentedPropagator keeps
+   the products already computed, so along a scan of delta (and of theta23)
+   each point only costs the two 3x3 products with O, whatever the number of
+   segments. Segments with the same length and density are only computed
+   once per product. The cache is emptied when the mixing changes or when it
+   holds SEGMENT_CACHE_SIZE products, so that long energy scans, where it
+   does not help, do not grow it without limit.
+
+   The profile is a text file with the length in Km and the density in
+   g/cm^3 of one segment per line, from the source to the detector. Empty
+   lines and lines starting with '#' are skipped. */
+
+#define SEGMENT_CACHE_SIZE 4096
+
+struct DensitySegment
+{
+  double length;   // in Km
+  double density;  // in g/cm^3
+};
+
+inline std::vector<DensitySegment> ReadDensityProfile(const std::string & file_name)
+{
+  std::ifstream file(file_name.c_str());
+  if (!file.is_open())
+    throw std::runtime_error("cannot open the density profile " + file_name);
+
+  std::vector<DensitySegment> profile;
+  std::string line;
+  int line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    std::istringstream ss(line);
+    std::string first;
+    if (!(ss >> first) || first[0] == '#') continue;
+
+    std::ostringstream where;
+    where << file_name << ":" << line_number;
+    DensitySegment segment;
+    std::istringstream values(line);
+    std::string rest;
+    if (!(values >> segment.length >> segment.density) || (values >> rest))
+      throw std::runtime_error(where.str() + ": expected a length and a density");
+    if (segment.length < 0 || segment.density < 0)
+      throw std::runtime_error(where.str() + ": negative length or density");
+    profile.push_back(segment);
+  }
+
+  if (profile.empty())
+    throw std::runtime_error("the density profile " + file_name + " is empty");
+  return profile;
+}
+
+// Total length of a profile in Km
+inline double ProfileLength(const std::vector<DensitySegment> & profile)
+{
+  double length = 0;
+  for (size_t i = 0; i < profile.size(); i++) length += profile[i].length;
+  return length;
+}
+
+// Mean density of a profile in g/cm^3, weighted with the lengths
+inline double ProfileMeanDensity(const std::vector<DensitySegment> & profile)
+{
+  double sum = 0, length = ProfileLength(profile);
+  for (size_t i = 0; i < profile.size(); i++)
+    sum += profile[i].length * profile[i].density;
+  return length > 0 ? sum / length : 0;
+}
+
+class SegmentedPropagator
+{
+  public:
+
+      typedef std::complex<double> Complex;
+
+      SegmentedPropagator( ) : valid(false), n_segments(0) {}
+
+      // the segments from the source to the detector
+      void SetProfile( const std::vector<DensitySegment> & profile )
+      {
+	segment.clear();
+	segment_index.clear();
+	for (size_t i = 0; i < profile.size(); i++) {
+	  size_t k = 0;
+	  while (k < segment.size() && (segment[k].length != profile[i].length ||
+					segment[k].density != profile[i].density)) k++;
+	  if (k == segment.size()) segment.push_back(profile[i]);
+	  segment_index.push_back(k);
+	}
+	cache.clear();
+      }
+
+      // same arguments of BargerPropagator::SetMNS (without delta, energy and
+      // type); the cache is kept if only theta23 changes
+      void SetMixing( double x12, double x13, double x23, double dm21, double dm32,
+		      bool kSquared )
+      {
+	KernelMixing m = SetKernelMixing( x12, x13, x23, dm21, dm32, kSquared );
+	s23 = m.s23;
+	c23 = m.c23;
+	if (valid && m.s12 == mix.s12 && m.s13 == mix.s13 && m.dm21 == mix.dm21 &&
+	    m.dm31 == mix.dm31) return;
+	mix = m;
+	valid = true;
+	cache.clear();
+
+	// H' (times 2E) in vacuum = R13 R12 diag(0, DM21, DM31) R12^T R13^T
+	const double u[3][3] = {
+	  {   mix.c13*mix.c12,  mix.c13*mix.s12, mix.s13 },
+	  { - mix.s12,          mix.c12,         0       },
+	  { - mix.s13*mix.c12, - mix.s13*mix.s12, mix.c13 } };
+	const double m2[3] = { 0, mix.dm21, mix.dm31 };
+	for (int i = 0; i < 3; i++)
+	  for (int j = 0; j < 3; j++) {
+	    vacuum[i][j] = 0;
+	    for (int k = 0; k < 3; k++) vacuum[i][j] += u[i][k] * m2[k] * u[j][k];
+	  }
+      }
+
+      // probabilities for one energy (GeV), delta and beam type
+      void propagate( double Energy, double d_cp, int type )
+      {
+	const Complex (* p)[3] = Product( Energy, type );
+
+	// O = R23 diag(1, 1, exp(i delta)), delta -> -delta for anti-neutrinos
+	const Complex phase = std::polar( 1.0, type > 0 ? d_cp : - d_cp );
+	const Complex o[3][3] = {
+	  { 1, 0,     0           },
+	  { 0, c23,   s23 * phase },
+	  { 0, - s23, c23 * phase } };
+
+	Complex t[3][3]; // S' O^+
+	for (int i = 0; i < 3; i++)
+	  for (int j = 0; j < 3; j++) {
+	    t[i][j] = 0;
+	    for (int k = 0; k < 3; k++) t[i][j] += p[i][k] * std::conj(o[j][k]);
+	  }
+	for (int i = 0; i < 3; i++)
+	  for (int j = 0; j < 3; j++) {
+	    Complex s = 0;
+	    for (int k = 0; k < 3; k++) s += o[i][k] * t[k][j];
+	    prob[j][i] = std::norm(s); // S_ij is the j -> i amplitude
+	  }
+      }
+
+      // nu_ - 1:e 2:mu 3:tau (the sign is ignored, as in BargerPropagator)
+      double GetProb( int nuIn, int nuOut ) const
+      { return prob[abs(nuIn) - 1][abs(nuOut) - 1]; }
+
+      // number of segment operators computed so far
+      long long GetNSegments() const { return n_segments; }
+
+  private:
+
+      struct Transfer { Complex s[3][3]; };
+
+      // S'_N ... S'_1 for this energy and type, from the cache if possible
+      const Complex (* Product( double Energy, int type ))[3]
+      {
+	const std::pair<double, int> key( Energy, type > 0 ? 1 : -1 );
+	std::map<std::pair<double, int>, Transfer>::iterator it = cache.find(key);
+	if (it != cache.end()) return it->second.s;
+	if (cache.size() >= SEGMENT_CACHE_SIZE) cache.clear();
+
+	std::vector<Transfer> step(segment.size());
+	for (size_t k = 0; k < segment.size(); k++)
+	  Segment( Energy, key.second, segment[k], step[k].s );
+	n_segments += segment.size();
+
+	Transfer & product = cache[key];
+	for (int i = 0; i < 3; i++)
+	  for (int j = 0; j < 3; j++) product.s[i][j] = i == j ? 1 : 0;
+	for (size_t n = 0; n < segment_index.size(); n++) {
+	  const Complex (* s)[3] = step[segment_index[n]].s;
+	  Complex r[3][3];
+	  for (int i = 0; i < 3; i++)
+	    for (int j = 0; j < 3; j++) {
+	      r[i][j] = 0;
+	      for (int k = 0; k < 3; k++) r[i][j] += s[i][k] * product.s[k][j];
+	    }
+	  for (int i = 0; i < 3; i++)
+	    for (int j = 0; j < 3; j++) product.s[i][j] = r[i][j];
+	}
+	return product.s;
+      }
+
+      /* exp(-i H' L/2E) of one segment (up to a global phase) with the
+	 traceless G = H' - tr(H')/3, whose eigenvalues are the roots of
+	 x^3 + p x + q: S = sum_k exp(-i x_k phase) (G^2 + x_k G + x_k^2 + p)
+	 / (3 x_k^2 + p), or KernelDegenerateCoefficients when two of them
+	 are (nearly) equal */
+      void Segment( double Energy, int type, const DensitySegment & seg,
+		    Complex (* s)[3] ) const
+      {
+	int i, j, k;
+	const double A = type * KERNEL_TWORTTWOGF * KERNEL_DENSITY_CONVERT
+	  * seg.density * Energy;
+	const double phase = KERNEL_LOEFAC * seg.length / Energy;
+
+	double g[3][3], g2[3][3];
+	for (i = 0; i < 3; i++)
+	  for (j = 0; j < 3; j++) g[i][j] = vacuum[i][j];
+	g[0][0] += A;
+	const double t3 = (g[0][0] + g[1][1] + g[2][2]) / 3.0;
+	for (i = 0; i < 3; i++) g[i][i] -= t3;
+	for (i = 0; i < 3; i++)
+	  for (j = 0; j < 3; j++) {
+	    g2[i][j] = 0;
+	    for (k = 0; k < 3; k++) g2[i][j] += g[i][k] * g[k][j];
+	  }
+
+	const double p = g[0][0]*g[1][1] + g[0][0]*g[2][2] + g[1][1]*g[2][2]
+	  - g[0][1]*g[0][1] - g[0][2]*g[0][2] - g[1][2]*g[1][2];
+	const double q = - (g[0][0]*g[1][1]*g[2][2] + 2*g[0][1]*g[1][2]*g[0][2]
+			    - g[0][0]*g[1][2]*g[1][2] - g[1][1]*g[0][2]*g[0][2]
+			    - g[2][2]*g[0][1]*g[0][1]);
+	const double r = sqrt(std::max(- p / 3.0, 0.0));
+	double arg = r > 0 ? - q / (2 * r*r*r) : 0;
+	arg = arg > 1 ? 1 : (arg < -1 ? -1 : arg);
+	const double theta = acos(arg) / 3.0;
+	const double x[3] = { 2*r*cos(theta),
+			      r*(- cos(theta) + sqrt(3.0)*sin(theta)),
+			      r*(- cos(theta) - sqrt(3.0)*sin(theta)) };
+
+	Complex c2 = 0, c1 = 0, c0 = 0;
+	if (KernelDegenerate(x[0], x[1], x[2])) {
+	  KernelCoefficients c = KernelDegenerateCoefficients(x[0], x[1], x[2],
+							       phase);
+	  c2 = Complex(c.c2r, c.c2i);
+	  c1 = Complex(c.c1r, c.c1i);
+	  c0 = Complex(c.c0r, c.c0i);
+	}
+	else
+	  for (k = 0; k < 3; k++) {
+	    const Complex e = std::polar( 1.0, - x[k] * phase ) / (3*x[k]*x[k] + p);
+	    c2 += e;
+	    c1 += e * x[k];
+	    c0 += e * (x[k]*x[k] + p);
+	  }
+	for (i = 0; i < 3; i++)
+	  for (j = 0; j < 3; j++)
+	    s[i][j] = c2 * g2[i][j] + c1 * g[i][j] + (i == j ? c0 : Complex(0));
+      }
+
+      std::vector<DensitySegment> segment; // distinct segments of the profile
+      std::vector<size_t> segment_index;   // the profile as indices of segment
+      KernelMixing mix;
+      bool   valid;
+      double s23, c23;
+      double vacuum[3][3];
+      double prob[3][3];
+      long long n_segments;
+      std::map<std::pair<double, int>, Transfer> cache;
+};
+
+/* Same arguments and results of BargerPropagator::propagateLinearBatch, with
+   the path and the density replaced by the profile of bNu */
+inline void PropagateSegments( SegmentedPropagator & bNu, int n, double x12,
+			       double x13, double x23, double dm21, double dm32,
+			       bool kSquared, const double * energy,
+			       const double * d_cp, const int * nuType,
+			       BargerProbabilityBuffer & buffer )
+{
+  bNu.SetMixing( x12, x13, x23, dm21, dm32, kSquared );
+  for (int k = 0; k < n; k++) {
+    bNu.propagate( energy[k], d_cp[k], nuType[k] );
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+	if (buffer.Prob[i][j]) buffer.Prob[i][j][k] = bNu.GetProb( i + 1, j + 1 );
+  }
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
@@ -0,0 +1,153 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _Experiments_
+#define _Experiments_
+
+// C++ includes
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* Batch of experiments of --config: an INI file with one section per
+   experiment, whose settings are command line options (without "--")
+   applied on top of those of the command line.
+
+     # T2K is the default
+     [T2K]
+
+     [NOvA]
+     energy   = 2
+     distance = 810
+
+     [DUNE]
+     energy   = 2.5
+     distance = 1300
+     density  = 2.8
+
+   The settings before the first section apply to all the experiments. The
+   experiments share the workers and the computation of the ellipses, so
+   they can only change what goes in the rows of the table of scenarios: the
+   oscillation parameters, the density, the energy, the distance and the
+   table itself (EXPERIMENT_OPTIONS). Everything else (kernel, delta steps,
+   flux, ...) comes from the command line. Since --flux replaces the energy
+   and --density-profile the density and the distance of every row, an
+   experiment setting those together with them is rejected by
+   nu_vs_antinu. */
+
+static const char * const EXPERIMENT_OPTIONS[] = {
+  "DM21", "DM32NH", "DM32IH", "theta12", "theta13", "theta23LO", "theta23UO",
+  "density", "energy", "distance", "scenarios"
+};
+
+struct Experiment
+{
+  std::string name;                 // Directory of its graphs in the output
+  std::vector<std::string> options; // "--name", "value", ...
+};
+
+inline std::vector<Experiment> ReadExperimentFile(const std::string & file_name)
+{
+  std::ifstream file(file_name.c_str());
+  if (!file.is_open())
+    throw std::runtime_error("cannot open the experiment file " + file_name);
+
+  std::vector<std::string> common;
+  std::vector<Experiment> experiments;
+  std::string line;
+  int line_number = 0;
+  const char * blank = " \t\r";
+  while (std::getline(file, line)) {
+    line_number++;
+    const size_t first = line.find_first_not_of(blank);
+    if (first == std::string::npos || line[first] == '#' || line[first] == ';')
+      continue;
+    line = line.substr(first, line.find_last_not_of(blank) + 1 - first);
+
+    std::ostringstream where;
+    where << file_name << ":" << line_number;
+    if (line[0] == '[') {
+      Experiment experiment;
+      experiment.name = line.substr(1, line.size() - 2);
+      if (line[line.size() - 1] != ']' || experiment.name.empty() ||
+	  experiment.name.find_first_of("/ \t") != std::string::npos)
+	throw std::runtime_error(where.str() + ": invalid experiment " + line);
+      for (size_t e = 0; e < experiments.size(); e++)
+	if (experiments[e].name == experiment.name)
+	  throw std::runtime_error(where.str() + ": experiment " +
+				   experiment.name + " defined twice");
+      experiments.push_back(experiment);
+      continue;
+    }
+
+    const size_t equal = line.find('=');
+    if (equal == std::string::npos)
+      throw std::runtime_error(where.str() + ": expected name = value");
+    std::string name = line.substr(0, equal);
+    std::string value = line.substr(equal + 1);
+    name.erase(name.find_last_not_of(blank) + 1);
+    value.erase(0, value.find_first_not_of(blank));
+    const char * const * known_end = EXPERIMENT_OPTIONS +
+      sizeof(EXPERIMENT_OPTIONS) / sizeof(EXPERIMENT_OPTIONS[0]);
+    if (std::find(EXPERIMENT_OPTIONS, known_end, name) == known_end)
+      throw std::runtime_error(where.str() + ": " + name + " cannot be set by an"
+			       " experiment");
+    if (value.empty())
+      throw std::runtime_error(where.str() + ": missing value of " + name);
+
+    std::vector<std::string> & options = experiments.empty() ? common :
+      experiments.back().options;
+    for (size_t o = 0; o < options.size(); o += 2)
+      if (options[o] == "--" + name)
+	throw std::runtime_error(where.str() + ": " + name + " set twice");
+    options.push_back("--" + name);
+    options.push_back(value);
+  }
+
+  if (experiments.empty())
+    throw std::runtime_error("the experiment file " + file_name + " is empty");
+  // the common settings not replaced by the experiment
+  for (size_t e = 0; e < experiments.size(); e++) {
+    std::vector<std::string> & options = experiments[e].options;
+    const size_t n_own = options.size();
+    for (size_t c = 0; c < common.size(); c += 2)
+      if (std::find(options.begin(), options.begin() + n_own, common[c]) ==
+	  options.begin() + n_own) {
+	options.push_back(common[c]);
+	options.push_back(common[c + 1]);
+      }
+  }
+  return experiments;
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
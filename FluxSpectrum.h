@@ -0,0 +1,219 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _FluxSpectrum_
+#define _FluxSpectrum_
+
+// C includes
+#include <math.h>
+
+// C++ includes
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// ROOT includes
+#ifndef WITHOUT_ROOT
+#include "TFile.h"
+#include "TH1.h"
+#endif
+
+/* Quadrature for averaging the probabilities over a beam flux spectrum.
+
+   The spectrum is a histogram in energy (GeV). Every bin with positive
+   content is integrated with an n-point Gauss-Legendre rule, so that
+
+     <P> = sum_q weight[q] P(energy[q])
+
+   with the weights normalized to one. The same nodes are used for all the
+   values of delta and all the scenarios. */
+struct FluxQuadrature
+{
+  std::vector<double> energy; // nodes in GeV
+  std::vector<double> weight; // normalized to one
+
+  int    GetNNodes() const { return (int) energy.size(); }
+  double GetMeanEnergy() const
+  {
+    double mean = 0;
+    for (size_t q = 0; q < energy.size(); q++) mean += weight[q] * energy[q];
+    return mean;
+  }
+};
+
+/* Nodes and weights of the n-point Gauss-Legendre rule on [-1, 1] */
+inline void GaussLegendre(int n, std::vector<double> & x, std::vector<double> & w)
+{
+  x.resize(n);
+  w.resize(n);
+  for (int i = 0; i < n; i++) {
+    // Newton iterations from the asymptotic guess of the i-th root of P_n
+    double z = cos(M_PI * (i + 0.75) / (n + 0.5)), dp = 1;
+    for (int iter = 0; iter < 100; iter++) {
+      double p0 = 1, p1 = 0;
+      for (int j = 1; j <= n; j++) {
+	double p2 = p1;
+	p1 = p0;
+	p0 = ((2*j - 1) * z * p1 - (j - 1) * p2) / j;
+      }
+      dp = n * (z * p0 - p1) / (z*z - 1);
+      double dz = p0 / dp;
+      z -= dz;
+      if (fabs(dz) < 1e-15) break;
+    }
+    x[i] = z;
+    w[i] = 2 / ((1 - z*z) * dp*dp);
+  }
+}
+
+/* Build the quadrature of a histogram with n_bins = content.size() bins
+   given by n_bins+1 increasing edges, with n_nodes nodes per bin */
+inline FluxQuadrature MakeFluxQuadrature(const std::vector<double> & edges,
+					 const std::vector<double> & content,
+					 int n_nodes)
+{
+  if (n_nodes < 1)
+    throw std::runtime_error("the flux quadrature needs at least one node per bin");
+  if (content.empty() || edges.size() != content.size() + 1)
+    throw std::runtime_error("invalid flux histogram");
+
+  std::vector<double> x, w;
+  GaussLegendre(n_nodes, x, w);
+
+  FluxQuadrature flux;
+  double total = 0;
+  for (size_t b = 0; b < content.size(); b++) {
+    if (edges[b + 1] <= edges[b])
+      throw std::runtime_error("the flux bins must be increasing in energy");
+    if (content[b] < 0)
+      throw std::runtime_error("the flux must not be negative");
+    if (content[b] == 0) continue;
+    // the nodes are inside the bin, so a lower edge at zero is fine
+    if (edges[b] < 0)
+      throw std::runtime_error("the flux must be zero at negative energies");
+    const double center = 0.5 * (edges[b + 1] + edges[b]);
+    const double half   = 0.5 * (edges[b + 1] - edges[b]);
+    for (int i = 0; i < n_nodes; i++) {
+      flux.energy.push_back(center + half * x[i]);
+      flux.weight.push_back(0.5 * w[i] * content[b]);
+    }
+    total += content[b];
+  }
+  if (total <= 0)
+    throw std::runtime_error("the flux is empty");
+  for (size_t q = 0; q < flux.weight.size(); q++) flux.weight[q] /= total;
+  return flux;
+}
+
+/* Read a spectrum from a text file with two columns: energy in GeV and flux
+   per unit energy (any normalization), with increasing energies. Lines
+   starting with '#' are comments. Each point is taken as the center of a bin
+   extending half way to its neighbours. */
+inline void ReadFluxTable(const std::string & file_name,
+			  std::vector<double> & edges, std::vector<double> & content)
+{
+  std::ifstream file(file_name.c_str());
+  if (!file.is_open())
+    throw std::runtime_error("cannot open the flux file " + file_name);
+
+  std::vector<double> energy, flux;
+  std::string line;
+  int line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    std::istringstream ss(line);
+    std::string first;
+    if (!(ss >> first) || first[0] == '#') continue;
+    std::istringstream row(line);
+    double e, f;
+    std::string rest;
+    if (!(row >> e >> f) || (row >> rest)) {
+      std::ostringstream where;
+      where << file_name << ":" << line_number;
+      throw std::runtime_error(where.str() + ": expected two columns (energy flux)");
+    }
+    if (!energy.empty() && e <= energy.back())
+      throw std::runtime_error(file_name + ": the energies must be increasing");
+    energy.push_back(e);
+    flux.push_back(f);
+  }
+  if (energy.size() < 2)
+    throw std::runtime_error("the flux file " + file_name + " needs at least two points");
+
+  const size_t n = energy.size();
+  edges.resize(n + 1);
+  content.resize(n);
+  edges[0] = energy[0] - 0.5 * (energy[1] - energy[0]);
+  for (size_t i = 1; i < n; i++) edges[i] = 0.5 * (energy[i - 1] + energy[i]);
+  edges[n] = energy[n - 1] + 0.5 * (energy[n - 1] - energy[n - 2]);
+  if (edges[0] < 0) edges[0] = 0;
+  for (size_t i = 0; i < n; i++) content[i] = flux[i] * (edges[i + 1] - edges[i]);
+}
+
+/* Load a flux spectrum, either "file.root:histogram" (any TH1, the bin
+   contents being the number of neutrinos in each bin) or a two-column text
+   file (see ReadFluxTable), and build its quadrature */
+inline FluxQuadrature LoadFluxSpectrum(const std::string & spec, int n_nodes)
+{
+  std::vector<double> edges, content;
+  const size_t colon = spec.rfind(':');
+  if (colon != std::string::npos && colon >= 5 &&
+      spec.compare(colon - 5, 5, ".root") == 0) {
+#ifdef WITHOUT_ROOT
+    throw std::runtime_error("compiled without ROOT: the flux must be a text file");
+#else
+    const std::string file_name = spec.substr(0, colon);
+    const std::string histo_name = spec.substr(colon + 1);
+    // the file (and the histogram it owns) is closed and deleted on return
+    std::unique_ptr<TFile> file(TFile::Open(file_name.c_str()));
+    if (!file || file->IsZombie())
+      throw std::runtime_error("cannot open the flux file " + file_name);
+    TH1 * histo = dynamic_cast<TH1 *>(file->Get(histo_name.c_str()));
+    if (!histo)
+      throw std::runtime_error("no histogram " + histo_name + " in " + file_name);
+    const int n_bins = histo->GetNbinsX();
+    edges.resize(n_bins + 1);
+    content.resize(n_bins);
+    for (int b = 1; b <= n_bins; b++) {
+      edges[b - 1] = histo->GetBinLowEdge(b);
+      content[b - 1] = histo->GetBinContent(b);
+    }
+    edges[n_bins] = histo->GetBinLowEdge(n_bins) + histo->GetBinWidth(n_bins);
+#endif
+  }
+  else
+    ReadFluxTable(spec, edges, content);
+  return MakeFluxQuadrature(edges, content, n_nodes);
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
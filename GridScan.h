@@ -0,0 +1,236 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _GridScan_
+#define _GridScan_
+
+// C includes
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// C++ includes
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Prob3++ includes
+#include "BargerPropagator.h"
+
+// nu-vs-antinu includes
+#include "WorkerPool.h"
+#include "Scenario.h"
+#include "ConstantDensityKernel.h"
+#include "ColumnArena.h"
+
+/* Scan of P(nu_mu -> nu_e) and P(nu_mu_bar -> nu_e_bar) over a regular grid
+   of theta23 x DM32 x delta x energy x distance.
+
+   The grid is streamed to a binary file in chunks of a fixed number of
+   points, so that only one chunk is kept in memory at a time. Each chunk is
+   split among the parallel workers (see WorkerPool.h) and written to disk in
+   order, so the file does not depend on the number of workers.
+
+   File layout (native endianness):
+     char     magic[8]      "NVAGRID"
+     uint64_t n_axes        always 5
+     n_axes times:
+       char     name[16]    theta23, DM32, delta, energy, distance
+       double   min, max    range of the axis (same units of Scenario)
+       uint64_t n           number of points, min and max included
+     double   theta12, theta13, DM21, density
+     then for every point of the grid, with theta23 the slowest and distance
+     the fastest varying axis, two doubles: P(mu->e), P(mu_bar->e_bar) */
+
+struct GridAxis
+{
+  std::string name;
+  double      min;
+  double      max;
+  uint64_t    n;
+
+  double Value(uint64_t i) const
+  { return n > 1 ? min + (max - min) * i / (double) (n - 1) : min; }
+};
+
+/* Parse an axis given as "min:max:n" or as a single value "x" */
+inline GridAxis ParseGridAxis(const std::string & name, const std::string & range)
+{
+  GridAxis axis;
+  axis.name = name;
+  std::string r = range;
+  std::replace(r.begin(), r.end(), ':', ' ');
+  std::istringstream ss(r);
+  long long n = 1;
+  if (!(ss >> axis.min))
+    throw std::runtime_error("invalid range \"" + range + "\" for the " + name + " axis");
+  axis.max = axis.min;
+  if (ss >> axis.max) {
+    if (!(ss >> n) || n < 1)
+      throw std::runtime_error("the range of the " + name + " axis must be min:max:n");
+  }
+  std::string rest;
+  if (ss >> rest)
+    throw std::runtime_error("invalid range \"" + range + "\" for the " + name + " axis");
+  axis.n = n;
+  return axis;
+}
+
+/* Run the scan on the grid of the five axes (theta23, DM32, delta, energy,
+   distance in this order) with the remaining parameters taken from fixed.
+   The results are written to file_name in chunks of chunk_size points.
+   kernel is the oscillation code, one of PropagatorKind (see Scenario.h). */
+inline void RunGridScan(const Scenario & fixed, const GridAxis axes[5],
+			uint64_t chunk_size, int n_workers,
+			const std::string & file_name, int kernel = PROPAGATOR_BARGER)
+{
+  uint64_t i, n_points = 1;
+  for (i = 0; i < 5; i++) n_points *= axes[i].n;
+  if (chunk_size < 1) chunk_size = 1;
+  chunk_size = std::min(chunk_size, n_points);
+  if (n_workers < 1) n_workers = 1;
+
+  /* The file, the propagators and the chunk buffer are released by their
+     owners also when a worker fails and ParallelFor throws */
+  std::unique_ptr<FILE, int (*)(FILE *)> file(fopen(file_name.c_str(), "wb"),
+					     fclose);
+  if (!file) throw std::runtime_error("cannot open " + file_name);
+
+  // Header
+  char magic[8] = "NVAGRID";
+  uint64_t n_axes = 5;
+  fwrite(magic, sizeof(magic), 1, file.get());
+  fwrite(&n_axes, sizeof(n_axes), 1, file.get());
+  for (i = 0; i < 5; i++) {
+    char name[16];
+    memset(name, 0, sizeof(name));
+    strncpy(name, axes[i].name.c_str(), sizeof(name) - 1);
+    fwrite(name, sizeof(name), 1, file.get());
+    fwrite(&axes[i].min, sizeof(double), 1, file.get());
+    fwrite(&axes[i].max, sizeof(double), 1, file.get());
+    fwrite(&axes[i].n, sizeof(uint64_t), 1, file.get());
+  }
+  double fixed_parameters[4] = { fixed.theta12, fixed.theta13, fixed.DM21, fixed.density };
+  fwrite(fixed_parameters, sizeof(double), 4, file.get());
+
+  // One propagator per worker
+  std::vector<std::unique_ptr<BargerPropagator> > bNu_worker(n_workers);
+  for (int w = 0; w < n_workers; w++) {
+    bNu_worker[w].reset( new BargerPropagator( ) );
+    bNu_worker[w]->UseMassEigenstates( false );
+  }
+
+  // The chunk buffer is shared with the workers: (P, P_bar) for every point
+  ColumnArena chunk_arena(true);
+  chunk_arena.Reserve(1, 2 * chunk_size);
+  double * chunk = chunk_arena.Column(0);
+  const uint64_t task_size = std::min<uint64_t>(MAX_TASK_POINTS,
+    std::max<uint64_t>(256, (chunk_size + 4*n_workers - 1) / (4*n_workers)));
+  const uint64_t n_inner = axes[2].n * axes[3].n * axes[4].n;
+
+  for (uint64_t first = 0; first < n_points; first += chunk_size) {
+    const uint64_t n_chunk = std::min(chunk_size, n_points - first);
+    const uint64_t n_tasks = (n_chunk + task_size - 1) / task_size;
+
+    ParallelFor(n_workers, n_tasks, [&](int worker, uint64_t task) {
+	const uint64_t task_first = first + task * task_size;
+	const uint64_t task_end = std::min(first + n_chunk, task_first + task_size);
+	std::vector<double> energy, delta, path, mu2e, mu2mu, mu2tau;
+	std::vector<int> type;
+
+	/* Split the task in runs of points sharing theta23 and DM32, since
+	   propagateLinearBatch works with a fixed set of mixing parameters.
+	   Each run is a batch: first all neutrinos, then all anti-neutrinos. */
+	for (uint64_t run = task_first; run < task_end; ) {
+	  const uint64_t outer = run / n_inner;
+	  const uint64_t run_end = std::min(task_end, (outer + 1) * n_inner);
+	  const int n = run_end - run;
+	  const double theta23 = axes[0].Value(outer / axes[1].n);
+	  const double DM32    = axes[1].Value(outer % axes[1].n);
+
+	  energy.resize(2*n); delta.resize(2*n); path.resize(2*n); type.resize(2*n);
+	  mu2e.resize(2*n); mu2mu.resize(2*n); mu2tau.resize(2*n);
+	  for (int p = 0; p < n; p++) {
+	    uint64_t inner = (run + p) % n_inner;
+	    path[p]   = path[n + p]   = axes[4].Value(inner % axes[4].n);
+	    inner /= axes[4].n;
+	    energy[p] = energy[n + p] = axes[3].Value(inner % axes[3].n);
+	    delta[p]  = delta[n + p]  = axes[2].Value(inner / axes[3].n);
+	    type[p] = 1;
+	    type[n + p] = -1;
+	  }
+
+	  BargerProbabilityBuffer buffer = {};
+	  buffer.Prob[1][0] = &mu2e[0];
+	  buffer.Prob[1][1] = &mu2mu[0];
+	  buffer.Prob[1][2] = &mu2tau[0];
+	  {
+	    ProfileScope scope( PROFILE_PROPAGATION, 2*n );
+	    if (kernel == PROPAGATOR_SIMD)
+	      PropagateLinearKernel( 2*n, fixed.theta12, fixed.theta13, theta23,
+				     fixed.DM21, DM32, true, &energy[0], &delta[0],
+				     &type[0], &path[0], fixed.density, buffer );
+	    else if (kernel == PROPAGATOR_STATIC)
+	      PropagateLinearStatic<true>( 2*n, fixed.theta12, fixed.theta13, theta23,
+					   fixed.DM21, DM32, &energy[0], &delta[0],
+					   &type[0], &path[0], fixed.density, buffer );
+	    else
+	      ProfileLinearBatch( bNu_worker[worker].get(), 2*n, fixed.theta12,
+				  fixed.theta13, theta23, fixed.DM21, DM32,
+				  true, &energy[0], &delta[0], &type[0],
+				  &path[0], fixed.density, buffer );
+	  }
+	  {
+	    ProfileScope scope( PROFILE_UNITARITY, 2*n );
+	    CheckUnitarity( 2*n, buffer, &energy[0] );
+	  }
+
+	  for (int p = 0; p < n; p++) {
+	    chunk[2*(run - first + p)]     = mu2e[p];
+	    chunk[2*(run - first + p) + 1] = mu2e[n + p];
+	  }
+	  run = run_end;
+	}
+      });
+
+    ProfileScope scope( PROFILE_FILE_WRITE );
+    if (fwrite(chunk, sizeof(double), 2 * n_chunk, file.get()) != 2 * n_chunk)
+      throw std::runtime_error("cannot write to " + file_name);
+    std::cout << "  Grid scan: " << first + n_chunk << " / " << n_points
+	      << " points written." << std::endl;
+  }
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
@@ -0,0 +1,301 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _Optimiser_
+#define _Optimiser_
+
+// C includes
+#include <math.h>
+#include <stdint.h>
+
+// C++ includes
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Prob3++ includes
+#include "BargerPropagator.h"
+
+// nu-vs-antinu includes
+#include "WorkerPool.h"
+#include "Scenario.h"
+#include "GridScan.h"
+#include "DeltaDecomposition.h"
+#include "Separation.h"
+#include "Profiler.h"
+
+/* Search of the distance and of the energy of the beam which separate best
+   two groups of scenarios, by default the two hierarchies, through constant
+   density matter (propagateLinear).
+
+   The separation at (distance, energy) is the minimum distance in the
+   (P, P_bar) plane between the ellipses of the rows of the two groups, all
+   moved to that distance and energy (see Separation.h): it is zero when the
+   hierarchies are degenerate for some delta and octant. The ellipses are
+   drawn from the closed-form delta dependence (see DeltaDecomposition.h),
+   three propagations per row and beam type, at n_delta steps in delta.
+
+   The search starts from the grid of the two axes, which is also the heat
+   map of the output, and refines it level by level. Every cell between four
+   points is split in four and its new points are computed only if the
+   separation inside it can still beat the best point found so far by more
+   than tolerance. The bound of a cell is the largest separation at its
+   corners plus K times half of its diagonal, K being OPTIMISER_SAFETY times
+   the steepest slope seen so far between two corners of a cell (in units of
+   the steps of the grid), so the cells far below the best point are dropped
+   at once and those near it after a few levels. K is measured and not
+   known, so a peak narrower than a cell of the grid can still be missed:
+   the grid is the resolution of the search.
+
+   All the new points of a level are computed together by the parallel
+   workers (see WorkerPool.h), each with its own propagator and its own slot
+   of shared memory, so the result does not depend on the number of
+   workers. */
+
+#define OPTIMISER_SAFETY 2
+
+struct OptimiserPoint
+{
+  double distance;   // in Km
+  double energy;     // in GeV
+  double separation; // minimum distance between the ellipses of the groups
+  int    level;      // of the refinement, 0 for the grid
+};
+
+struct OptimiserResult
+{
+  OptimiserPoint best;
+  std::vector<double> map;            // separation on the grid, energy fastest
+  std::vector<OptimiserPoint> points; // all the points, in the order computed
+  std::vector<size_t> n_refined;      // cells refined at each level
+  std::vector<size_t> n_pruned;       // cells dropped at each level
+};
+
+/* Separation between the rows of table with side 0 and those with side 1
+   (-1 for neither) at distance and energy */
+inline double HierarchySeparation(BargerPropagator * bNu,
+				  const std::vector<Scenario> & table,
+				  const std::vector<int> & side, double distance,
+				  double energy, int n_delta)
+{
+  std::vector<double> xy;
+  std::vector<double> delta(n_delta);
+  for (int k = 0; k < n_delta; k++) delta[k] = 2 * M_PI * k / n_delta;
+
+  size_t n_rows = 0, r = 0;
+  for (size_t s = 0; s < table.size(); s++) if (side[s] >= 0) n_rows++;
+  xy.resize(2 * n_rows * n_delta);
+
+  std::vector<SeparationCurve> curves[2];
+  for (size_t s = 0; s < table.size(); s++) {
+    if (side[s] < 0) continue;
+    const Scenario & row = table[s];
+    double * x = &xy[2 * r * n_delta];
+    double * y = x + n_delta;
+    for (int t = 0; t < 2; t++) {
+      const int nu = t == 0 ? 1 : -1;
+      DeltaHarmonics h;
+      {
+	ProfileScope scope( PROFILE_PROPAGATION, 3 );
+	h = ExtractDeltaHarmonics( bNu, 1, 2*nu, nu, row.theta12, row.theta13,
+				   row.theta23, row.DM21, row.DM32, true, energy,
+				   nu, distance, row.density );
+      }
+      double * p = t == 0 ? x : y;
+      for (int k = 0; k < n_delta; k++) p[k] = h.Eval(delta[k]);
+    }
+    SeparationCurve curve = { x, y, &delta[0], (size_t) n_delta };
+    curves[side[s]].push_back(curve);
+    r++;
+  }
+
+  ProfileScope scope( PROFILE_SEPARATION );
+  return MinimumDistance(curves[0], curves[1]);
+}
+
+/* Search the distance x energy plane for the largest separation between
+   the rows of table of group[0] and those of group[1], with at most
+   n_levels refinements of the grid */
+inline OptimiserResult OptimiseBaseline(const std::vector<Scenario> & table,
+					const std::string group[2],
+					const GridAxis & distance,
+					const GridAxis & energy, int n_levels,
+					double tolerance, int n_delta,
+					int n_workers)
+{
+  if (n_workers < 1) n_workers = 1;
+  if (n_levels < 0 || n_levels > 20)
+    throw std::runtime_error("the levels of the optimiser must be between 0 and 20");
+  if (distance.min <= 0 || energy.min <= 0 || distance.max < distance.min ||
+      energy.max < energy.min)
+    throw std::runtime_error("the axes of the optimiser must be positive and"
+			     " increasing");
+
+  std::vector<int> side(table.size(), -1);
+  for (size_t s = 0; s < table.size(); s++)
+    for (int g = 0; g < 2; g++)
+      if (table[s].group == group[g]) side[s] = g;
+  for (int g = 0; g < 2; g++)
+    if (std::find(side.begin(), side.end(), g) == side.end())
+      throw std::runtime_error("no scenario in the group " + group[g]);
+
+  /* The points are on a lattice 2^n_levels times finer than the grid: the
+     point (i, j) of the grid is (i << n_levels, j << n_levels). An axis of
+     a single point has no cells along it. */
+  typedef std::pair<int64_t, int64_t> Node;
+  const int64_t scale = (int64_t) 1 << n_levels;
+  const bool split[2] = { distance.n > 1, energy.n > 1 };
+  const double unit[2] = { distance.n > 1 ? (distance.max - distance.min) /
+			   ((distance.n - 1) * (double) scale) : 0,
+			   energy.n > 1 ? (energy.max - energy.min) /
+			   ((energy.n - 1) * (double) scale) : 0 };
+  std::map<Node, double> value;
+
+  std::vector<BargerPropagator *> bNu_worker(n_workers);
+  for (int w = 0; w < n_workers; w++) {
+    bNu_worker[w] = new BargerPropagator( );
+    bNu_worker[w]->UseMassEigenstates( false );
+  }
+
+  OptimiserResult result;
+  auto compute = [&](const std::vector<Node> & nodes, int level) {
+    if (nodes.empty()) return;
+    double * separation = SharedAlloc<double>(nodes.size());
+    try {
+      ParallelFor(n_workers, nodes.size(), [&](int worker, uint64_t n) {
+	  separation[n] = HierarchySeparation(bNu_worker[worker], table, side,
+					      distance.min + unit[0] * nodes[n].first,
+					      energy.min + unit[1] * nodes[n].second,
+					      n_delta);
+	});
+    }
+    catch(...) {
+      SharedFree(separation, nodes.size());
+      throw;
+    }
+    for (size_t n = 0; n < nodes.size(); n++) {
+      value[nodes[n]] = separation[n];
+      OptimiserPoint point = { distance.min + unit[0] * nodes[n].first,
+			       energy.min + unit[1] * nodes[n].second,
+			       separation[n], level };
+      result.points.push_back(point);
+      // the first of the best ones, whatever the order of the workers
+      if (result.points.size() == 1 || point.separation > result.best.separation)
+	result.best = point;
+    }
+    SharedFree(separation, nodes.size());
+  };
+
+  std::vector<Node> nodes;
+  for (uint64_t i = 0; i < distance.n; i++)
+    for (uint64_t j = 0; j < energy.n; j++)
+      nodes.push_back(Node(i * scale, j * scale));
+  try {
+    compute(nodes, 0);
+  }
+  catch(...) {
+    for (int w = 0; w < n_workers; w++) delete bNu_worker[w];
+    throw;
+  }
+  for (size_t n = 0; n < nodes.size(); n++) result.map.push_back(value[nodes[n]]);
+
+  // The cells by their lower corner, all of the size of the level
+  std::vector<Node> cells;
+  if (split[0] || split[1])
+    for (uint64_t i = 0; i + split[0] < distance.n; i++)
+      for (uint64_t j = 0; j + split[1] < energy.n; j++)
+	cells.push_back(Node(i * scale, j * scale));
+
+  double slope = 0; // in units of the steps of the grid
+  for (int level = 1; level <= n_levels && !cells.empty(); level++) {
+    const int64_t size = scale >> (level - 1);
+    const int64_t side_size[2] = { split[0] ? size : 0, split[1] ? size : 0 };
+    const double half_diagonal = .5 * sqrt((double) (side_size[0] * side_size[0] +
+						    side_size[1] * side_size[1])) / scale;
+
+    double corner[4];
+    for (size_t c = 0; c < cells.size(); c++) {
+      for (int k = 0; k < 4; k++)
+	corner[k] = value[Node(cells[c].first + (k & 1) * side_size[0],
+			       cells[c].second + (k >> 1) * side_size[1])];
+      if (split[0])
+	slope = std::max(slope, std::max(fabs(corner[1] - corner[0]),
+					 fabs(corner[3] - corner[2])) * scale / size);
+      if (split[1])
+	slope = std::max(slope, std::max(fabs(corner[2] - corner[0]),
+					 fabs(corner[3] - corner[1])) * scale / size);
+    }
+
+    std::vector<Node> children;
+    std::set<Node> queued;
+    nodes.clear();
+    const int64_t half[2] = { side_size[0] / 2, side_size[1] / 2 };
+    for (size_t c = 0; c < cells.size(); c++) {
+      double bound = -HUGE_VAL;
+      for (int k = 0; k < 4; k++)
+	bound = std::max(bound, value[Node(cells[c].first + (k & 1) * side_size[0],
+					   cells[c].second + (k >> 1) * side_size[1])]);
+      bound += OPTIMISER_SAFETY * slope * half_diagonal;
+      if (bound <= result.best.separation + tolerance) continue;
+
+      for (int k = 0; k < 4; k++) {
+	if (((k & 1) && !split[0]) || ((k >> 1) && !split[1])) continue;
+	children.push_back(Node(cells[c].first + (k & 1) * half[0],
+				cells[c].second + (k >> 1) * half[1]));
+      }
+      for (int64_t i = 0; i <= 2; i++)
+	for (int64_t j = 0; j <= 2; j++) {
+	  const Node node(cells[c].first + i * half[0], cells[c].second + j * half[1]);
+	  if (!value.count(node) && queued.insert(node).second)
+	    nodes.push_back(node);
+	}
+    }
+    result.n_refined.push_back(children.size() / (split[0] && split[1] ? 4 : 2));
+    result.n_pruned.push_back(cells.size() - result.n_refined.back());
+
+    try {
+      compute(nodes, level);
+    }
+    catch(...) {
+      for (int w = 0; w < n_workers; w++) delete bNu_worker[w];
+      throw;
+    }
+    cells.swap(children);
+  }
+
+  for (int w = 0; w < n_workers; w++) delete bNu_worker[w];
+  return result;
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
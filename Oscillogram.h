@@ -0,0 +1,144 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _Oscillogram_
+#define _Oscillogram_
+
+// C includes
+#include <math.h>
+#include <stdint.h>
+
+// C++ includes
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+// Prob3++ includes
+#include "BargerPropagator.h"
+
+// nu-vs-antinu includes
+#include "WorkerPool.h"
+#include "ColumnArena.h"
+#include "Scenario.h"
+#include "GridScan.h"
+#include "Profiler.h"
+
+/* Atmospheric oscillograms: P(nu_mu -> nu_e) and P(nu_mu_bar -> nu_e_bar)
+   on a grid of cos(zenith) x energy, for every row of a scenario table and
+   every value of delta, through the layered Earth of Prob3++
+   (BargerPropagator::DefinePath + propagate).
+
+   The density profile along the path only depends on the zenith angle, so
+   the work is split in one task per cos(zenith) row. DefinePath is called
+   once at the beginning of the row and its profile is then shared by all
+   the scenarios, the values of delta and the energies of the row, which only
+   call SetMNS + propagate. The rows are computed by the parallel workers (see
+   WorkerPool.h), each with its own propagator.
+
+   The results are columns of a shared ColumnArena, one column for each
+   scenario s, value of delta d and beam type t (0: neutrinos 1:
+   anti-neutrinos), column (s * n_delta + d) * 2 + t, each with the
+   n_cos_zenith x n_energy points of the map and cos(zenith) as the slowest
+   varying index. The rows of the table only give the oscillation
+   parameters: their density, energy and distance are not used. */
+
+// i-th point of an energy axis, logarithmically spaced from min to max
+inline double LogAxisValue(const GridAxis & axis, uint64_t i)
+{
+  return axis.n > 1 ? axis.min * pow(axis.max / axis.min, i / (double) (axis.n - 1))
+    : axis.min;
+}
+
+/* Compute the oscillograms of table on the cos_zenith (linear) x energy
+   (logarithmic) grid for every value of the delta axis, with neutrinos
+   produced at height Km above the ground */
+inline void RunOscillogram(const std::vector<Scenario> & table,
+			   const GridAxis & cos_zenith, const GridAxis & energy,
+			   const GridAxis & delta, double height, int n_workers,
+			   ColumnArena & results)
+{
+  if (n_workers < 1) n_workers = 1;
+  if (cos_zenith.min < -1 || cos_zenith.max > 1)
+    throw std::runtime_error("cos(zenith) must be between -1 and 1");
+  if (energy.min <= 0 || energy.max <= 0)
+    throw std::runtime_error("the energies of the oscillogram must be positive");
+
+  const size_t n_maps = 2 * table.size() * delta.n;
+  const size_t n_energy = energy.n;
+  results.Reserve(n_maps, cos_zenith.n * n_energy);
+
+  std::vector<double> energy_value(n_energy);
+  for (size_t e = 0; e < n_energy; e++) energy_value[e] = LogAxisValue(energy, e);
+
+  // deleted also when a worker fails and ParallelFor throws
+  std::vector<std::unique_ptr<BargerPropagator> > bNu_worker(n_workers);
+  for (int w = 0; w < n_workers; w++) {
+    bNu_worker[w].reset( new BargerPropagator( ) );
+    bNu_worker[w]->UseMassEigenstates( false );
+  }
+
+  ParallelFor(n_workers, cos_zenith.n, [&](int worker, uint64_t row) {
+      BargerPropagator * bNu = bNu_worker[worker].get();
+      // the layers of the path are part of the propagation through the Earth
+      ProfileScope scope( PROFILE_PROPAGATION, n_maps * n_energy );
+      bNu->DefinePath( cos_zenith.Value(row), height );
+
+      for (size_t s = 0; s < table.size(); s++) {
+	const Scenario & r = table[s];
+	for (uint64_t d = 0; d < delta.n; d++)
+	  for (int t = 0; t < 2; t++) {
+	    const int nu = t == 0 ? 1 : -1;
+	    double * map = results.Column((s * delta.n + d) * 2 + t) + row * n_energy;
+	    for (size_t e = 0; e < n_energy; e++) {
+	      {
+		ProfileScope setmns( PROFILE_SETMNS, 1, PROFILE_PROPAGATION );
+		bNu->SetMNS( r.theta12, r.theta13, r.theta23, r.DM21, r.DM32,
+			     delta.Value(d), energy_value[e], true, nu );
+	      }
+	      bNu->propagate( nu );
+	      // the same check of CheckUnitarity, which fails the run
+	      double total_prob = bNu->GetProb(2*nu, nu) + bNu->GetProb(2*nu, 2*nu)
+		+ bNu->GetProb(2*nu, 3*nu);
+	      if ( !(total_prob <= 1.00001 && total_prob >= 0.99998) )
+		{
+		  std::ostringstream message;
+		  message << "the probabilities sum up to " << total_prob
+			  << " (cos(zenith) " << cos_zenith.Value(row)
+			  << ", energy " << energy_value[e] << " GeV)";
+		  throw std::runtime_error(message.str()); }
+	      map[e] = bNu->GetProb(2*nu, nu);
+	    }
+	  }
+      }
+    });
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
@@ -0,0 +1,342 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _ProbabilityTable_
+#define _ProbabilityTable_
+
+// C includes
+#include <math.h>
+#include <stdint.h>
+
+// C++ includes
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Prob3++ includes
+#include "BargerPropagator.h"
+
+// nu-vs-antinu includes
+#include "WorkerPool.h"
+#include "Scenario.h"
+#include "ConstantDensityKernel.h"
+#include "DeltaDecomposition.h"
+#include "ColumnFile.h"
+#include "Profiler.h"
+
+/* Lookup table of P(nu_mu -> nu_e) and P(nu_mu_bar -> nu_e_bar) as a
+   function of the energy and of delta, for the other parameters of one row
+   of a scenario table, through constant density matter.
+
+   In delta the probabilities are exactly a + b cos(delta) + c sin(delta)
+   (see DeltaDecomposition.h), so the table keeps these three harmonics of
+   each beam type as functions of the energy and has no error in delta. In
+   energy each harmonic is a clamped cubic spline in log(E) on n equal
+   intervals from energy_min to energy_max, kept as the four coefficients of
+   the cubic of every interval, so that a query costs a log, three cubics
+   and the cos and sin of delta, which the caller can also pass already
+   computed. Outside the range the first or the last cubic is extrapolated.
+
+   The slopes at the ends of the splines come from two more nodes beyond
+   each end. After the build the table is compared with the propagation at
+   the middle of every interval, where the error of a spline is largest, and
+   TABLE_SAFETY times the largest deviation of P over all delta
+   (|da| + hypot(db, dc)) of both beam types is GetErrorEstimate(). It is an
+   estimate of the largest error, not a bound: the margin covers the shift
+   of the largest error away from the middle, a few per cent where the table
+   is accurate, but a table with too few intervals for the oscillations
+   (errors of 0.1 and more) can be worse than its estimate. With a tolerance
+   the number of intervals is doubled until the estimate is below it, or
+   there are TABLE_MAX_INTERVALS. All the propagations of a build go
+   through the oscillation code in batches of TABLE_BATCH energies split
+   among the parallel workers.
+
+   The tables are stored in column files (see ColumnFile.h): the table of
+   the row with label l is the column "l/table" and the parameters "l/..."
+   (its oscillation parameters, "l/energy_min", "l/energy_max",
+   "l/error_estimate"). A table read from a file uses the mapping in place, so
+   all the jobs which read the same file share one copy of it in memory. */
+
+#define TABLE_MAX_INTERVALS (1 << 20)
+#define TABLE_BATCH         1024 // energies propagated at once by a worker
+#define TABLE_SAFETY        1.5  // margin of the estimate over the error at the midpoints
+
+// Coefficients of an interval: 4 for each harmonic (a, b, c) and beam type
+#define TABLE_STRIDE 24
+
+class ProbabilityTable
+{
+  public:
+
+      /* Tabulate the probabilities of row (its energy is not used) from
+	 energy_min to energy_max (GeV) in n_intervals intervals, or more
+	 until the estimate of the error is below tolerance if it is positive.
+	 kernel is the oscillation code, one of PropagatorKind (see
+	 Scenario.h). */
+      ProbabilityTable( const Scenario & row, double energy_min, double energy_max,
+			int n_intervals, double tolerance = 0, int n_workers = 1,
+			int kernel = PROPAGATOR_BARGER )
+	: scenario(row), file(NULL)
+      {
+	if (energy_min <= 0 || energy_max <= energy_min)
+	  throw std::runtime_error("the energies of the table must be positive and"
+				   " increasing");
+	if (n_intervals < 3 || n_intervals > TABLE_MAX_INTERVALS)
+	  throw std::runtime_error("the table needs between 3 and 2^20 intervals");
+	log_min = log(energy_min);
+	log_max = log(energy_max);
+	for (n = n_intervals; ; n *= 2) {
+	  Build(n_workers, kernel);
+	  if (tolerance <= 0 || error_estimate <= tolerance || 2 * n > TABLE_MAX_INTERVALS)
+	    break;
+	}
+      }
+
+      // The table of the row label of a column file
+      ProbabilityTable( const std::string & file_name, const std::string & label )
+	: file(new ColumnFile(file_name))
+      {
+	try {
+	  const std::string p = label + "/";
+	  scenario.label    = label;
+	  scenario.theta12  = file->GetParameter(p + "theta12");
+	  scenario.theta13  = file->GetParameter(p + "theta13");
+	  scenario.theta23  = file->GetParameter(p + "theta23");
+	  scenario.DM21     = file->GetParameter(p + "DM21");
+	  scenario.DM32     = file->GetParameter(p + "DM32");
+	  scenario.density  = file->GetParameter(p + "density");
+	  scenario.distance = file->GetParameter(p + "distance");
+	  scenario.energy   = 0;
+	  log_min   = log(file->GetParameter(p + "energy_min"));
+	  log_max   = log(file->GetParameter(p + "energy_max"));
+	  error_estimate = file->GetParameter(p + "error_estimate");
+	  size_t size = 0;
+	  coefficients = file->FindColumn(p + "table", &size);
+	  if (!coefficients || size < 3 * TABLE_STRIDE || size % TABLE_STRIDE != 0)
+	    throw std::runtime_error("no table " + label + " in " + file_name);
+	  n = size / TABLE_STRIDE;
+	  inv_step = n / (log_max - log_min);
+	}
+	catch(...) {
+	  delete file;
+	  throw;
+	}
+      }
+
+     ~ProbabilityTable( ) { delete file; }
+
+      // P(mu -> e) for type > 0, P(mu_bar -> e_bar) for type < 0
+      double Eval( double energy, double delta, int type ) const
+	{ return Eval(energy, cos(delta), sin(delta), type); }
+
+      double Eval( double energy, double cos_delta, double sin_delta, int type ) const
+      {
+	const double x = (log(energy) - log_min) * inv_step;
+	const int i = std::min(std::max((int) floor(x), 0), (int) n - 1);
+	const double s = x - i;
+	const double * c = coefficients + i * TABLE_STRIDE + (type > 0 ? 0 : 12);
+	const double a = ((c[3] * s + c[2]) * s + c[1]) * s + c[0];
+	const double b = ((c[7] * s + c[6]) * s + c[5]) * s + c[4];
+	const double d = ((c[11] * s + c[10]) * s + c[9]) * s + c[8];
+	return a + b * cos_delta + d * sin_delta;
+      }
+
+      // Add the table (column "<label>/table") and its parameters to writer
+      void AddToFile( ColumnFileWriter & writer ) const
+      {
+	const std::string p = scenario.label + "/";
+	writer.AddParameter(p + "theta12", scenario.theta12);
+	writer.AddParameter(p + "theta13", scenario.theta13);
+	writer.AddParameter(p + "theta23", scenario.theta23);
+	writer.AddParameter(p + "DM21", scenario.DM21);
+	writer.AddParameter(p + "DM32", scenario.DM32);
+	writer.AddParameter(p + "density", scenario.density);
+	writer.AddParameter(p + "distance", scenario.distance);
+	writer.AddParameter(p + "energy_min", GetEnergyMin());
+	writer.AddParameter(p + "energy_max", GetEnergyMax());
+	writer.AddParameter(p + "error_estimate", error_estimate);
+	writer.AddColumn(p + "table", coefficients, n * TABLE_STRIDE);
+      }
+
+      const Scenario & GetScenario() const { return scenario; }
+      double GetEnergyMin() const { return exp(log_min); }
+      double GetEnergyMax() const { return exp(log_max); }
+      size_t GetNIntervals() const { return n; }
+      double GetErrorEstimate() const { return error_estimate; }
+
+  private:
+
+      ProbabilityTable( const ProbabilityTable & );
+      ProbabilityTable & operator=( const ProbabilityTable & );
+
+      void Build( int n_workers, int kernel );
+
+      Scenario scenario;
+      double log_min, log_max, inv_step;
+      size_t n;                     // intervals
+      double error_estimate;
+      std::vector<double> own;      // the coefficients of a table built here
+      ColumnFile * file;            // the mapping of a table read from a file
+      const double * coefficients;  // TABLE_STRIDE per interval
+};
+
+/* Harmonics a, b, c of P(mu -> e) and then of P(mu_bar -> e_bar) of row at
+   the n_energy energies, six per energy, with three propagations per energy
+   and beam type in one batch */
+inline void TableHarmonics( const Scenario & row, int n_energy, const double * energy,
+			    BargerPropagator * bNu, int kernel, double * harmonics )
+{
+  const int n = 6 * n_energy;
+  std::vector<double> p_energy(n), p_delta(n), p_path(n, row.distance), prob(n);
+  std::vector<int> p_type(n);
+  for (int i = 0; i < n; i++) {
+    p_energy[i] = energy[i / 6];
+    p_delta[i] = 2 * M_PI * (i % 3) / 3.0;
+    p_type[i] = i % 6 < 3 ? 1 : -1;
+  }
+  BargerProbabilityBuffer buffer = {};
+  buffer.Prob[1][0] = &prob[0];
+  {
+    ProfileScope scope( PROFILE_PROPAGATION, n );
+    if (kernel == PROPAGATOR_SIMD)
+      PropagateLinearKernel( n, row.theta12, row.theta13, row.theta23, row.DM21,
+			     row.DM32, true, &p_energy[0], &p_delta[0], &p_type[0],
+			     &p_path[0], row.density, buffer );
+    else if (kernel == PROPAGATOR_STATIC)
+      PropagateLinearStatic<true>( n, row.theta12, row.theta13, row.theta23, row.DM21,
+				   row.DM32, &p_energy[0], &p_delta[0], &p_type[0],
+				   &p_path[0], row.density, buffer );
+    else
+      ProfileLinearBatch( bNu, n, row.theta12, row.theta13, row.theta23,
+			  row.DM21, row.DM32, true, &p_energy[0], &p_delta[0],
+			  &p_type[0], &p_path[0], row.density, buffer );
+  }
+  for (int k = 0; k < 2 * n_energy; k++) {
+    const DeltaHarmonics h = DeltaHarmonicsFromSamples( 1, &prob[3 * k] );
+    harmonics[3 * k]     = h.a[0];
+    harmonics[3 * k + 1] = h.a[1];
+    harmonics[3 * k + 2] = h.b[1];
+  }
+}
+
+inline void ProbabilityTable::Build( int n_workers, int kernel )
+{
+  if (n_workers < 1) n_workers = 1;
+  const double step = (log_max - log_min) / n;
+  inv_step = 1 / step;
+
+  /* The n+1 nodes with two more at each end, for the slopes there, and
+     then the midpoints of the intervals */
+  const size_t n_nodes = n + 5;
+  const size_t n_energy = n_nodes + n;
+  std::vector<double> energy(n_energy);
+  for (size_t k = 0; k < n_nodes; k++)
+    energy[k] = exp(log_min + ((double) k - 2) * step);
+  for (size_t k = 0; k < n; k++)
+    energy[n_nodes + k] = exp(log_min + (k + .5) * step);
+
+  std::vector<BargerPropagator *> bNu_worker(n_workers);
+  for (int w = 0; w < n_workers; w++) {
+    bNu_worker[w] = new BargerPropagator( );
+    bNu_worker[w]->UseMassEigenstates( false );
+  }
+  double * harmonics = SharedAlloc<double>(6 * n_energy);
+  try {
+    const uint64_t n_batches = (n_energy + TABLE_BATCH - 1) / TABLE_BATCH;
+    ParallelFor(n_workers, n_batches, [&](int worker, uint64_t batch) {
+	const size_t first = batch * (size_t) TABLE_BATCH;
+	const int size = std::min<size_t>(TABLE_BATCH, n_energy - first);
+	TableHarmonics(scenario, size, &energy[first], bNu_worker[worker], kernel,
+		       harmonics + 6 * first);
+      });
+  }
+  catch(...) {
+    SharedFree(harmonics, 6 * n_energy);
+    for (int w = 0; w < n_workers; w++) delete bNu_worker[w];
+    throw;
+  }
+  for (int w = 0; w < n_workers; w++) delete bNu_worker[w];
+
+  /* The clamped spline of each of the six functions, with the slopes at the
+     ends from the centred differences of five nodes, solved for the second
+     derivatives m (in units of the step) */
+  own.assign(n * TABLE_STRIDE, 0);
+  std::vector<double> f(n + 1), m(n + 1), diagonal(n + 1), rhs(n + 1);
+  for (int j = 0; j < 6; j++) {
+    const double * g = harmonics + 12 + j; // g[6 * k] at the node k, from -2
+    for (size_t k = 0; k <= n; k++) f[k] = g[6 * k];
+    const double slope0 = (g[-12] - 8 * g[-6] + 8 * g[6] - g[12]) / 12;
+    const double slope1 = (g[6 * (n-2)] - 8 * g[6 * (n-1)] + 8 * g[6 * (n+1)] -
+			   g[6 * (n+2)]) / 12;
+    // tridiagonal system with ones off the diagonal (Thomas algorithm)
+    diagonal[0] = 2;
+    rhs[0] = 6 * (f[1] - f[0] - slope0);
+    for (size_t k = 1; k <= n; k++) {
+      const double d = k < n ? 4 : 2;
+      const double r = k < n ? 6 * (f[k+1] - 2 * f[k] + f[k-1]) :
+	6 * (slope1 - (f[n] - f[n-1]));
+      diagonal[k] = d - 1 / diagonal[k-1];
+      rhs[k] = r - rhs[k-1] / diagonal[k-1];
+    }
+    m[n] = rhs[n] / diagonal[n];
+    for (size_t k = n; k-- > 0; ) m[k] = (rhs[k] - m[k+1]) / diagonal[k];
+
+    // neutrinos first, then anti-neutrinos, a, b, c for each
+    const size_t offset = (j / 3) * 12 + (j % 3) * 4;
+    for (size_t k = 0; k < n; k++) {
+      double * c = &own[k * TABLE_STRIDE + offset];
+      c[0] = f[k];
+      c[1] = f[k+1] - f[k] - (2 * m[k] + m[k+1]) / 6;
+      c[2] = m[k] / 2;
+      c[3] = (m[k+1] - m[k]) / 6;
+    }
+  }
+  coefficients = &own[0];
+
+  // the error at the midpoints, over all delta
+  error_estimate = 0;
+  for (size_t k = 0; k < n; k++) {
+    const double * exact = harmonics + 6 * (n_nodes + k);
+    for (int t = 0; t < 2; t++) {
+      const double * c = &own[k * TABLE_STRIDE + 12 * t];
+      double error[3];
+      for (int h = 0; h < 3; h++)
+	error[h] = (((c[4*h+3] * .5 + c[4*h+2]) * .5 + c[4*h+1]) * .5 + c[4*h]) -
+	  exact[3 * t + h];
+      error_estimate = std::max(error_estimate,
+				fabs(error[0]) + hypot(error[1], error[2]));
+    }
+  }
+  error_estimate *= TABLE_SAFETY;
+  SharedFree(harmonics, 6 * n_energy);
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
@@ -0,0 +1,254 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _Profiler_
+#define _Profiler_
+
+// C includes
+#include <stdlib.h>
+
+// C++ includes
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+
+// nu-vs-antinu includes
+#include "WorkerPool.h"
+
+/* Scoped timers and call counters of the main phases of a run (--profile).
+
+   Every phase has a counter of the time spent in it and of its calls. A
+   ProfileScope object adds the time between its construction and its
+   destruction to the counter of its phase. Until ProfileEnable is called
+   the counters do not exist and a ProfileScope costs a single test, so the
+   scopes can stay in the hot paths.
+
+   The counters live in memory shared with the parallel workers (see
+   WorkerPool.h), so the phases run by the workers are counted too. Their
+   times are summed over the workers, so with more than one worker the share
+   of the total wall time can exceed 100%.
+
+   The table of the phases is printed when the program exits. */
+
+#if ATOMIC_LLONG_LOCK_FREE != 2
+#error "std::atomic<long long> must be lock-free to be shared between processes"
+#endif
+
+enum ProfilePhase
+{
+  PROFILE_OPTIONS,     // parsing of the command line
+  PROFILE_SETUP,       // input files (scenario table, flux) and histograms
+  PROFILE_PROPAGATION, // propagateLinear (or the kernel), per point
+  PROFILE_SETMNS,      // SetMNS of Prob3++, per call (the kernels do it inline)
+  PROFILE_UNITARITY,   // check of the total probability, per point
+  PROFILE_FILL,        // filling of the bins of the scans, per point
+  PROFILE_GRAPHS,      // construction of the TGraph or TH1 objects
+  PROFILE_FILE_OPEN,   // creation of the output file
+  PROFILE_FILE_WRITE,  // Write and Close of the output file
+  PROFILE_SEPARATION,  // separation metrics of the hierarchies
+  PROFILE_BANDS,       // quantiles of the uncertainty bands
+  PROFILE_N_PHASES
+};
+
+inline const char * ProfilePhaseName( int phase )
+{
+  static const char * name[PROFILE_N_PHASES] = {
+    "options", "setup", "propagation", "SetMNS", "unitarity check",
+    "bin filling",
+    "graphs", "file open", "file write", "separation", "bands" };
+  return name[phase];
+}
+
+struct ProfileCounter
+{
+  std::atomic<long long> ns;
+  std::atomic<long long> calls;
+};
+
+// The counters of all the phases, NULL while the profiling is disabled
+inline ProfileCounter *& ProfileTable( )
+{
+  static ProfileCounter * table = NULL;
+  return table;
+}
+
+inline long long ProfileNow( )
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>
+    (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class ProfileScope
+{
+  public:
+
+      // calls is the number of calls (or points) done by the scope; the time
+      // of a scope nested in one of the phase parent is taken off parent
+      ProfileScope( int phase, long long calls = 1, int parent = -1 )
+	: counter(ProfileTable() ? ProfileTable() + phase : NULL), calls(calls),
+	  parent(parent), start(0)
+	{ if (counter) start = ProfileNow(); }
+     ~ProfileScope( ) { Stop(); }
+
+      // end the phase before the end of the scope
+      void Stop( )
+	{
+	  if (!counter) return;
+	  const long long ns = ProfileNow() - start;
+	  counter->ns.fetch_add(ns, std::memory_order_relaxed);
+	  counter->calls.fetch_add(calls, std::memory_order_relaxed);
+	  if (parent >= 0)
+	    ProfileTable()[parent].ns.fetch_add(-ns, std::memory_order_relaxed);
+	  counter = NULL;
+	}
+
+  private:
+
+      ProfileScope( const ProfileScope & );
+      ProfileScope & operator=( const ProfileScope & );
+
+      ProfileCounter * counter;
+      long long calls;
+      int    parent;
+      long long start;
+};
+
+// Add a phase measured by hand (e.g. before the profiling was enabled)
+inline void ProfileAdd( int phase, long long ns, long long calls = 1 )
+{
+  if (!ProfileTable()) return;
+  ProfileTable()[phase].ns.fetch_add(ns, std::memory_order_relaxed);
+  ProfileTable()[phase].calls.fetch_add(calls, std::memory_order_relaxed);
+}
+
+/* propagateLinearBatch of a BargerPropagator (the arguments are the same)
+   with the time of its SetMNS calls in the phase PROFILE_SETMNS. It must be
+   called inside a scope of PROFILE_PROPAGATION, which then counts only the
+   propagateLinear calls. The propagator is a template parameter only to keep
+   Prob3++ out of this file. */
+template<class Propagator, class Buffer>
+inline void ProfileLinearBatch( Propagator * bNu, int n, double x12, double x13,
+				double x23, double dm21, double dm32, bool kSquared,
+				const double * energy, const double * d_cp,
+				const int * nuType, const double * path,
+				double density, Buffer & buffer )
+{
+  if (!ProfileTable()) {
+    bNu->propagateLinearBatch( n, x12, x13, x23, dm21, dm32, kSquared, energy,
+			       d_cp, nuType, path, density, buffer );
+    return;
+  }
+  // the same sequence of calls of propagateLinearBatch
+  for (int k = 0; k < n; k++) {
+    if (k == 0 || energy[k] != energy[k-1] || d_cp[k] != d_cp[k-1]
+	|| nuType[k] != nuType[k-1]) {
+      ProfileScope scope( PROFILE_SETMNS, 1, PROFILE_PROPAGATION );
+      bNu->SetMNS( x12, x13, x23, dm21, dm32, d_cp[k], energy[k], kSquared,
+		   nuType[k] );
+    }
+    bNu->propagateLinear( nuType[k], path[k], density );
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+	if (buffer.Prob[i][j]) buffer.Prob[i][j][k] = bNu->GetProb(i + 1, j + 1);
+  }
+}
+
+// Start time of the run and JSON file of the report
+inline long long & ProfileStart( ) { static long long start = 0; return start; }
+inline std::string & ProfileJsonFile( ) { static std::string file; return file; }
+
+/* Print the table of the phases on the standard output, and write it to
+   ProfileJsonFile() if not empty. The total is the wall time since the
+   start given to ProfileEnable. */
+inline void ProfileReport( )
+{
+  ProfileCounter * table = ProfileTable();
+  if (!table) return;
+  const double total = 1e-9 * (ProfileNow() - ProfileStart());
+
+  std::ios::fmtflags flags = std::cout.flags();
+  std::streamsize precision = std::cout.precision();
+  std::cout << std::endl << "  Profile (wall time " << std::fixed
+	    << std::setprecision(6) << total << " s):" << std::endl
+	    << "      phase                 time [s]    share        calls"
+	    << "   mean [ns]" << std::endl;
+  for (int p = 0; p < PROFILE_N_PHASES; p++) {
+    const long long calls = table[p].calls;
+    if (calls == 0) continue;
+    const double time = 1e-9 * table[p].ns;
+    std::cout << "      " << std::left << std::setw(18) << ProfilePhaseName(p)
+	      << std::right << std::setprecision(6) << std::setw(12) << time
+	      << std::setprecision(1) << std::setw(8) << 100 * time / total << "%"
+	      << std::setw(13) << calls << std::setw(12)
+	      << 1e9 * time / calls << std::endl;
+  }
+  std::cout.flags(flags);
+  std::cout.precision(precision);
+
+  if (ProfileJsonFile().empty()) return;
+  std::ofstream json(ProfileJsonFile().c_str());
+  if (!json.is_open()) {
+    std::cerr << "  Error: cannot open " << ProfileJsonFile() << "\n";
+    return;
+  }
+  json << std::setprecision(9) << "{\n  \"wall_time\": " << total
+       << ",\n  \"phases\": [";
+  bool first = true;
+  for (int p = 0; p < PROFILE_N_PHASES; p++) {
+    const long long calls = table[p].calls;
+    if (calls == 0) continue;
+    const double time = 1e-9 * table[p].ns;
+    json << (first ? "\n" : ",\n") << "    {\"phase\": \"" << ProfilePhaseName(p)
+	 << "\", \"time\": " << time << ", \"share\": " << time / total
+	 << ", \"calls\": " << calls << ", \"mean_ns\": " << 1e9 * time / calls
+	 << "}";
+    first = false;
+  }
+  json << "\n  ]\n}\n";
+}
+
+/* Create the counters and print the report at exit. start is the time
+   (ProfileNow) of the beginning of the run. */
+inline void ProfileEnable( long long start, const std::string & json_file = "" )
+{
+  if (ProfileTable()) return;
+  ProfileCounter * table = SharedAlloc<ProfileCounter>(PROFILE_N_PHASES);
+  for (int p = 0; p < PROFILE_N_PHASES; p++) new (table + p) ProfileCounter();
+  ProfileStart() = start;
+  ProfileJsonFile() = json_file;
+  ProfileTable() = table;
+  atexit(ProfileReport);
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
@@ -0,0 +1,217 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _ResultCache_
+#define _ResultCache_
+
+// C includes
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// C++ includes
+#include <deque>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// nu-vs-antinu includes
+#include "ColumnFile.h"
+
+/* Content-addressed cache of results on disk (--cache).
+
+   A result is a set of named columns of doubles identified by a key, the
+   list of every number it depends on (the oscillation parameters, the
+   settings of the computation and RESULT_CACHE_VERSION). The file of a
+   result is <directory>/<hash of the key>.nva, a column file (see
+   ColumnFile.h) holding the key itself in the column "key", so that a
+   collision of the hashes is detected and counts as a miss.
+
+   The files are written to a temporary name and then renamed, so concurrent
+   runs sharing a directory never see a partial file. Nothing is ever
+   deleted: removing the directory empties the cache.
+
+   RESULT_CACHE_VERSION must be increased whenever a change of the code
+   changes the results, to invalidate the old files.
+
+   With SetMemory the last results stored or read are also kept in memory,
+   with or without a directory, and looked up there first: a long running
+   process (the server of --serve) then answers the same request twice
+   without propagating again nor reading the disk. */
+
+#define RESULT_CACHE_VERSION 2
+#define RESULT_CACHE_MEMORY  1024 // results kept in memory by the server
+
+class ResultCache
+{
+  public:
+
+      ResultCache( ) : memory_size(0), n_hits(0), n_misses(0) {}
+
+      // use this directory, created if needed; an empty name disables the cache
+      void SetDirectory( const std::string & name )
+      {
+	directory = name;
+	if (name.empty()) return;
+	if (mkdir(name.c_str(), 0777) != 0 && errno != EEXIST)
+	  throw std::runtime_error("cannot create the cache directory " + name);
+      }
+
+      // keep also the last n results in memory (0 disables it)
+      void SetMemory( size_t n )
+      {
+	memory_size = n;
+	while (memory_order.size() > memory_size) {
+	  memory.erase(memory_order.front());
+	  memory_order.pop_front();
+	}
+      }
+
+      bool Enabled() const { return !directory.empty() || memory_size > 0; }
+
+      // the columns stored under key, false if there are none
+      bool Load( const std::vector<double> & key,
+		 const std::vector<std::string> & names,
+		 std::vector< std::vector<double> > & columns )
+      {
+	if (!Enabled()) return false;
+	std::map< std::vector<double>, std::vector< std::vector<double> > >::const_iterator
+	  kept = memory.find(key);
+	if (kept != memory.end() && kept->second.size() == names.size()) {
+	  columns = kept->second;
+	  n_hits++;
+	  return true;
+	}
+	if (!directory.empty() && access(FileName(key).c_str(), R_OK) == 0) {
+	  try {
+	    ColumnFile file(FileName(key));
+	    size_t n = 0;
+	    const double * stored = file.FindColumn("key", &n);
+	    if (file.GetParameter("version") == RESULT_CACHE_VERSION &&
+		stored && n == key.size() &&
+		memcmp(stored, &key[0], n * sizeof(double)) == 0) {
+	      columns.resize(names.size());
+	      size_t c;
+	      for (c = 0; c < names.size(); c++) {
+		const double * data = file.FindColumn(names[c], &n);
+		if (!data) break;
+		columns[c].assign(data, data + n);
+	      }
+	      if (c == names.size()) {
+		Keep(key, columns);
+		n_hits++;
+		return true;
+	      }
+	    }
+	  }
+	  catch(std::exception &) {} // a damaged file is a miss
+	}
+	n_misses++;
+	return false;
+      }
+
+      // false if the result cannot be written (the cache is only an help, so
+      // this is not an error)
+      bool Store( const std::vector<double> & key,
+		  const std::vector<std::string> & names,
+		  const std::vector< std::vector<double> > & columns )
+      {
+	Keep(key, columns);
+	if (directory.empty()) return memory_size > 0;
+	std::ostringstream temporary;
+	temporary << FileName(key) << ".tmp" << getpid();
+	try {
+	  ColumnFileWriter writer;
+	  writer.AddParameter("version", RESULT_CACHE_VERSION);
+	  writer.AddColumn("key", &key[0], key.size());
+	  for (size_t c = 0; c < names.size(); c++)
+	    writer.AddColumn(names[c], columns[c].empty() ? NULL : &columns[c][0],
+			     columns[c].size());
+	  writer.Write(temporary.str());
+	}
+	catch(std::exception &) {
+	  unlink(temporary.str().c_str());
+	  return false;
+	}
+	if (rename(temporary.str().c_str(), FileName(key).c_str()) != 0) {
+	  unlink(temporary.str().c_str());
+	  return false;
+	}
+	return true;
+      }
+
+      long long GetNHits()   const { return n_hits; }
+      long long GetNMisses() const { return n_misses; }
+
+  private:
+
+      // keep a result in memory, dropping the oldest one if there are too many
+      void Keep( const std::vector<double> & key,
+		 const std::vector< std::vector<double> > & columns )
+      {
+	if (memory_size == 0 || memory.count(key)) return;
+	if (memory_order.size() >= memory_size) {
+	  memory.erase(memory_order.front());
+	  memory_order.pop_front();
+	}
+	memory[key] = columns;
+	memory_order.push_back(key);
+      }
+
+      // 64 bit FNV-1a hash of the version and of the bytes of the key
+      std::string FileName( const std::vector<double> & key ) const
+      {
+	uint64_t hash = 14695981039346656037ULL;
+	const double version = RESULT_CACHE_VERSION;
+	const unsigned char * byte = (const unsigned char *) &version;
+	for (size_t i = 0; i < sizeof(double); i++)
+	  hash = (hash ^ byte[i]) * 1099511628211ULL;
+	byte = (const unsigned char *) &key[0];
+	for (size_t i = 0; i < key.size() * sizeof(double); i++)
+	  hash = (hash ^ byte[i]) * 1099511628211ULL;
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx", (unsigned long long) hash);
+	return directory + "/" + name + ".nva";
+      }
+
+      std::string directory;
+      size_t memory_size;
+      std::map< std::vector<double>, std::vector< std::vector<double> > > memory;
+      std::deque< std::vector<double> > memory_order; // oldest first
+      long long n_hits;
+      long long n_misses;
+};
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
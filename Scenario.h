@@ -0,0 +1,959 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _Scenario_
+#define _Scenario_
+
+// C includes
+#include <math.h>
+
+// C++ includes
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Prob3++ includes
+#include "BargerPropagator.h"
+
+// nu-vs-antinu includes
+#include "WorkerPool.h"
+#include "DeltaDecomposition.h"
+#include "ConstantDensityKernel.h"
+#include "StaticPropagator.h"
+#include "DensityProfile.h"
+#include "ResultCache.h"
+#include "FluxSpectrum.h"
+#include "ColumnArena.h"
+#include "Profiler.h"
+
+/* A scenario is one row of the table of ellipses to be drawn: a complete set
+   of oscillation parameters, the name of its graph and the values of delta
+   for which a marker point is drawn. The k-th marker of all the rows sharing
+   the same group are collected in a single graph named <group>_<k>, so that
+   for example NH_0 contains the delta = 0 point of both octants. */
+struct Scenario
+{
+  std::string label;  // Name of the ellipse graph
+  std::string group;  // Name prefix of the marker graphs
+  double theta12;     // Sin^2(theta12)
+  double theta13;     // Sin^2(theta13)
+  double theta23;     // Sin^2(theta23)
+  double DM21;        // in eV^2
+  double DM32;        // in eV^2
+  double density;     // in g/cm^3
+  double energy;      // in GeV
+  double distance;    // in Km
+  std::vector<double> markers; // delta values of the markers in radiants
+};
+
+/* Read a table of scenarios from a text file. Each non-empty line that does
+   not start with '#' is a row made of the following eleven columns:
+
+     label group theta12 theta13 theta23 DM21 DM32 density energy distance markers
+
+   with the same units of the command line options (DM21 in 10^-5 eV^2, DM32
+   in 10^-3 eV^2). A "-" stands for the value of the same parameter in the
+   defaults scenario (i.e. the command line). The markers are a comma
+   separated list of delta values in units of pi (e.g. 0,0.5,1,1.5) or "-" for
+   no markers. */
+inline std::vector<Scenario> ReadScenarioTable(const std::string & file_name,
+					       const Scenario & defaults)
+{
+  std::ifstream file(file_name.c_str());
+  if (!file.is_open())
+    throw std::runtime_error("cannot open the scenario table " + file_name);
+
+  std::vector<Scenario> table;
+  std::string line;
+  int line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    std::istringstream ss(line);
+    std::vector<std::string> col;
+    std::string word;
+    while (ss >> word) col.push_back(word);
+    if (col.empty() || col[0][0] == '#') continue;
+
+    std::ostringstream where;
+    where << file_name << ":" << line_number;
+    if (col.size() != 11)
+      throw std::runtime_error(where.str() + ": expected 11 columns");
+
+    Scenario s = defaults;
+    double * value[8] = { &s.theta12, &s.theta13, &s.theta23, &s.DM21,
+			  &s.DM32, &s.density, &s.energy, &s.distance };
+    double unit[8] = { 1, 1, 1, 1e-5, 1e-3, 1, 1, 1 };
+    s.label = col[0];
+    s.group = col[1];
+    for (int i = 0; i < 8; i++) {
+      if (col[i + 2] == "-") continue;
+      char * end;
+      *value[i] = strtod(col[i + 2].c_str(), &end) * unit[i];
+      if (*end != '\0')
+	throw std::runtime_error(where.str() + ": invalid number " + col[i + 2]);
+    }
+    s.markers.clear();
+    if (col[10] != "-") {
+      std::istringstream markers(col[10]);
+      while (std::getline(markers, word, ',')) {
+	char * end;
+	s.markers.push_back(strtod(word.c_str(), &end) * M_PI);
+	if (*end != '\0')
+	  throw std::runtime_error(where.str() + ": invalid marker " + word);
+      }
+    }
+    table.push_back(s);
+  }
+
+  if (table.empty())
+    throw std::runtime_error("the scenario table " + file_name + " is empty");
+  return table;
+}
+
+/* Check that the parameters of row are within their physical ranges: the
+   Sin^2 of the angles between 0 and 1, DM21 positive, DM32 not zero, the
+   density and the distance not negative, the energy positive and every
+   number finite. Out of these ranges the propagators return NaN or
+   nonsense, so the row is rejected with an exception before propagating. */
+inline void CheckScenario(const Scenario & row)
+{
+  const std::string where = "the scenario " + row.label + ": ";
+  const double angle[3] = { row.theta12, row.theta13, row.theta23 };
+  const char * angle_name[3] = { "theta12", "theta13", "theta23" };
+  for (int i = 0; i < 3; i++)
+    if (!(angle[i] >= 0 && angle[i] <= 1))
+      throw std::runtime_error(where + "Sin^2(" + angle_name[i] + ") must be"
+			       " between 0 and 1");
+  if (!(row.DM21 > 0 && isfinite(row.DM21)))
+    throw std::runtime_error(where + "DM21 must be positive");
+  if (!(row.DM32 != 0 && isfinite(row.DM32)))
+    throw std::runtime_error(where + "DM32 must be finite and not zero");
+  if (!(row.density >= 0 && isfinite(row.density)))
+    throw std::runtime_error(where + "the density cannot be negative");
+  if (!(row.energy > 0 && isfinite(row.energy)))
+    throw std::runtime_error(where + "the energy must be positive");
+  if (!(row.distance >= 0 && isfinite(row.distance)))
+    throw std::runtime_error(where + "the distance cannot be negative");
+  for (size_t k = 0; k < row.markers.size(); k++)
+    if (!isfinite(row.markers[k]))
+      throw std::runtime_error(where + "the markers must be finite");
+}
+
+/* The oscillation codes: Prob3++, the vectorized kernel of
+   ConstantDensityKernel.h and the compile-time specialised propagators of
+   StaticPropagator.h */
+enum PropagatorKind
+{
+  PROPAGATOR_BARGER = 0,
+  PROPAGATOR_SIMD   = 1,
+  PROPAGATOR_STATIC = 2
+};
+
+/* Check that the muon (anti-)neutrino row of every probability matrix in the
+   batch sums up to one. If it does not, something went really wrong in the
+   propagator and an exception is thrown, which fails the run (or only the
+   request of the server). */
+inline void CheckUnitarity(int n, const BargerProbabilityBuffer & buffer,
+			   const double * energy)
+{
+  double total_prob;
+  for(int i = 0; i < n; i++) {
+    total_prob = buffer.Prob[1][0][i] + buffer.Prob[1][1][i] + buffer.Prob[1][2][i];
+    if ( !(total_prob <= 1.00001 && total_prob >= 0.99998) ) // also NaN
+      {
+	std::ostringstream message;
+	message << "the probabilities of point " << i << " sum up to " << total_prob
+		<< " (energy " << energy[i] << " GeV)";
+	throw std::runtime_error(message.str()); }
+  }
+}
+
+/* Index i of the point -pi + i 2pi/n_steps of an ellipse sampled in n_steps
+   equal steps which is equal to delta (modulo 2pi), -1 if there is none */
+inline int DeltaGridIndex( double delta, int n_steps )
+{
+  const double x = (delta + M_PI) / (2 * M_PI) * n_steps;
+  const double i = floor(x + 0.5);
+  if (fabs(x - i) > 1e-12 * n_steps) return -1;
+  return (((long long) i) % n_steps + n_steps) % n_steps;
+}
+
+/* Computes P(nu_mu -> nu_e) and P(nu_mu_bar -> nu_e_bar) for all the rows of
+   a scenario table as a single batch of work.
+
+   The points of all the rows (ellipses and markers, neutrinos and
+   anti-neutrinos) are laid out in one array shared with the parallel workers.
+   For each row it contains, in this order: the neutrino points of the
+   ellipse with delta going from -pi to pi, the same for anti-neutrinos, the
+   neutrino markers and the anti-neutrino markers. The work is then split in
+   chunks of at most chunk_size points, each one belonging to one row.
+
+   Run samples every ellipse at n_delta_steps+1 equally spaced values of
+   delta. RunAdaptive instead starts from a coarse sampling and bisects the
+   intervals of delta until the ellipse is within a tolerance of its chords,
+   so each row ends up with its own number of points.
+
+   The results and the working arrays live in two ColumnArena objects which
+   only grow, so the number of points is limited only by the memory and
+   repeated runs do not allocate anything once the arenas are large enough.
+
+   With a cache directory (SetCache) the ellipses and the markers of every
+   row are stored on disk, keyed by all the numbers they depend on, and the
+   rows already computed by a previous run are read back instead of being
+   propagated (see ResultCache.h). */
+class ScenarioEngine
+{
+  public:
+
+      ScenarioEngine( int n_workers = 1 );
+     ~ScenarioEngine( );
+
+      // compute all the ellipses and markers of the table
+      // analytic: use the closed-form delta dependence (see DeltaDecomposition.h)
+      // check:    compute also the brute-force points and store the maximum deviation
+      //           between the two methods (the analytic points are kept)
+      void Run( const std::vector<Scenario> & table, int n_delta_steps,
+		bool analytic = false, bool check = false );
+
+      // same as Run, but the ellipses are refined until the distance in the
+      // (P, P_bar) plane between the curve and every chord is below tolerance,
+      // starting from n_initial equal intervals of delta
+      void RunAdaptive( const std::vector<Scenario> & table, double tolerance,
+			bool analytic = false, int n_initial = 16 );
+
+      // the GetNEllipsePoints(s) points of the ellipse of row s
+      // type > 0 : neutrino  type < 0 : anti-neutrino
+      const double * GetEllipse( int s, int type ) const
+	{ return mu2e + offset[s] + (type > 0 ? 0 : ellipse_size[s]); }
+
+      // the values of delta of the ellipse of row s
+      const double * GetEllipseDelta( int s ) const
+	{ return point_delta + offset[s]; }
+
+      int    GetNEllipsePoints( int s ) const { return ellipse_size[s]; }
+
+      // the point of the k-th marker of row s
+      double GetMarker( int s, int k, int type ) const
+	{ return mu2e[offset[s] + 2 * ellipse_size[s]
+		      + (type > 0 ? 0 : table[s].markers.size()) + k]; }
+
+      // the oscillation code, one of PropagatorKind (PROPAGATOR_BARGER by
+      // default, PROPAGATOR_SIMD or PROPAGATOR_STATIC)
+      void   SetKernel( int x ) { kernel = x; }
+
+      // average every point over the nodes of a flux spectrum instead of
+      // using the energy of the rows (an empty quadrature restores them)
+      void   SetFlux( const FluxQuadrature & x ) { flux = x; }
+
+      // propagate through these segments instead of the distance and the
+      // density of the rows, whatever the kernel (an empty profile restores
+      // them, see DensityProfile.h)
+      void   SetDensityProfile( const std::vector<DensitySegment> & x )
+	{ profile = x; segments.SetProfile(x); }
+
+      int    GetNWorkers()    const { return (int) bNu_worker.size(); }
+      double GetMaxDeviation() const { return max_deviation; }
+
+      // number of propagations done by the last run (one per point and per
+      // node of the flux, three per beam type and node for the closed form)
+      long long GetNPropagations() const { return n_propagations; }
+
+      // keep the ellipses of every row in this directory and reuse them in
+      // the later runs with the same parameters (an empty name disables it)
+      void   SetCache( const std::string & directory ) { cache.SetDirectory(directory); }
+
+      // keep also the ellipses of the last n rows in memory, for the later
+      // runs of the same engine (see ResultCache.h)
+      void   SetMemoryCache( size_t n ) { cache.SetMemory(n); }
+      const ResultCache & GetCache() const { return cache; }
+
+      // the first propagator, always owned by the calling process
+      BargerPropagator * GetPropagator() { return bNu_worker[0]; }
+
+  protected:
+
+      // Run and RunAdaptive without the cache
+      void ComputeRun( const std::vector<Scenario> & table, int n_delta_steps,
+		       bool analytic, bool check );
+      void ComputeRunAdaptive( const std::vector<Scenario> & table, double tolerance,
+			       bool analytic, int n_initial );
+
+      // take the rows of table from the cache, compute the missing ones with
+      // compute and store them; run_key identifies the kind of run
+      void CachedRun( const std::vector<Scenario> & table,
+		      const std::vector<double> & run_key,
+		      const std::function<void(const std::vector<Scenario> &)> & compute );
+
+      // all the numbers the ellipse and the markers of row depend on
+      std::vector<double> RowCacheKey( const Scenario & row,
+				       const std::vector<double> & run_key ) const;
+
+      // propagate a batch of points of row with the chosen code, profiled
+      // and checked for unitarity
+      void Propagate( int worker, const Scenario & row, int n,
+		      const double * energy, const double * delta,
+		      const int * type, const double * path,
+		      BargerProbabilityBuffer & buffer );
+
+      // the same without the profiling and the check
+      void PropagateBatch( int worker, const Scenario & row, int n,
+			   const double * energy, const double * delta,
+			   const int * type, const double * path,
+			   BargerProbabilityBuffer & buffer );
+
+      // brute-force P(mu->e) of a batch of points split in rows, the points
+      // of row s going from row_offset[s] to row_offset[s+1] (or to
+      // row_end[s] if given); out must be shared with the workers
+      void ComputePoints( const std::vector<size_t> & row_offset,
+			  const double * delta, const int * type, double * out,
+			  const std::vector<size_t> * row_end = NULL );
+
+      // harmonics of P(mu->e) of every row of table for both beam types,
+      // the rows split among the workers
+      void ComputeHarmonics( std::vector<DeltaHarmonics> & harm_nu,
+			     std::vector<DeltaHarmonics> & harm_nubar );
+
+      // harmonics of P(mu->e) of row, averaged over the flux if any
+      DeltaHarmonics RowHarmonics( int worker, const Scenario & row, int type );
+
+      // harmonics of P(mu->e) of row at one energy
+      DeltaHarmonics EnergyHarmonics( int worker, const Scenario & row, int type,
+				      double energy );
+
+      // make room for n points in mu2e, point_delta and point_type
+      void Reserve( size_t n );
+
+      std::vector<BargerPropagator *> bNu_worker; // one propagator per worker
+      std::vector<Scenario> table;
+      std::vector<size_t> offset; // first point of every row in mu2e
+      std::vector<int> ellipse_size; // points of every ellipse per beam type
+      ColumnArena results;        // mu2e and point_delta, shared with the workers
+      double * mu2e;              // P(mu->e) of every point
+      double * point_delta;       // delta of every point
+      std::vector<int> point_type; // beam type of every point
+      ColumnArena scratch;        // working arrays of the workers
+      std::vector<int> scratch_type;
+      double max_deviation;
+      long long n_propagations;
+      int    kernel;
+      FluxQuadrature flux;
+      std::vector<DensitySegment> profile;
+      SegmentedPropagator segments; // copied to every worker by the fork
+      ResultCache cache;
+};
+
+inline ScenarioEngine::ScenarioEngine( int n_workers )
+  : results(true), mu2e(NULL), point_delta(NULL), scratch(false),
+    max_deviation(0), n_propagations(0), kernel(PROPAGATOR_BARGER)
+{
+  if (n_workers < 1) n_workers = 1;
+  bNu_worker.resize(n_workers);
+  for (int w = 0; w < n_workers; w++) {
+    bNu_worker[w] = new BargerPropagator( );
+    bNu_worker[w]->UseMassEigenstates( false );
+  }
+}
+
+inline ScenarioEngine::~ScenarioEngine( )
+{
+  for (size_t w = 0; w < bNu_worker.size(); w++) delete bNu_worker[w];
+}
+
+inline void ScenarioEngine::Reserve( size_t n )
+{
+  results.Reserve(2, n);
+  mu2e = results.Column(0);
+  point_delta = results.Column(1);
+  point_type.resize(n);
+}
+
+inline void ScenarioEngine::PropagateBatch( int worker, const Scenario & row, int n,
+					    const double * energy, const double * delta,
+					    const int * type, const double * path,
+					    BargerProbabilityBuffer & buffer )
+{
+  if (!profile.empty())
+    PropagateSegments( segments, n, row.theta12, row.theta13, row.theta23,
+		       row.DM21, row.DM32, true, energy, delta, type, buffer );
+  else if (kernel == PROPAGATOR_SIMD)
+    PropagateLinearKernel( n, row.theta12, row.theta13, row.theta23,
+			   row.DM21, row.DM32, true, energy, delta, type,
+			   path, row.density, buffer );
+  else if (kernel == PROPAGATOR_STATIC)
+    PropagateLinearStatic<true>( n, row.theta12, row.theta13, row.theta23,
+				 row.DM21, row.DM32, energy, delta, type,
+				 path, row.density, buffer );
+  else
+    ProfileLinearBatch( bNu_worker[worker], n, row.theta12, row.theta13,
+			row.theta23, row.DM21, row.DM32, true, energy, delta,
+			type, path, row.density, buffer );
+}
+
+inline void ScenarioEngine::Propagate( int worker, const Scenario & row, int n,
+				       const double * energy, const double * delta,
+				       const int * type, const double * path,
+				       BargerProbabilityBuffer & buffer )
+{
+  {
+    ProfileScope scope( PROFILE_PROPAGATION, n );
+    PropagateBatch( worker, row, n, energy, delta, type, path, buffer );
+  }
+  ProfileScope scope( PROFILE_UNITARITY, n );
+  CheckUnitarity( n, buffer, energy );
+}
+
+/* The three samples of delta of the harmonics go through the same code as
+   the points (the kernel or the profile of segments, which has the same
+   delta dependence) */
+inline DeltaHarmonics ScenarioEngine::EnergyHarmonics( int worker,
+						       const Scenario & row,
+						       int type, double energy )
+{
+  double s_energy[3], s_delta[3], s_path[3], s_prob[3];
+  int s_type[3];
+  for (int k = 0; k < 3; k++) {
+    s_energy[k] = energy;
+    s_delta[k] = 2 * M_PI * k / 3.0;
+    s_type[k] = type > 0 ? 1 : -1;
+    s_path[k] = row.distance;
+  }
+  BargerProbabilityBuffer buffer = {};
+  buffer.Prob[1][0] = s_prob;
+  PropagateBatch( worker, row, 3, s_energy, s_delta, s_type, s_path, buffer );
+  return DeltaHarmonicsFromSamples( 1, s_prob );
+}
+
+inline DeltaHarmonics ScenarioEngine::RowHarmonics( int worker,
+						    const Scenario & row, int type )
+{
+  if (flux.energy.empty()) {
+    ProfileScope scope( PROFILE_PROPAGATION, 3 );
+    return EnergyHarmonics( worker, row, type, row.energy );
+  }
+
+  DeltaHarmonics average = {};
+  average.order = 1;
+  ProfileScope scope( PROFILE_PROPAGATION, 3 * flux.energy.size() );
+  for (size_t q = 0; q < flux.energy.size(); q++) {
+    DeltaHarmonics h = EnergyHarmonics( worker, row, type, flux.energy[q] );
+    for (int n = 0; n <= DELTA_MAX_ORDER; n++) {
+      average.a[n] += flux.weight[q] * h.a[n];
+      average.b[n] += flux.weight[q] * h.b[n];
+    }
+  }
+  return average;
+}
+
+/* Every task is one row and one beam type. The propagations are counted
+   here, since the counters of the workers are lost with them. */
+inline void ScenarioEngine::ComputeHarmonics( std::vector<DeltaHarmonics> & harm_nu,
+					      std::vector<DeltaHarmonics> & harm_nubar )
+{
+  const size_t n_rows = table.size();
+  DeltaHarmonics * harm = SharedAlloc<DeltaHarmonics>(2 * n_rows);
+  try {
+    ParallelFor(bNu_worker.size(), 2 * n_rows, [&](int worker, uint64_t task) {
+	harm[task] = RowHarmonics( worker, table[task / 2], task % 2 ? -1 : 1 );
+      });
+  }
+  catch(...) {
+    SharedFree(harm, 2 * n_rows);
+    throw;
+  }
+  harm_nu.resize(n_rows);
+  harm_nubar.resize(n_rows);
+  for (size_t s = 0; s < n_rows; s++) {
+    harm_nu[s] = harm[2 * s];
+    harm_nubar[s] = harm[2 * s + 1];
+  }
+  SharedFree(harm, 2 * n_rows);
+  n_propagations += 6 * n_rows * std::max<size_t>(flux.energy.size(), 1);
+}
+
+inline void ScenarioEngine::ComputePoints( const std::vector<size_t> & row_offset,
+					   const double * delta, const int * type,
+					   double * out,
+					   const std::vector<size_t> * row_end )
+{
+  size_t s;
+  const size_t n_rows = row_offset.size() - 1;
+  std::vector<size_t> end(row_offset.begin() + 1, row_offset.end());
+  if (row_end) end = *row_end;
+  size_t n_points = 0;
+  for (s = 0; s < n_rows; s++) n_points += end[s] - row_offset[s];
+  const int n_workers = bNu_worker.size();
+  const size_t chunk_size = std::min<size_t>(MAX_TASK_POINTS,
+    std::max<size_t>(64, (n_points + 4*n_workers - 1) / (4*n_workers)));
+
+  // Split every row in chunks: (row, first point, number of points)
+  std::vector<size_t> task_row, task_first, task_n;
+  for (s = 0; s < n_rows; s++) {
+    for (size_t first = row_offset[s]; first < end[s]; first += chunk_size) {
+      task_row.push_back(s);
+      task_first.push_back(first);
+      task_n.push_back(std::min(chunk_size, end[s] - first));
+    }
+  }
+
+  // With a flux spectrum every point costs one propagation per node
+  const int n_nodes = flux.GetNNodes();
+  const int max_batch = std::max(n_nodes, 65536);
+  n_propagations += n_points * std::max(n_nodes, 1);
+
+  /* The working arrays are allocated once here. The scratch arena is not
+     shared, so after the fork every worker writes to its own copy of it. */
+  const size_t n_scratch = n_nodes == 0 ? chunk_size :
+    std::min<size_t>(max_batch, chunk_size * n_nodes);
+  scratch.Reserve(6, n_scratch);
+  if (scratch_type.size() < n_scratch) scratch_type.resize(n_scratch);
+  double * energy    = scratch.Column(0);
+  double * path      = scratch.Column(1);
+  double * prob_e    = scratch.Column(2);
+  double * prob_mu   = scratch.Column(3); // The mu->mu and mu->tau columns are
+  double * prob_tau  = scratch.Column(4); // only needed to check the unitarity
+  double * sub_delta = scratch.Column(5);
+  int    * sub_type  = &scratch_type[0];
+
+  ParallelFor(n_workers, task_row.size(), [&](int worker, uint64_t task) {
+      const Scenario & row = table[task_row[task]];
+      const size_t first = task_first[task];
+      const int n = task_n[task];
+
+      if (n_nodes == 0) {
+	std::fill(energy, energy + n, row.energy);
+	std::fill(path, path + n, row.distance);
+	BargerProbabilityBuffer buffer = {};
+	buffer.Prob[1][0] = out + first;
+	buffer.Prob[1][1] = prob_mu;
+	buffer.Prob[1][2] = prob_tau;
+	Propagate( worker, row, n, energy, delta + first, type + first, path,
+		   buffer );
+	return;
+      }
+
+      /* Flux average: the points are expanded in sub-batches with all the
+	 nodes of each point next to each other, so that the kernel builds
+	 the vacuum Hamiltonian only once per point */
+      const int n_sub = max_batch / n_nodes;
+      for (int p0 = 0; p0 < n; p0 += n_sub) {
+	const int m = std::min(n_sub, n - p0);
+	const int n_batch = m * n_nodes;
+	for (int i = 0; i < m; i++)
+	  for (int q = 0; q < n_nodes; q++) {
+	    energy[i*n_nodes + q]    = flux.energy[q];
+	    sub_delta[i*n_nodes + q] = delta[first + p0 + i];
+	    sub_type[i*n_nodes + q]  = type[first + p0 + i];
+	    path[i*n_nodes + q]      = row.distance;
+	  }
+	BargerProbabilityBuffer buffer = {};
+	buffer.Prob[1][0] = prob_e;
+	buffer.Prob[1][1] = prob_mu;
+	buffer.Prob[1][2] = prob_tau;
+	Propagate( worker, row, n_batch, energy, sub_delta, sub_type, path,
+		   buffer );
+	for (int i = 0; i < m; i++) {
+	  double average = 0;
+	  for (int q = 0; q < n_nodes; q++)
+	    average += flux.weight[q] * prob_e[i*n_nodes + q];
+	  out[first + p0 + i] = average;
+	}
+      }
+    });
+}
+
+inline std::vector<double> ScenarioEngine::RowCacheKey( const Scenario & row,
+							 const std::vector<double> & run_key ) const
+{
+  size_t i;
+  const double parameter[8] = { row.theta12, row.theta13, row.theta23, row.DM21,
+				row.DM32, row.density, row.energy, row.distance };
+  std::vector<double> key(parameter, parameter + 8);
+  key.push_back(row.markers.size());
+  key.insert(key.end(), row.markers.begin(), row.markers.end());
+  key.insert(key.end(), run_key.begin(), run_key.end());
+  key.push_back(kernel);
+  key.push_back(flux.energy.size());
+  key.insert(key.end(), flux.energy.begin(), flux.energy.end());
+  key.insert(key.end(), flux.weight.begin(), flux.weight.end());
+  key.push_back(profile.size());
+  for (i = 0; i < profile.size(); i++) {
+    key.push_back(profile[i].length);
+    key.push_back(profile[i].density);
+  }
+  return key;
+}
+
+inline void ScenarioEngine::CachedRun( const std::vector<Scenario> & new_table,
+				       const std::vector<double> & run_key,
+				       const std::function<void(const std::vector<Scenario> &)> & compute )
+{
+  size_t s, m;
+  int i, k;
+  // nu and nubar ellipse, delta, nu and nubar markers
+  static const char * column_name[5] = { "nu", "nubar", "delta", "marker_nu",
+					 "marker_nubar" };
+  const std::vector<std::string> names(column_name, column_name + 5);
+  std::vector< std::vector<double> > key(new_table.size());
+  std::vector< std::vector< std::vector<double> > > data(new_table.size());
+
+  std::vector<Scenario> missing;
+  std::vector<size_t> missing_row;
+  for (s = 0; s < new_table.size(); s++) {
+    key[s] = RowCacheKey( new_table[s], run_key );
+    if (!cache.Load( key[s], names, data[s] )) {
+      missing.push_back(new_table[s]);
+      missing_row.push_back(s);
+    }
+  }
+
+  max_deviation = 0;
+  n_propagations = 0;
+  if (!missing.empty()) {
+    compute( missing );
+    for (m = 0; m < missing.size(); m++) {
+      const int n = ellipse_size[m], n_markers = missing[m].markers.size();
+      const double * p = mu2e + offset[m];
+      std::vector< std::vector<double> > & d = data[missing_row[m]];
+      d.resize(5);
+      d[0].assign(p, p + n);
+      d[1].assign(p + n, p + 2*n);
+      d[2].assign(point_delta + offset[m], point_delta + offset[m] + n);
+      d[3].assign(p + 2*n, p + 2*n + n_markers);
+      d[4].assign(p + 2*n + n_markers, p + 2*n + 2*n_markers);
+      if (!cache.Store( key[missing_row[m]], names, d ))
+	std::cerr << "  Warning: cannot write " << missing[m].label
+		  << " to the cache" << std::endl;
+    }
+  }
+
+  /***** Lay out all the rows as in Run *****/
+
+  table = new_table;
+  offset.resize(table.size() + 1);
+  ellipse_size.resize(table.size());
+  offset[0] = 0;
+  for (s = 0; s < table.size(); s++) {
+    ellipse_size[s] = data[s][0].size();
+    offset[s + 1] = offset[s] + 2 * (ellipse_size[s] + table[s].markers.size());
+  }
+  Reserve(offset[table.size()]);
+  for (s = 0; s < table.size(); s++) {
+    const int n = ellipse_size[s], n_markers = table[s].markers.size();
+    const std::vector< std::vector<double> > & d = data[s];
+    for (i = 0; i < n; i++) {
+      point_delta[offset[s] + i] = point_delta[offset[s] + n + i] = d[2][i];
+      point_type[offset[s] + i] = 1;
+      point_type[offset[s] + n + i] = -1;
+      mu2e[offset[s] + i] = d[0][i];
+      mu2e[offset[s] + n + i] = d[1][i];
+    }
+    for (k = 0; k < n_markers; k++) {
+      point_delta[offset[s] + 2*n + k] = table[s].markers[k];
+      point_delta[offset[s] + 2*n + n_markers + k] = table[s].markers[k];
+      point_type[offset[s] + 2*n + k] = 1;
+      point_type[offset[s] + 2*n + n_markers + k] = -1;
+      mu2e[offset[s] + 2*n + k] = d[3][k];
+      mu2e[offset[s] + 2*n + n_markers + k] = d[4][k];
+    }
+  }
+}
+
+inline void ScenarioEngine::Run( const std::vector<Scenario> & new_table,
+				 int n_delta_steps, bool analytic, bool check )
+{
+  // The deviation of check is only known for the rows computed now
+  if (!cache.Enabled() || check) {
+    ComputeRun( new_table, n_delta_steps, analytic, check );
+    return;
+  }
+  std::vector<double> run_key;
+  run_key.push_back(0); // equal steps
+  run_key.push_back(n_delta_steps);
+  run_key.push_back(analytic);
+  CachedRun( new_table, run_key, [&](const std::vector<Scenario> & missing) {
+      ComputeRun( missing, n_delta_steps, analytic, false );
+    });
+}
+
+inline void ScenarioEngine::ComputeRun( const std::vector<Scenario> & new_table,
+					int n_delta_steps, bool analytic, bool check )
+{
+  int i, k;
+  size_t s;
+  table = new_table;
+  max_deviation = 0;
+  n_propagations = 0;
+
+  /***** Lay out the points of all the rows *****/
+
+  const int n_ellipse = n_delta_steps + 1;
+  const double delta_step = 2 * M_PI / (double) n_delta_steps;
+  offset.resize(table.size() + 1);
+  ellipse_size.assign(table.size(), n_ellipse);
+  offset[0] = 0;
+  for (s = 0; s < table.size(); s++)
+    offset[s + 1] = offset[s] + 2 * (n_ellipse + table[s].markers.size());
+  const size_t n_points = offset[table.size()];
+  Reserve(n_points);
+
+  for (s = 0; s < table.size(); s++) {
+    const int n_markers = table[s].markers.size();
+    double * delta = point_delta + offset[s];
+    int    * type  = &point_type[offset[s]];
+    for (i = 0; i < n_ellipse; i++) {
+      delta[i] = delta[n_ellipse + i] = - M_PI + i*delta_step;
+      type[i] = 1;                // neutrino beam
+      type[n_ellipse + i] = -1;   // anti-neutrino beam
+    }
+    for (k = 0; k < n_markers; k++) {
+      delta[2*n_ellipse + k] = delta[2*n_ellipse + n_markers + k] = table[s].markers[k];
+      type[2*n_ellipse + k] = 1;
+      type[2*n_ellipse + n_markers + k] = -1;
+    }
+  }
+
+  /* The markers falling on points of the ellipse (all the default ones
+     when n_delta_steps is a multiple of 4) are copied from them instead of
+     being propagated. The rows with any other marker propagate all of them. */
+  std::vector<size_t> row_end(offset.begin() + 1, offset.end());
+  for (s = 0; s < table.size(); s++) {
+    for (k = 0; k < (int) table[s].markers.size(); k++)
+      if (DeltaGridIndex(table[s].markers[k], n_delta_steps) < 0) break;
+    if (k == (int) table[s].markers.size())
+      row_end[s] = offset[s] + 2 * n_ellipse;
+  }
+
+  /***** The brute-force path: every point is propagated *****/
+
+  if (!analytic || check) {
+    ComputePoints( offset, point_delta, &point_type[0], mu2e, &row_end );
+    for (s = 0; s < table.size(); s++) {
+      if (row_end[s] == offset[s + 1]) continue;
+      const int n_markers = table[s].markers.size();
+      double * p = mu2e + offset[s];
+      for (k = 0; k < n_markers; k++) {
+	i = DeltaGridIndex(table[s].markers[k], n_delta_steps);
+	p[2*n_ellipse + k] = p[i];
+	p[2*n_ellipse + n_markers + k] = p[n_ellipse + i];
+      }
+    }
+  }
+
+  /***** The closed-form path *****/
+
+  /* Each row is obtained from the harmonics of P(delta), extracted from three
+     propagations per beam type (and per node of the flux, since the average
+     of the harmonics is the harmonics of the average) and evaluated at all
+     the points of the row */
+  if (analytic) {
+    std::vector<DeltaHarmonics> harm_nu, harm_nubar;
+    ComputeHarmonics( harm_nu, harm_nubar );
+    for (s = 0; s < table.size(); s++) {
+      for (size_t p = offset[s]; p < offset[s + 1]; p++) {
+	const DeltaHarmonics & h = point_type[p] > 0 ? harm_nu[s] : harm_nubar[s];
+	double prob = h.Eval(point_delta[p]);
+	if (check)
+	  max_deviation = std::max(max_deviation, fabs(prob - mu2e[p]));
+	mu2e[p] = prob;
+      }
+    }
+  }
+}
+
+/* Distance in the (P, P_bar) plane of the point m from the segment ab */
+inline double ChordDeviation( double ax, double ay, double bx, double by,
+			      double mx, double my )
+{
+  const double dx = bx - ax, dy = by - ay;
+  const double len2 = dx*dx + dy*dy;
+  double t = len2 > 0 ? ((mx - ax)*dx + (my - ay)*dy) / len2 : 0;
+  t = std::max(0.0, std::min(1.0, t));
+  return hypot(mx - (ax + t*dx), my - (ay + t*dy));
+}
+
+inline void ScenarioEngine::RunAdaptive( const std::vector<Scenario> & new_table,
+					 double tolerance, bool analytic,
+					 int n_initial )
+{
+  if (!cache.Enabled()) {
+    ComputeRunAdaptive( new_table, tolerance, analytic, n_initial );
+    return;
+  }
+  std::vector<double> run_key;
+  run_key.push_back(1); // adaptive
+  run_key.push_back(tolerance);
+  run_key.push_back(n_initial);
+  run_key.push_back(analytic);
+  CachedRun( new_table, run_key, [&](const std::vector<Scenario> & missing) {
+      ComputeRunAdaptive( missing, tolerance, analytic, n_initial );
+    });
+}
+
+inline void ScenarioEngine::ComputeRunAdaptive( const std::vector<Scenario> & new_table,
+						double tolerance, bool analytic,
+						int n_initial )
+{
+  int i, k;
+  size_t s, p;
+  table = new_table;
+  max_deviation = 0;
+  n_propagations = 0;
+  if (n_initial < 2) n_initial = 2;
+  // Intervals of delta are not bisected below this width
+  const double min_width = 2 * M_PI / (1 << 20);
+
+  std::vector<DeltaHarmonics> harm_nu, harm_nubar;
+  if (analytic) ComputeHarmonics( harm_nu, harm_nubar );
+
+  /* Every curve is a list of (delta, P, P_bar) sorted in delta, with a flag
+     for each interval between two consecutive points to be bisected */
+  struct CurvePoint { double delta, nu, nubar; bool refine; };
+  std::vector< std::vector<CurvePoint> > curve(table.size());
+  std::vector< std::vector<double> > marker_nu(table.size()), marker_nubar(table.size());
+
+  /* Each level evaluates a batch of values of delta per row, for both beam
+     types: the initial points and the markers first, then the midpoints of
+     the intervals flagged by the previous level */
+  std::vector< std::vector<double> > level_delta(table.size());
+  for (s = 0; s < table.size(); s++) {
+    for (i = 0; i <= n_initial; i++)
+      level_delta[s].push_back(- M_PI + i * 2 * M_PI / (double) n_initial);
+    level_delta[s].insert(level_delta[s].end(), table[s].markers.begin(),
+			  table[s].markers.end());
+  }
+
+  std::vector<size_t> row_offset(table.size() + 1);
+  for (int level = 0; ; level++) {
+    row_offset[0] = 0;
+    for (s = 0; s < table.size(); s++)
+      row_offset[s + 1] = row_offset[s] + 2 * level_delta[s].size();
+    const size_t n_points = row_offset[table.size()];
+    if (n_points == 0) break;
+
+    Reserve(n_points);
+    for (s = 0; s < table.size(); s++) {
+      const size_t n = level_delta[s].size();
+      for (p = 0; p < n; p++) {
+	point_delta[row_offset[s] + p] = point_delta[row_offset[s] + n + p] = level_delta[s][p];
+	point_type[row_offset[s] + p] = 1;
+	point_type[row_offset[s] + n + p] = -1;
+      }
+    }
+
+    if (analytic)
+      for (s = 0; s < table.size(); s++)
+	for (p = row_offset[s]; p < row_offset[s + 1]; p++)
+	  mu2e[p] = point_type[p] > 0 ? harm_nu[s].Eval(point_delta[p]) :
+	    harm_nubar[s].Eval(point_delta[p]);
+    else
+      ComputePoints( row_offset, point_delta, &point_type[0], mu2e );
+
+    for (s = 0; s < table.size(); s++) {
+      const size_t n = level_delta[s].size();
+      const double * nu = mu2e + row_offset[s];
+      const double * nubar = nu + n;
+      std::vector<CurvePoint> & c = curve[s];
+
+      if (level == 0) {
+	for (i = 0; i <= n_initial; i++) {
+	  CurvePoint point = { level_delta[s][i], nu[i], nubar[i], true };
+	  c.push_back(point);
+	}
+	c.back().refine = false;
+	for (p = n_initial + 1; p < n; p++) {
+	  marker_nu[s].push_back(nu[p]);
+	  marker_nubar[s].push_back(nubar[p]);
+	}
+      }
+      else {
+	// Insert the midpoints, in the same order of the flagged intervals
+	std::vector<CurvePoint> refined;
+	size_t m = 0;
+	for (p = 0; p < c.size(); p++) {
+	  refined.push_back(c[p]);
+	  if (!c[p].refine) continue;
+	  const CurvePoint & a = c[p], & b = c[p + 1];
+	  double deviation = ChordDeviation(a.nu, a.nubar, b.nu, b.nubar,
+					    nu[m], nubar[m]);
+	  bool split = deviation > tolerance &&
+	    0.5 * (b.delta - a.delta) > min_width;
+	  refined.back().refine = split;
+	  CurvePoint mid = { level_delta[s][m], nu[m], nubar[m], split };
+	  refined.push_back(mid);
+	  m++;
+	}
+	c.swap(refined);
+      }
+
+      level_delta[s].clear();
+      for (p = 0; p + 1 < c.size(); p++)
+	if (c[p].refine)
+	  level_delta[s].push_back(0.5 * (c[p].delta + c[p + 1].delta));
+    }
+  }
+
+  /***** Lay out the final points as in Run *****/
+
+  offset.resize(table.size() + 1);
+  ellipse_size.resize(table.size());
+  offset[0] = 0;
+  for (s = 0; s < table.size(); s++) {
+    ellipse_size[s] = curve[s].size();
+    offset[s + 1] = offset[s] + 2 * (ellipse_size[s] + table[s].markers.size());
+  }
+  Reserve(offset[table.size()]);
+  for (s = 0; s < table.size(); s++) {
+    const int n = ellipse_size[s], n_markers = table[s].markers.size();
+    double * delta_out = point_delta + offset[s];
+    int    * type_out  = &point_type[offset[s]];
+    for (i = 0; i < n; i++) {
+      delta_out[i] = delta_out[n + i] = curve[s][i].delta;
+      type_out[i] = 1;
+      type_out[n + i] = -1;
+      mu2e[offset[s] + i] = curve[s][i].nu;
+      mu2e[offset[s] + n + i] = curve[s][i].nubar;
+    }
+    for (k = 0; k < n_markers; k++) {
+      delta_out[2*n + k] = delta_out[2*n + n_markers + k] = table[s].markers[k];
+      type_out[2*n + k] = 1;
+      type_out[2*n + n_markers + k] = -1;
+      mu2e[offset[s] + 2*n + k] = marker_nu[s][k];
+      mu2e[offset[s] + 2*n + n_markers + k] = marker_nubar[s][k];
+    }
+  }
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
@@ -0,0 +1,544 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _Separation_
+#define _Separation_
+
+// C includes
+#include <math.h>
+
+// C++ includes
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// nu-vs-antinu includes
+#include "WorkerPool.h"
+
+/* Separation between two sets of ellipses in the (P, P_bar) plane, by
+   default those of the normal and of the inverted hierarchy (both octants
+   each):
+
+   - the minimum distance between the curves of the two sets;
+   - the area of the overlap of the regions enclosed by the two sets;
+   - for each set, the fraction of delta for which its point is closer than
+     a tolerance (the resolution on the probabilities) to a curve of the
+     other set, i.e. the hierarchy is degenerate.
+
+   The ellipses are closed polygons through their points. The nearest point
+   of the other set is found with a tree of bounding boxes of its points
+   (PointTree), and the distances are then refined on the segments next to
+   the two points, so the cost is O(N log N) for N points instead of the
+   O(N^2) of all the pairs. The area is integrated over SEPARATION_SCANLINES
+   horizontal lines swept upwards through the edges sorted by their lowest
+   point, so that only the edges crossing a line are looked at. */
+
+#define SEPARATION_SCANLINES 4096
+
+// Points compared by each task of the parallel workers
+#define SEPARATION_CHUNK 65536
+
+// Points of each curve sampled for the first bound of the minimum distance
+#define SEPARATION_SAMPLE 1024
+
+// Points of the leaves of the tree, searched linearly
+#define SEPARATION_LEAF 8
+
+// An ellipse: the points (x[i], y[i]) = (P, P_bar) at delta[i] (increasing)
+struct SeparationCurve
+{
+  const double * x;
+  const double * y;
+  const double * delta;
+  size_t n;
+};
+
+struct SeparationMetrics
+{
+  double min_distance;  // between the curves of the two sets
+  double overlap_area;  // of the regions enclosed by the two sets
+  double degenerate[2]; // fraction of delta of each set close to the other
+};
+
+/* Tree of bounding boxes of the points of a set of curves. The points keep
+   their order along the curves, so that a range of them is an arc and its
+   box is tight: every node is a range, split in two halves down to
+   SEPARATION_LEAF points, and the tree is built in linear time without
+   sorting anything. The search visits the nodes by the distance of their
+   box and skips those farther than the best point found so far. */
+class PointTree
+{
+  public:
+
+      struct Point
+      {
+	double x, y;
+	int curve;
+	int index;
+      };
+
+      PointTree( const std::vector<SeparationCurve> & curves )
+      {
+	size_t n = 0;
+	for (size_t c = 0; c < curves.size(); c++) n += curves[c].n;
+	points.reserve(n);
+	for (size_t c = 0; c < curves.size(); c++)
+	  for (size_t i = 0; i < curves[c].n; i++) {
+	    Point p = { curves[c].x[i], curves[c].y[i], (int) c, (int) i };
+	    points.push_back(p);
+	  }
+	if (!points.empty()) {
+	  nodes.reserve(2 * points.size() / SEPARATION_LEAF + 1);
+	  Build(0, points.size());
+	}
+      }
+
+      /* the point closest to (x, y), NULL if there are none closer than
+	 sqrt(max_distance2). The smaller the limit, the fewer nodes are
+	 visited. */
+      const Point * Nearest( double x, double y, double max_distance2 = HUGE_VAL ) const
+      {
+	if (points.empty()) return NULL;
+	size_t best = points.size();
+	double best_d2 = max_distance2;
+	Search(0, x, y, best, best_d2);
+	return best < points.size() ? &points[best] : NULL;
+      }
+
+      // whether any point is closer than sqrt(distance2) to (x, y)
+      bool AnyWithin( double x, double y, double distance2 ) const
+      {
+	return !points.empty() && Within(0, x, y, distance2);
+      }
+
+  private:
+
+      struct Node
+      {
+	double x_min, x_max, y_min, y_max;
+	size_t begin, end;
+	int left, right; // -1 for the leaves
+      };
+
+      int Build( size_t begin, size_t end )
+      {
+	Node node = { HUGE_VAL, -HUGE_VAL, HUGE_VAL, -HUGE_VAL, begin, end, -1, -1 };
+	const int n = nodes.size();
+	nodes.push_back(node);
+	if (end - begin <= SEPARATION_LEAF) {
+	  for (size_t i = begin; i < end; i++) {
+	    node.x_min = std::min(node.x_min, points[i].x);
+	    node.x_max = std::max(node.x_max, points[i].x);
+	    node.y_min = std::min(node.y_min, points[i].y);
+	    node.y_max = std::max(node.y_max, points[i].y);
+	  }
+	}
+	else {
+	  const size_t middle = (begin + end) / 2;
+	  node.left = Build(begin, middle);
+	  node.right = Build(middle, end);
+	  const Node & left = nodes[node.left], & right = nodes[node.right];
+	  node.x_min = std::min(left.x_min, right.x_min);
+	  node.x_max = std::max(left.x_max, right.x_max);
+	  node.y_min = std::min(left.y_min, right.y_min);
+	  node.y_max = std::max(left.y_max, right.y_max);
+	}
+	nodes[n] = node;
+	return n;
+      }
+
+      // squared distance of (x, y) from the box of node n
+      double BoxDistance2( int n, double x, double y ) const
+      {
+	const Node & node = nodes[n];
+	const double dx = std::max(0.0, std::max(node.x_min - x, x - node.x_max));
+	const double dy = std::max(0.0, std::max(node.y_min - y, y - node.y_max));
+	return dx * dx + dy * dy;
+      }
+
+      void Search( int n, double x, double y, size_t & best, double & best_d2 ) const
+      {
+	const Node & node = nodes[n];
+	if (node.left < 0) {
+	  for (size_t i = node.begin; i < node.end; i++) {
+	    const double d2 = (points[i].x - x) * (points[i].x - x)
+	      + (points[i].y - y) * (points[i].y - y);
+	    if (d2 < best_d2) { best_d2 = d2; best = i; }
+	  }
+	  return;
+	}
+	double d_left = BoxDistance2(node.left, x, y);
+	double d_right = BoxDistance2(node.right, x, y);
+	int first = node.left, second = node.right;
+	if (d_right < d_left) {
+	  std::swap(first, second);
+	  std::swap(d_left, d_right);
+	}
+	if (d_left < best_d2) Search(first, x, y, best, best_d2);
+	if (d_right < best_d2) Search(second, x, y, best, best_d2);
+      }
+
+      bool Within( int n, double x, double y, double distance2 ) const
+      {
+	const Node & node = nodes[n];
+	if (node.left < 0) {
+	  for (size_t i = node.begin; i < node.end; i++)
+	    if ((points[i].x - x) * (points[i].x - x)
+		+ (points[i].y - y) * (points[i].y - y) <= distance2) return true;
+	  return false;
+	}
+	int first = node.left, second = node.right;
+	double d_first = BoxDistance2(first, x, y), d_second = BoxDistance2(second, x, y);
+	if (d_second < d_first) {
+	  std::swap(first, second);
+	  std::swap(d_first, d_second);
+	}
+	return (d_first <= distance2 && Within(first, x, y, distance2)) ||
+	  (d_second <= distance2 && Within(second, x, y, distance2));
+      }
+
+      std::vector<Point> points;
+      std::vector<Node> nodes;
+};
+
+// Squared distance of (px, py) from the segment (ax, ay) - (bx, by)
+inline double SegmentDistance2(double px, double py, double ax, double ay,
+			       double bx, double by)
+{
+  const double dx = bx - ax, dy = by - ay, length2 = dx * dx + dy * dy;
+  double t = length2 > 0 ? ((px - ax) * dx + (py - ay) * dy) / length2 : 0;
+  t = std::min(1.0, std::max(0.0, t));
+  const double ex = ax + t * dx - px, ey = ay + t * dy - py;
+  return ex * ex + ey * ey;
+}
+
+// Squared distance between the segments a0 - a1 and b0 - b1
+inline double SegmentDistance2(const double a0[2], const double a1[2],
+			       const double b0[2], const double b1[2])
+{
+  // sides of the end points of each segment with respect to the other
+  const double s0 = (a1[0] - a0[0]) * (b0[1] - a0[1]) - (a1[1] - a0[1]) * (b0[0] - a0[0]);
+  const double s1 = (a1[0] - a0[0]) * (b1[1] - a0[1]) - (a1[1] - a0[1]) * (b1[0] - a0[0]);
+  const double s2 = (b1[0] - b0[0]) * (a0[1] - b0[1]) - (b1[1] - b0[1]) * (a0[0] - b0[0]);
+  const double s3 = (b1[0] - b0[0]) * (a1[1] - b0[1]) - (b1[1] - b0[1]) * (a1[0] - b0[0]);
+  if (((s0 < 0 && s1 > 0) || (s0 > 0 && s1 < 0)) &&
+      ((s2 < 0 && s3 > 0) || (s2 > 0 && s3 < 0)))
+    return 0;
+  return std::min(std::min(SegmentDistance2(a0[0], a0[1], b0[0], b0[1], b1[0], b1[1]),
+			   SegmentDistance2(a1[0], a1[1], b0[0], b0[1], b1[0], b1[1])),
+		  std::min(SegmentDistance2(b0[0], b0[1], a0[0], a0[1], a1[0], a1[1]),
+			   SegmentDistance2(b1[0], b1[1], a0[0], a0[1], a1[0], a1[1])));
+}
+
+// Length of the longest segment of the curves
+inline double MaxSegmentLength(const std::vector<SeparationCurve> & curves)
+{
+  double length2 = 0;
+  for (size_t c = 0; c < curves.size(); c++)
+    for (size_t i = 0; i < curves[c].n; i++) {
+      const size_t k = (i + 1) % curves[c].n;
+      const double dx = curves[c].x[k] - curves[c].x[i];
+      const double dy = curves[c].y[k] - curves[c].y[i];
+      length2 = std::max(length2, dx * dx + dy * dy);
+    }
+  return sqrt(length2);
+}
+
+/* Lower point_distance2 to the distance (squared) of the point i of the
+   curve a from the two segments of the curve b next to its point j, and
+   min_distance2 to that between them and the segments next to i */
+inline void CompareSegments(const SeparationCurve & a, size_t i,
+			    const SeparationCurve & b, size_t j,
+			    double & point_distance2, double & min_distance2)
+{
+  // the curves are closed
+  const size_t a_near[3] = { (i + a.n - 1) % a.n, i, (i + 1) % a.n };
+  const size_t b_near[3] = { (j + b.n - 1) % b.n, j, (j + 1) % b.n };
+  for (int v = 0; v < 2; v++) {
+    const double b0[2] = { b.x[b_near[v]], b.y[b_near[v]] };
+    const double b1[2] = { b.x[b_near[v + 1]], b.y[b_near[v + 1]] };
+    point_distance2 = std::min(point_distance2,
+			       SegmentDistance2(a.x[i], a.y[i], b0[0], b0[1],
+						b1[0], b1[1]));
+    for (int u = 0; u < 2; u++) {
+      const double a0[2] = { a.x[a_near[u]], a.y[a_near[u]] };
+      const double a1[2] = { a.x[a_near[u + 1]], a.y[a_near[u + 1]] };
+      min_distance2 = std::min(min_distance2, SegmentDistance2(a0, a1, b0, b1));
+    }
+  }
+}
+
+/* Compare the points [begin, end) of the curve c of from with the curves
+   of the tree to. The result is the measure of delta of the points closer
+   than tolerance to them, the total measure of delta of the points and the
+   minimum distance (squared) between the segments next to each point and to
+   its nearest point of to, starting from min_distance2. step is the
+   longest segment of all the curves.
+
+   The nearest point is only looked for within the minimum distance found
+   so far plus the longest segment, the only ones which can lower it, so a
+   good starting value saves most of the work (see ComputeSeparation). A
+   point is degenerate for sure if a point of the other curves is within the
+   tolerance, which is found by the first leaves reached, and for sure not if
+   there are none within the tolerance plus half of the longest segment; only
+   in between the segments are looked at. This is what keeps the cost low at
+   10^6 points, whether the curves are far apart or run close together. */
+inline void SeparationPass(const std::vector<SeparationCurve> & from,
+			   const std::vector<SeparationCurve> & to,
+			   const PointTree & tree, double tolerance, double step,
+			   size_t c, size_t begin, size_t end, double min_distance2,
+			   double result[3])
+{
+  double degenerate = 0, total = 0;
+  const SeparationCurve & a = from[c];
+  for (size_t i = begin; i < end; i++) {
+    // the point stands for half of the interval of delta on each side
+    const double weight = a.n < 2 ? 1 :
+      .5 * (a.delta[std::min(i + 1, a.n - 1)] - a.delta[i > 0 ? i - 1 : 0]);
+    total += weight;
+
+    double point_distance2 = HUGE_VAL;
+    double reach = sqrt(min_distance2) + step;
+    for (int attempt = 0; attempt < 2; attempt++) {
+      const PointTree::Point * nearest = tree.Nearest(a.x[i], a.y[i], reach * reach);
+      if (nearest)
+	CompareSegments(a, i, to[nearest->curve], nearest->index, point_distance2,
+			min_distance2);
+      if (point_distance2 <= tolerance * tolerance ||
+	  tree.AnyWithin(a.x[i], a.y[i], tolerance * tolerance)) {
+	degenerate += weight;
+	break;
+      }
+      // between the sure and the impossible: the segments decide
+      if (reach >= tolerance + .5 * step) break;
+      reach = tolerance + .5 * step;
+    }
+  }
+  result[0] = degenerate;
+  result[1] = total;
+  result[2] = min_distance2;
+}
+
+/* A first bound of the minimum distance (squared) between the curves of a
+   and those of b, from a sample of the points of a */
+inline double SampledDistance2(const std::vector<SeparationCurve> & a,
+			       const std::vector<SeparationCurve> & b,
+			       const PointTree & tree_b, double step)
+{
+  double bound2 = HUGE_VAL, unused = HUGE_VAL;
+  for (size_t c = 0; c < a.size(); c++)
+    for (size_t i = 0; i < a[c].n; i += std::max<size_t>(1, a[c].n / SEPARATION_SAMPLE)) {
+      const double reach = sqrt(bound2) + step;
+      const PointTree::Point * nearest = tree_b.Nearest(a[c].x[i], a[c].y[i], reach * reach);
+      if (nearest)
+	CompareSegments(a[c], i, b[nearest->curve], nearest->index, unused, bound2);
+    }
+  return bound2;
+}
+
+/* Area of the intersection of the region enclosed by the curves of a
+   (union of the interiors of the polygons) with that of the curves of b */
+inline double OverlapArea(const std::vector<SeparationCurve> & a,
+			  const std::vector<SeparationCurve> & b)
+{
+  struct Edge { double y_low, y_high, x_low, slope; int curve; };
+  double y_min[2] = { HUGE_VAL, HUGE_VAL }, y_max[2] = { -HUGE_VAL, -HUGE_VAL };
+  for (int set = 0; set < 2; set++) {
+    const std::vector<SeparationCurve> & curves = set == 0 ? a : b;
+    for (size_t c = 0; c < curves.size(); c++)
+      for (size_t i = 0; i < curves[c].n; i++) {
+	y_min[set] = std::min(y_min[set], curves[c].y[i]);
+	y_max[set] = std::max(y_max[set], curves[c].y[i]);
+      }
+  }
+  const double y_begin = std::max(y_min[0], y_min[1]);
+  const double y_end = std::min(y_max[0], y_max[1]);
+  if (!(y_end > y_begin)) return 0;
+  const double step = (y_end - y_begin) / SEPARATION_SCANLINES;
+
+  // the edges crossing at least one line (y_low <= y < y_high), a few for
+  // each line when the curves have many points
+  std::vector<Edge> edges;
+  int n_curves = 0;
+  for (int set = 0; set < 2; set++) {
+    const std::vector<SeparationCurve> & curves = set == 0 ? a : b;
+    for (size_t c = 0; c < curves.size(); c++, n_curves++) {
+      const SeparationCurve & curve = curves[c];
+      for (size_t i = 0; i < curve.n; i++) {
+	const size_t k = (i + 1) % curve.n;
+	const bool up = curve.y[i] < curve.y[k];
+	Edge edge;
+	edge.y_low  = up ? curve.y[i] : curve.y[k];
+	edge.y_high = up ? curve.y[k] : curve.y[i];
+	long line = std::max(0L, (long) ceil((edge.y_low - y_begin) / step - .5));
+	while (line > 0 && y_begin + (line - .5) * step >= edge.y_low) line--;
+	while (line < SEPARATION_SCANLINES && y_begin + (line + .5) * step < edge.y_low)
+	  line++;
+	if (line >= SEPARATION_SCANLINES || y_begin + (line + .5) * step >= edge.y_high)
+	  continue;
+	edge.x_low  = up ? curve.x[i] : curve.x[k];
+	edge.slope  = (curve.x[k] - curve.x[i]) / (curve.y[k] - curve.y[i]);
+	edge.curve = n_curves;
+	edges.push_back(edge);
+      }
+    }
+  }
+  std::sort(edges.begin(), edges.end(),
+	    [](const Edge & e1, const Edge & e2) { return e1.y_low < e2.y_low; });
+
+  double area = 0;
+  size_t next = 0;
+  std::vector<const Edge *> active;
+  std::vector<std::pair<int, double> > crossing; // curve, x
+  std::vector<std::pair<double, double> > inside[2];
+  for (int line = 0; line < SEPARATION_SCANLINES; line++) {
+    const double y = y_begin + (line + .5) * step;
+    while (next < edges.size() && edges[next].y_low <= y) active.push_back(&edges[next++]);
+    size_t n_active = 0;
+    for (size_t e = 0; e < active.size(); e++)
+      if (active[e]->y_high > y) active[n_active++] = active[e];
+    active.resize(n_active);
+
+    // the intervals inside each polygon, by the even-odd rule
+    crossing.clear();
+    for (size_t e = 0; e < active.size(); e++)
+      crossing.push_back(std::make_pair(active[e]->curve, active[e]->x_low
+					+ (y - active[e]->y_low) * active[e]->slope));
+    std::sort(crossing.begin(), crossing.end());
+    inside[0].clear();
+    inside[1].clear();
+    for (size_t k = 0, end; k < crossing.size(); k = end) {
+      for (end = k; end < crossing.size() && crossing[end].first == crossing[k].first; end++);
+      const int set = crossing[k].first < (int) a.size() ? 0 : 1;
+      for (size_t m = k; m + 1 < end; m += 2)
+	inside[set].push_back(std::make_pair(crossing[m].second, crossing[m + 1].second));
+    }
+
+    // the union over the polygons of each set, then the intersection
+    for (int set = 0; set < 2; set++) {
+      std::vector<std::pair<double, double> > & in = inside[set];
+      std::sort(in.begin(), in.end());
+      size_t n_merged = 0;
+      for (size_t k = 0; k < in.size(); k++) {
+	if (n_merged > 0 && in[k].first <= in[n_merged - 1].second)
+	  in[n_merged - 1].second = std::max(in[n_merged - 1].second, in[k].second);
+	else
+	  in[n_merged++] = in[k];
+      }
+      in.resize(n_merged);
+    }
+    size_t i = 0, j = 0;
+    while (i < inside[0].size() && j < inside[1].size()) {
+      const double low = std::max(inside[0][i].first, inside[1][j].first);
+      const double high = std::min(inside[0][i].second, inside[1][j].second);
+      if (high > low) area += (high - low) * step;
+      if (inside[0][i].second < inside[1][j].second) i++;
+      else j++;
+    }
+  }
+  return area;
+}
+
+/* The separation between the curves of a and those of b, with the points
+   closer than tolerance counted as degenerate. The points are compared in
+   chunks of SEPARATION_CHUNK by n_workers parallel workers (see
+   WorkerPool.h), which share the trees built before, and the results of the
+   chunks are summed in a fixed order, so they do not depend on the number
+   of workers. */
+inline SeparationMetrics ComputeSeparation(const std::vector<SeparationCurve> & a,
+					   const std::vector<SeparationCurve> & b,
+					   double tolerance, int n_workers = 1)
+{
+  struct Task { int set; size_t curve, begin, end; };
+  std::vector<Task> tasks;
+  for (int set = 0; set < 2; set++) {
+    const std::vector<SeparationCurve> & curves = set == 0 ? a : b;
+    for (size_t c = 0; c < curves.size(); c++)
+      for (size_t begin = 0; begin < curves[c].n; begin += SEPARATION_CHUNK) {
+	Task task = { set, c, begin, std::min(curves[c].n, begin + SEPARATION_CHUNK) };
+	tasks.push_back(task);
+      }
+  }
+
+  const PointTree tree_a(a), tree_b(b);
+  const double step = std::max(MaxSegmentLength(a), MaxSegmentLength(b));
+  // shared by all the chunks
+  const double bound2 = SampledDistance2(a, b, tree_b, step);
+
+  double * result = SharedAlloc<double>(3 * tasks.size() + 1);
+  try {
+    ParallelFor(n_workers, tasks.size(), [&](int, uint64_t t) {
+	const Task & task = tasks[t];
+	SeparationPass(task.set == 0 ? a : b, task.set == 0 ? b : a,
+		       task.set == 0 ? tree_b : tree_a, tolerance, step,
+		       task.curve, task.begin, task.end, bound2, result + 3 * t);
+      });
+  }
+  catch(...) {
+    SharedFree(result, 3 * tasks.size() + 1);
+    throw;
+  }
+
+  SeparationMetrics metrics;
+  double degenerate[2] = { 0, 0 }, total[2] = { 0, 0 }, min_distance2 = HUGE_VAL;
+  for (size_t t = 0; t < tasks.size(); t++) {
+    degenerate[tasks[t].set] += result[3 * t];
+    total[tasks[t].set] += result[3 * t + 1];
+    min_distance2 = std::min(min_distance2, result[3 * t + 2]);
+  }
+  SharedFree(result, 3 * tasks.size() + 1);
+  for (int set = 0; set < 2; set++)
+    metrics.degenerate[set] = total[set] > 0 ? degenerate[set] / total[set] : 0;
+  metrics.min_distance = sqrt(min_distance2);
+  metrics.overlap_area = OverlapArea(a, b);
+  return metrics;
+}
+
+/* Only the minimum distance between the curves of a and those of b, in the
+   calling process: the objective of the optimiser (see Optimiser.h), which
+   computes it at many points at once */
+inline double MinimumDistance(const std::vector<SeparationCurve> & a,
+			      const std::vector<SeparationCurve> & b)
+{
+  const PointTree tree_a(a), tree_b(b);
+  const double step = std::max(MaxSegmentLength(a), MaxSegmentLength(b));
+  double min_distance2 = SampledDistance2(a, b, tree_b, step), result[3];
+  for (int set = 0; set < 2; set++) {
+    const std::vector<SeparationCurve> & from = set == 0 ? a : b;
+    for (size_t c = 0; c < from.size(); c++) {
+      SeparationPass(from, set == 0 ? b : a, set == 0 ? tree_b : tree_a, 0, step,
+		     c, 0, from[c].n, min_distance2, result);
+      min_distance2 = result[2];
+    }
+  }
+  return sqrt(min_distance2);
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
@@ -0,0 +1,296 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _Server_
+#define _Server_
+
+// C includes
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// C++ includes
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* Query server of --serve: a loop reading requests and writing replies, one
+   JSON object per line, either on the standard input and output or on the
+   connections to a Unix domain socket.
+
+   A request is a flat JSON object whose members are command line options:
+
+     {"id": 1, "theta23LO": 0.5, "energy": 2, "distance": 810, "analytic": true}
+
+   stands for "--theta23LO 0.5 --energy 2 --distance 810 --analytic". A true
+   value is an option without argument, false and null leave the option out
+   and "id" is only copied to the reply. The reply is made by the handler.
+
+   The requests are served one at a time, in the order they arrive, so the
+   handler can keep its state (propagators, caches) from one request to the
+   next. nva_client.py is a client for testing. */
+
+// A member of a flat JSON object: the strings are unquoted, the other values
+// (numbers, true, false, null) are kept as they are written
+struct JsonMember
+{
+  std::string name;
+  std::string value;
+  bool        quoted;
+};
+
+// Whether s is a JSON number: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+inline bool IsJsonNumber(const std::string & s)
+{
+  size_t i = 0;
+  const size_t n = s.size();
+  if (i < n && s[i] == '-') i++;
+  if (i < n && s[i] == '0') i++;
+  else if (i < n && isdigit((unsigned char) s[i]))
+    while (i < n && isdigit((unsigned char) s[i])) i++;
+  else return false;
+  if (i < n && s[i] == '.') {
+    if (++i >= n || !isdigit((unsigned char) s[i])) return false;
+    while (i < n && isdigit((unsigned char) s[i])) i++;
+  }
+  if (i < n && (s[i] == 'e' || s[i] == 'E')) {
+    if (++i < n && (s[i] == '+' || s[i] == '-')) i++;
+    if (i >= n || !isdigit((unsigned char) s[i])) return false;
+    while (i < n && isdigit((unsigned char) s[i])) i++;
+  }
+  return i == n;
+}
+
+inline std::vector<JsonMember> ParseJsonObject(const std::string & text)
+{
+  std::vector<JsonMember> members;
+  size_t i = 0;
+  const size_t n = text.size();
+
+  struct Parser {
+    const std::string & t;
+    size_t & i;
+    void Space() { while (i < t.size() && isspace((unsigned char) t[i])) i++; }
+    void Fail(const char * what) {
+      std::ostringstream message;
+      message << "invalid JSON request (" << what << " at " << i << ")";
+      throw std::runtime_error(message.str());
+    }
+    std::string String() {
+      std::string s;
+      if (i >= t.size() || t[i] != '"') Fail("expected a string");
+      for (i++; i < t.size() && t[i] != '"'; i++) {
+	if (t[i] != '\\') { s += t[i]; continue; }
+	if (++i >= t.size()) break;
+	switch (t[i]) {
+	case 'n': s += '\n'; break;
+	case 't': s += '\t'; break;
+	case 'r': s += '\r'; break;
+	case 'b': s += '\b'; break;
+	case 'f': s += '\f'; break;
+	case 'u': {
+	  if (i + 4 >= t.size()) Fail("bad escape");
+	  unsigned code = strtoul(t.substr(i + 1, 4).c_str(), NULL, 16);
+	  if (code >= 0x80) Fail("non-ASCII escape");
+	  s += (char) code;
+	  i += 4;
+	  break;
+	}
+	default: s += t[i];
+	}
+      }
+      if (i >= t.size()) Fail("unterminated string");
+      i++;
+      return s;
+    }
+  } p = { text, i };
+
+  p.Space();
+  if (i >= n || text[i] != '{') p.Fail("expected an object");
+  i++;
+  p.Space();
+  if (i < n && text[i] == '}') i++;
+  else
+    for (;;) {
+      p.Space();
+      std::string name = p.String();
+      p.Space();
+      if (i >= n || text[i] != ':') p.Fail("expected ':'");
+      i++;
+      p.Space();
+      JsonMember member = { name, "", i < n && text[i] == '"' };
+      std::string & value = member.value;
+      if (member.quoted)
+	value = p.String();
+      else {
+	size_t start = i;
+	while (i < n && text[i] != ',' && text[i] != '}' &&
+	       !isspace((unsigned char) text[i])) i++;
+	value = text.substr(start, i - start);
+	if (value != "true" && value != "false" && value != "null" &&
+	    !IsJsonNumber(value)) {
+	  i = start;
+	  p.Fail("expected a number, a string, true, false or null");
+	}
+      }
+      members.push_back(member);
+      p.Space();
+      if (i < n && text[i] == ',') { i++; continue; }
+      if (i < n && text[i] == '}') { i++; break; }
+      p.Fail("expected ',' or '}'");
+    }
+  p.Space();
+  if (i != n) p.Fail("trailing characters");
+  return members;
+}
+
+// A string as a JSON string literal
+inline std::string JsonString(const std::string & s)
+{
+  std::string out = "\"";
+  for (size_t i = 0; i < s.size(); i++) {
+    const unsigned char c = s[i];
+    if (c == '"' || c == '\\') { out += '\\'; out += c; }
+    else if (c == '\n') out += "\\n";
+    else if (c < 0x20) {
+      char code[8];
+      snprintf(code, sizeof(code), "\\u%04x", c);
+      out += code;
+    }
+    else out += c;
+  }
+  return out + "\"";
+}
+
+// An array of doubles as a JSON array, with all their digits; JSON has no
+// NaN nor infinity, so the non-finite values are written as null
+inline std::string JsonArray(const double * x, size_t n)
+{
+  std::string out = "[";
+  char number[32];
+  for (size_t i = 0; i < n; i++) {
+    if (isfinite(x[i]))
+      snprintf(number, sizeof(number), i ? ",%.17g" : "%.17g", x[i]);
+    else
+      snprintf(number, sizeof(number), i ? ",null" : "null");
+    out += number;
+  }
+  return out + "]";
+}
+
+/* Serve the requests read from in, one per line, writing the replies to
+   out, until the end of in. Empty lines are skipped. */
+inline void ServeStream(std::istream & in, std::ostream & out,
+			const std::function<std::string(const std::string &)> & handler)
+{
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+    out << handler(line) << "\n";
+    out.flush();
+  }
+}
+
+static volatile sig_atomic_t server_stop = 0;
+inline void ServerSignal(int) { server_stop = 1; }
+
+/* Serve the requests of the clients connecting to the Unix domain socket
+   socket_path, one connection at a time, until SIGINT or SIGTERM. The
+   socket file is removed at the end. */
+inline void ServeUnixSocket(const std::string & socket_path,
+			    const std::function<std::string(const std::string &)> & handler)
+{
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path))
+    throw std::runtime_error("the socket path " + socket_path + " is too long");
+  strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+  int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server < 0) throw std::runtime_error("cannot create the socket");
+  unlink(socket_path.c_str());
+  if (bind(server, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+      listen(server, 16) != 0) {
+    close(server);
+    throw std::runtime_error("cannot listen on " + socket_path);
+  }
+
+  // accept and read are interrupted by the signals (no SA_RESTART)
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = ServerSignal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN); // a client leaving before its reply
+
+  while (!server_stop) {
+    int client = accept(server, NULL, NULL);
+    if (client < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    std::string buffer;
+    char chunk[65536];
+    ssize_t n_read;
+    while (!server_stop && (n_read = read(client, chunk, sizeof(chunk))) > 0) {
+      buffer.append(chunk, n_read);
+      size_t end;
+      while ((end = buffer.find('\n')) != std::string::npos) {
+	const std::string line = buffer.substr(0, end);
+	buffer.erase(0, end + 1);
+	if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+	const std::string reply = handler(line) + "\n";
+	size_t sent = 0;
+	while (sent < reply.size()) {
+	  ssize_t n = send(client, reply.data() + sent, reply.size() - sent,
+			   MSG_NOSIGNAL);
+	  if (n <= 0) break;
+	  sent += n;
+	}
+      }
+    }
+    close(client);
+  }
+  close(server);
+  unlink(socket_path.c_str());
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
@@ -0,0 +1,162 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _SpectrumScan_
+#define _SpectrumScan_
+
+// C includes
+#include <math.h>
+
+// C++ includes
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+// Prob3++ includes
+#include "BargerPropagator.h"
+
+// nu-vs-antinu includes
+#include "WorkerPool.h"
+#include "ConstantDensityKernel.h"
+#include "ColumnArena.h"
+#include "Scenario.h"
+#include "Profiler.h"
+
+/* Parallel "oscillation spectrum" scan: P(nu_mu -> nu_x) (x = e, mu, tau)
+   for a list of points (energy, path) with fixed oscillation parameters,
+   accumulated in the bins of three histograms sharing the same binning.
+
+   The points are split in one contiguous block per worker. Each worker
+   propagates its block with its own propagator and fills its own bin
+   buffers, which live in memory shared with the calling process. The
+   buffers are then added up in the order of the blocks, so the histograms
+   are built with three additions per bin instead of three Fill calls per
+   point. */
+
+#define SPECTRUM_BATCH 4096 // points propagated at once by a worker
+
+// Oscillation parameters of the scan (same conventions of SetMNS)
+struct SpectrumSetup
+{
+  double theta12, theta13, theta23;
+  double DM21, DM32;
+  double delta;     // in radiants
+  double density;   // in g/cm^3
+  bool   kSquared;
+  int    type;      // > 0 neutrinos, < 0 anti-neutrinos
+  bool   use_kernel; // ConstantDensityKernel.h instead of Prob3++
+};
+
+/* Scan n points with the given energies and paths and fill the bins of the
+   variable x[i] (energy or path). The bins are given by n_bins+1 increasing
+   edges, with the same convention of ROOT: bin 0 is the underflow, bin b
+   contains [edges[b-1], edges[b]) and bin n_bins+1 is the overflow.
+   content[j] (j = 0:e 1:mu 2:tau) must have room for n_bins+2 values. */
+inline void ParallelSpectrumScan(const SpectrumSetup & setup, int n,
+				 const double * energy, const double * path,
+				 const double * x, int n_bins, const double * edges,
+				 int n_workers, double * content[3])
+{
+  int j;
+  if (n_workers < 1) n_workers = 1;
+  if (n_workers > n) n_workers = std::max(n, 1);
+  const size_t n_cells = n_bins + 2;
+  const int block = (n + n_workers - 1) / n_workers;
+
+  /* One propagator and one set of bin buffers per worker (and block), both
+     released also when a worker fails and ParallelFor throws. The buffer of
+     bin k of block t is the column t * 3 + k of the shared arena. */
+  std::vector<std::unique_ptr<BargerPropagator> > bNu_worker(n_workers);
+  for (int w = 0; w < n_workers; w++) {
+    bNu_worker[w].reset( new BargerPropagator( ) );
+    bNu_worker[w]->UseMassEigenstates( false );
+  }
+  ColumnArena bins(true);
+  bins.Reserve(n_workers * 3, n_cells);
+
+  ParallelFor(n_workers, n_workers, [&](int worker, uint64_t task) {
+      const int first = task * block;
+      const int last = std::min(n, first + block);
+      double * local[3];
+      for (int k = 0; k < 3; k++) local[k] = bins.Column(task * 3 + k);
+
+      KernelPropagator kernel;
+      kernel.SetMixing( setup.theta12, setup.theta13, setup.theta23,
+			setup.DM21, setup.DM32, setup.kSquared );
+      kernel.SetPhase( setup.delta, setup.type );
+      std::vector<double> delta(SPECTRUM_BATCH, setup.delta);
+      std::vector<int>    type(SPECTRUM_BATCH, setup.type);
+      std::vector<double> prob[3];
+      BargerProbabilityBuffer buffer = {};
+      for (int k = 0; k < 3; k++) {
+	prob[k].resize(SPECTRUM_BATCH);
+	buffer.Prob[1][k] = &prob[k][0];
+      }
+
+      for (int b0 = first; b0 < last; b0 += SPECTRUM_BATCH) {
+	const int m = std::min(SPECTRUM_BATCH, last - b0);
+	{
+	  ProfileScope scope( PROFILE_PROPAGATION, m );
+	  if (setup.use_kernel)
+	    kernel.PropagateEnergies( m, energy + b0, path + b0, setup.density,
+				      buffer );
+	  else
+	    ProfileLinearBatch( bNu_worker[worker].get(), m, setup.theta12,
+				setup.theta13, setup.theta23, setup.DM21,
+				setup.DM32, setup.kSquared, energy + b0,
+				&delta[0], &type[0], path + b0, setup.density,
+				buffer );
+	}
+
+	{
+	  ProfileScope scope( PROFILE_UNITARITY, m );
+	  CheckUnitarity( m, buffer, energy + b0 );
+	}
+
+	ProfileScope scope( PROFILE_FILL, m );
+	for (int i = 0; i < m; i++) {
+	  const int bin = std::upper_bound(edges, edges + n_bins + 1, x[b0 + i]) - edges;
+	  for (int k = 0; k < 3; k++) local[k][bin] += prob[k][i];
+	}
+      }
+    });
+
+  // Merge the buffers of the blocks in order
+  ProfileScope scope( PROFILE_FILL, 0 );
+  for (j = 0; j < 3; j++) {
+    std::fill(content[j], content[j] + n_cells, 0.0);
+    for (int t = 0; t < n_workers; t++) {
+      const double * local = bins.Column(t * 3 + j);
+      for (size_t b = 0; b < n_cells; b++) content[j][b] += local[b];
+    }
+  }
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
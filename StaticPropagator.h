@@ -0,0 +1,170 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _StaticPropagator_
+#define _StaticPropagator_
+
+// C includes
+#include <stdlib.h>
+
+// Prob3++ includes (only for BargerProbabilityBuffer)
+#include "BargerPropagator.h"
+
+// nu-vs-antinu includes
+#include "ConstantDensityKernel.h"
+
+/* Propagator through matter of constant density with the beam type and the
+   angle convention fixed at compile time.
+
+   BargerPropagator decides at every call between neutrinos and
+   anti-neutrinos, sin^2(x) and sin^2(2x) angles, flavour and mass
+   eigenstates, and every call goes through the virtual methods of
+   NeutrinoPropagator. Here kNuType (> 0 neutrinos, < 0 anti-neutrinos) and
+   kSquared (true: sin^2(x), false: sin^2(2x)) are template parameters, the
+   initial states are always flavour states and there is nothing virtual, so
+   the compiler folds the signs of delta and of the matter potential into the
+   code and inlines the whole propagation.
+
+   The physics is the scalar path of ConstantDensityKernel.h, so the results
+   are the same of KernelPropagator to the last bit and agree with Prob3++ to
+   rounding. The interface follows BargerPropagator:
+
+     StaticPropagator<-1> bNuBar;
+     bNuBar.SetMNS( x12, x13, x23, dm21, dm32, d_cp, Energy );
+     bNuBar.propagateLinear( Path, Density );
+     double p = bNuBar.GetProb( 2, 1 ); // mu_bar -> e_bar */
+template<int kNuType, bool kSquared = true>
+class StaticPropagator
+{
+  public:
+
+      StaticPropagator( ) : energy(1) {}
+
+      // same as BargerPropagator::SetMNS, without the convention and the type
+      KERNEL_NO_CONTRACT
+      void SetMNS( double x12, double x13, double x23, double dm21, double dm32,
+		   double d_cp, double Energy )
+      {
+	SetMixing( x12, x13, x23, dm21, dm32 );
+	SetPhase( d_cp );
+	energy = Energy;
+      }
+
+      // the three steps of SetMNS, for callers scanning only some of them
+      void SetMixing( double x12, double x13, double x23, double dm21, double dm32 )
+      { mix = SetKernelMixing( x12, x13, x23, dm21, dm32, kSquared ); }
+
+      KERNEL_NO_CONTRACT
+      void SetPhase( double d_cp )
+      {
+	const int type = kNuType;
+	KernelVacuumBlock<1>( mix, &d_cp, &type, vacuum );
+      }
+
+      void SetEnergy( double Energy ) { energy = Energy; }
+
+      // Path length in Km and density in g/cm^3
+      KERNEL_NO_CONTRACT
+      void propagateLinear( double Path, double Density )
+      {
+	const int type = kNuType;
+	ConstantDensityBlock<1>( vacuum, &energy, &type, &Path, Density, prob );
+      }
+
+      // nu_ - 1:e 2:mu 3:tau (the sign is ignored, as in BargerPropagator)
+      double GetProb( int nuIn, int nuOut ) const
+      { return prob[abs(nuIn) - 1][abs(nuOut) - 1][0]; }
+
+  private:
+
+      KernelMixing mix;
+      KernelVacuumLanes<1> vacuum;
+      double energy;
+      double prob[3][3][1];
+};
+
+/* Same arguments and results of BargerPropagator::propagateLinearBatch, with
+   one StaticPropagator per beam type. The types and the convention are only
+   tested once per point here, outside of the propagators. */
+template<bool kSquared>
+inline void PropagateLinearStatic( int n, double x12, double x13, double x23,
+				   double dm21, double dm32,
+				   const double * energy, const double * d_cp,
+				   const int * nuType, const double * path,
+				   double density, BargerProbabilityBuffer & buffer )
+{
+  StaticPropagator< 1, kSquared> bNu;
+  StaticPropagator<-1, kSquared> bNuBar;
+  bNu.SetMixing( x12, x13, x23, dm21, dm32 );
+  bNuBar.SetMixing( x12, x13, x23, dm21, dm32 );
+  double phase[2] = { 0, 0 };
+  bool valid[2] = { false, false };
+
+  for (int k = 0; k < n; k++) {
+    const int t = nuType[k] > 0 ? 0 : 1;
+    if (!valid[t] || d_cp[k] != phase[t]) {
+      if (t == 0) bNu.SetPhase( d_cp[k] ); else bNuBar.SetPhase( d_cp[k] );
+      phase[t] = d_cp[k];
+      valid[t] = true;
+    }
+    double p[3][3];
+    if (t == 0) {
+      bNu.SetEnergy( energy[k] );
+      bNu.propagateLinear( path[k], density );
+      for (int i = 0; i < 3; i++)
+	for (int j = 0; j < 3; j++) p[i][j] = bNu.GetProb( i + 1, j + 1 );
+    }
+    else {
+      bNuBar.SetEnergy( energy[k] );
+      bNuBar.propagateLinear( path[k], density );
+      for (int i = 0; i < 3; i++)
+	for (int j = 0; j < 3; j++) p[i][j] = bNuBar.GetProb( i + 1, j + 1 );
+    }
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+	if (buffer.Prob[i][j]) buffer.Prob[i][j][k] = p[i][j];
+  }
+}
+
+inline void PropagateLinearStatic( int n, double x12, double x13, double x23,
+				   double dm21, double dm32, bool kSquared,
+				   const double * energy, const double * d_cp,
+				   const int * nuType, const double * path,
+				   double density, BargerProbabilityBuffer & buffer )
+{
+  if (kSquared)
+    PropagateLinearStatic<true>( n, x12, x13, x23, dm21, dm32, energy, d_cp,
+				 nuType, path, density, buffer );
+  else
+    PropagateLinearStatic<false>( n, x12, x13, x23, dm21, dm32, energy, d_cp,
+				  nuType, path, density, buffer );
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
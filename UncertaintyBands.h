@@ -0,0 +1,384 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _UncertaintyBands_
+#define _UncertaintyBands_
+
+// C includes
+#include <math.h>
+#include <stdint.h>
+
+// C++ includes
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Prob3++ includes
+#include "BargerPropagator.h"
+
+// nu-vs-antinu includes
+#include "WorkerPool.h"
+#include "Scenario.h"
+#include "ConstantDensityKernel.h"
+#include "DeltaDecomposition.h"
+#include "Profiler.h"
+
+/* Monte Carlo bands of the ellipses for the uncertainty on the oscillation
+   parameters: every sample draws an offset of theta12, theta13, theta23,
+   DM21, |DM32| and density from their priors, applies it to all the rows of
+   the table and computes their ellipses. For each row and value of delta the
+   band is given by the quantiles of P and of P_bar over the samples: the
+   median and the central 68.27% (1 sigma) and 95.45% (2 sigma) intervals.
+
+   The random numbers come from the counter-based generator Philox4x32-10:
+   the offset of parameter p in sample k is a function of (seed, k, p) only,
+   so the samples are the same whichever worker draws them, and the bands do
+   not depend on the number of workers.
+
+   Each ellipse of a sample is kept as its delta harmonics (three
+   propagations per beam type, see DeltaDecomposition.h), six numbers per
+   row, so 10^5 samples take a few MB. The six propagations of a row go
+   through the oscillation code in one batch: with the simd kernel those of
+   10^5 samples of the four default rows take less than a second on a single
+   core, and the quantiles at 100 values of delta about three seconds. The
+   samples are split among the parallel workers in tasks of BANDS_CHUNK, and
+   the quantiles in one task per row and value of delta. */
+
+#define BANDS_CHUNK 1024 // samples of a task of the workers
+#define BANDS_MIN_SPLITTING 1e-3 // floor of DM21 and |DM32| (see BandSample)
+
+#define BANDS_N_PARAMETERS 6
+#define BANDS_N_QUANTILES  5
+
+enum BandPriorKind { BAND_FIXED, BAND_GAUSS, BAND_FLAT };
+
+// Prior of the offset of a parameter, width in the units of the Scenario
+struct BandPrior
+{
+  int    kind;  // BandPriorKind
+  double width; // sigma of BAND_GAUSS, half width of BAND_FLAT
+};
+
+struct BandResult
+{
+  std::vector<double> delta;    // of the points of the bands
+  /* Quantile q (BandQuantile) of P (t = 0) or P_bar (t = 1) for row s at
+     delta[d], at ((s * delta.size() + d) * 2 + t) * BANDS_N_QUANTILES + q */
+  std::vector<double> quantile;
+  long long n_propagations;
+};
+
+// theta12, theta13, theta23, DM21, DM32, density
+inline const char * BandParameterName( int p )
+{
+  static const char * name[BANDS_N_PARAMETERS] = {
+    "theta12", "theta13", "theta23", "DM21", "DM32", "density" };
+  return name[p];
+}
+
+// Unit of the parameters in the options and in the file of the priors
+inline double BandParameterUnit( int p )
+{
+  static const double unit[BANDS_N_PARAMETERS] = { 1, 1, 1, 1e-5, 1e-3, 1 };
+  return unit[p];
+}
+
+// Cumulative probability of the quantiles: -2, -1, 0, +1, +2 sigma
+inline double BandQuantile( int q )
+{
+  static const double level[BANDS_N_QUANTILES] = {
+    0.022750131948179, 0.158655253931457, 0.5, 0.841344746068543,
+    0.977249868051821 };
+  return level[q];
+}
+
+/* Gaussian priors with about the 1 sigma uncertainties of the PDG 2018
+   averages, and 2% of the density of the crust */
+inline void DefaultBandPriors(BandPrior prior[BANDS_N_PARAMETERS])
+{
+  const double sigma[BANDS_N_PARAMETERS] = { 0.013, 0.0008, 0.02, 0.18e-5,
+					     0.05e-3, 0.054 };
+  for (int p = 0; p < BANDS_N_PARAMETERS; p++) {
+    prior[p].kind = BAND_GAUSS;
+    prior[p].width = sigma[p];
+  }
+}
+
+/* Replace the priors of the parameters listed in a text file, one per line:
+
+     # parameter  prior  width
+     theta23      flat   0.05
+     DM32         gauss  0.05
+     density      none
+
+   "gauss" is a Gaussian of sigma width, "flat" is uniform within +- width and
+   "none" keeps the parameter fixed. The widths are in the units of the
+   command line options (10^-5 eV^2 for DM21, 10^-3 eV^2 for DM32). */
+inline void ReadBandPriors(const std::string & file_name,
+			   BandPrior prior[BANDS_N_PARAMETERS])
+{
+  std::ifstream file(file_name.c_str());
+  if (!file.is_open())
+    throw std::runtime_error("cannot open the file of the priors " + file_name);
+
+  std::string line;
+  int line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    std::istringstream ss(line);
+    std::string name, kind, rest;
+    if (!(ss >> name) || name[0] == '#') continue;
+    std::ostringstream where;
+    where << file_name << ":" << line_number;
+
+    int p = 0;
+    while (p < BANDS_N_PARAMETERS && name != BandParameterName(p)) p++;
+    if (p == BANDS_N_PARAMETERS)
+      throw std::runtime_error(where.str() + ": unknown parameter " + name);
+    double width = 0;
+    if (!(ss >> kind))
+      throw std::runtime_error(where.str() + ": missing prior of " + name);
+    if (kind == "none")
+      prior[p].kind = BAND_FIXED;
+    else if (kind == "gauss" || kind == "flat") {
+      if (!(ss >> width) || width < 0)
+	throw std::runtime_error(where.str() + ": invalid width of " + name);
+      prior[p].kind = kind == "gauss" ? BAND_GAUSS : BAND_FLAT;
+    }
+    else
+      throw std::runtime_error(where.str() + ": unknown prior " + kind);
+    if (ss >> rest)
+      throw std::runtime_error(where.str() + ": unexpected " + rest);
+    prior[p].width = width * BandParameterUnit(p);
+  }
+}
+
+/* Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+   3", SC11): four random words for a 128 bit counter and a 64 bit key */
+inline void Philox4x32(const uint32_t counter[4], const uint32_t key[2],
+		       uint32_t out[4])
+{
+  uint32_t c[4] = { counter[0], counter[1], counter[2], counter[3] };
+  uint32_t k[2] = { key[0], key[1] };
+  for (int round = 0; round < 10; round++) {
+    const uint64_t p0 = (uint64_t) 0xD2511F53 * c[0];
+    const uint64_t p1 = (uint64_t) 0xCD9E8D57 * c[2];
+    const uint32_t next[4] = { (uint32_t) (p1 >> 32) ^ c[1] ^ k[0], (uint32_t) p1,
+			       (uint32_t) (p0 >> 32) ^ c[3] ^ k[1], (uint32_t) p0 };
+    for (int i = 0; i < 4; i++) c[i] = next[i];
+    k[0] += 0x9E3779B9;
+    k[1] += 0xBB67AE85;
+  }
+  for (int i = 0; i < 4; i++) out[i] = c[i];
+}
+
+// Offset of the parameter p in the sample k
+inline double BandOffset(const BandPrior & prior, uint64_t seed, uint64_t k, int p)
+{
+  if (prior.kind == BAND_FIXED || prior.width == 0) return 0;
+  const uint32_t counter[4] = { (uint32_t) k, (uint32_t) (k >> 32), (uint32_t) p, 0 };
+  const uint32_t key[2] = { (uint32_t) seed, (uint32_t) (seed >> 32) };
+  uint32_t word[4];
+  Philox4x32(counter, key, word);
+  // two uniform numbers in [0, 1) with 53 bits each
+  const double u1 = ((word[0] >> 5) * 67108864.0 + (word[1] >> 6)) / 9007199254740992.0;
+  const double u2 = ((word[2] >> 5) * 67108864.0 + (word[3] >> 6)) / 9007199254740992.0;
+  if (prior.kind == BAND_FLAT) return prior.width * (2 * u1 - 1);
+  return prior.width * sqrt(-2 * log(1 - u1)) * cos(2 * M_PI * u2);
+}
+
+/* Offsets of all the parameters in the sample k */
+inline void BandOffsets(const BandPrior prior[BANDS_N_PARAMETERS], uint64_t seed,
+			uint64_t k, double offset[BANDS_N_PARAMETERS])
+{
+  for (int p = 0; p < BANDS_N_PARAMETERS; p++)
+    offset[p] = BandOffset(prior[p], seed, k, p);
+}
+
+/* The row moved by the offsets of a sample. The mixing angles stay in
+   [0, 1], the density positive and DM21 and |DM32| above BANDS_MIN_SPLITTING
+   of their values in the row: a wide prior must not swap the mass states. */
+inline Scenario BandSample(const Scenario & row,
+			   const double offset[BANDS_N_PARAMETERS])
+{
+  Scenario sample = row;
+  sample.theta12 = std::min(1.0, std::max(0.0, row.theta12 + offset[0]));
+  sample.theta13 = std::min(1.0, std::max(0.0, row.theta13 + offset[1]));
+  sample.theta23 = std::min(1.0, std::max(0.0, row.theta23 + offset[2]));
+  sample.DM21    = std::max(BANDS_MIN_SPLITTING * row.DM21, row.DM21 + offset[3]);
+  sample.DM32    = std::max(BANDS_MIN_SPLITTING * fabs(row.DM32),
+			    fabs(row.DM32) + offset[4]);
+  if (row.DM32 < 0) sample.DM32 = -sample.DM32;
+  sample.density = std::max(0.0, row.density + offset[5]);
+  return sample;
+}
+
+/* The quantiles of the values v at the levels of BandQuantile, interpolated
+   between the two nearest values. v is reordered: the median splits it,
+   then the quantiles below are selected among the smaller values only, going
+   outwards, and those above among the larger ones, which takes about two
+   passes over the values instead of five. */
+inline void BandQuantiles(std::vector<double> & v, double out[BANDS_N_QUANTILES])
+{
+  const size_t n = v.size();
+  const int order[BANDS_N_QUANTILES] = { 2, 1, 0, 3, 4 };
+  size_t index[BANDS_N_QUANTILES];
+  double next[BANDS_N_QUANTILES];
+  for (int j = 0; j < BANDS_N_QUANTILES; j++) {
+    const int q = order[j];
+    const double position = BandQuantile(q) * (n - 1);
+    const size_t i = (size_t) position;
+    index[q] = i;
+    const int neighbour = q < 2 ? q + 1 : q - 1; // already selected
+    if (q != 2 && i == index[neighbour]) {
+      next[q] = next[neighbour];
+    }
+    else if (q < 2) {
+      std::nth_element(v.begin(), v.begin() + i, v.begin() + index[q + 1]);
+      next[q] = *std::min_element(v.begin() + i + 1, v.begin() + index[q + 1] + 1);
+    }
+    else {
+      const size_t begin = q == 2 ? 0 : index[q - 1] + 1;
+      std::nth_element(v.begin() + begin, v.begin() + i, v.end());
+      next[q] = i + 1 < n ? *std::min_element(v.begin() + i + 1, v.end()) : v[i];
+    }
+    out[q] = v[i] + (position - i) * (next[q] - v[i]);
+  }
+}
+
+/* Bands of all the rows of table from n_samples samples of the priors, at
+   n_points equal steps of delta from -pi (like the ellipses). kernel is the
+   oscillation code, one of PropagatorKind (see Scenario.h). */
+inline BandResult RunUncertaintyBands(const std::vector<Scenario> & table,
+				      const BandPrior prior[BANDS_N_PARAMETERS],
+				      uint64_t n_samples, int n_points,
+				      uint64_t seed, int n_workers,
+				      int kernel = PROPAGATOR_BARGER)
+{
+  if (n_workers < 1) n_workers = 1;
+  if (n_samples < 2) throw std::runtime_error("the bands need at least two samples");
+  if (n_points < 1) throw std::runtime_error("the bands need at least one point");
+
+  const size_t n_rows = table.size();
+  BandResult result;
+  result.n_propagations = 6 * n_rows * n_samples;
+  for (int d = 0; d < n_points; d++)
+    result.delta.push_back(- M_PI + d * 2 * M_PI / n_points);
+
+  // a[0], a[1], b[1] of P and P_bar for every sample and row
+  const size_t n_harmonics = 6 * n_rows * n_samples;
+  double * harmonics = SharedAlloc<double>(n_harmonics);
+  double * quantile = SharedAlloc<double>(n_rows * n_points * 2 * BANDS_N_QUANTILES);
+
+  std::vector<BargerPropagator *> bNu_worker(n_workers);
+  for (int w = 0; w < n_workers; w++) {
+    bNu_worker[w] = new BargerPropagator( );
+    bNu_worker[w]->UseMassEigenstates( false );
+  }
+
+  try {
+    const uint64_t n_chunks = (n_samples + BANDS_CHUNK - 1) / BANDS_CHUNK;
+    ParallelFor(n_workers, n_chunks, [&](int worker, uint64_t chunk) {
+	const uint64_t end = std::min<uint64_t>(n_samples, (chunk + 1) * (uint64_t) BANDS_CHUNK);
+	ProfileScope scope( PROFILE_PROPAGATION, 6 * n_rows * (end - chunk * BANDS_CHUNK) );
+	// the three values of delta of the harmonics, neutrinos then anti-neutrinos
+	double offset[BANDS_N_PARAMETERS], energy[6], delta[6], path[6], prob[6];
+	int type[6];
+	for (int i = 0; i < 6; i++) {
+	  delta[i] = 2 * M_PI * (i % 3) / 3.0;
+	  type[i] = i < 3 ? 1 : -1;
+	}
+	BargerProbabilityBuffer buffer = {};
+	buffer.Prob[1][0] = prob;
+	for (uint64_t k = chunk * (uint64_t) BANDS_CHUNK; k < end; k++) {
+	  BandOffsets(prior, seed, k, offset);
+	  for (size_t s = 0; s < n_rows; s++) {
+	    const Scenario row = BandSample(table[s], offset);
+	    for (int i = 0; i < 6; i++) {
+	      energy[i] = row.energy;
+	      path[i] = row.distance;
+	    }
+	    if (kernel == PROPAGATOR_SIMD)
+	      PropagateLinearKernel( 6, row.theta12, row.theta13, row.theta23,
+				     row.DM21, row.DM32, true, energy, delta, type,
+				     path, row.density, buffer );
+	    else if (kernel == PROPAGATOR_STATIC)
+	      PropagateLinearStatic<true>( 6, row.theta12, row.theta13, row.theta23,
+					   row.DM21, row.DM32, energy, delta, type,
+					   path, row.density, buffer );
+	    else
+	      ProfileLinearBatch( bNu_worker[worker], 6, row.theta12,
+				  row.theta13, row.theta23, row.DM21, row.DM32,
+				  true, energy, delta, type, path, row.density,
+				  buffer );
+	    double * h = harmonics + 6 * (k * n_rows + s);
+	    for (int t = 0; t < 2; t++) {
+	      const DeltaHarmonics p = DeltaHarmonicsFromSamples( 1, prob + 3 * t );
+	      h[3 * t] = p.a[0];
+	      h[3 * t + 1] = p.a[1];
+	      h[3 * t + 2] = p.b[1];
+	    }
+	  }
+	}
+      });
+
+    ParallelFor(n_workers, n_rows * n_points, [&](int, uint64_t task) {
+	ProfileScope scope( PROFILE_BANDS );
+	const size_t s = task / n_points;
+	const double c = cos(result.delta[task % n_points]);
+	const double sn = sin(result.delta[task % n_points]);
+	std::vector<double> value(n_samples);
+	for (int t = 0; t < 2; t++) {
+	  for (uint64_t k = 0; k < n_samples; k++) {
+	    const double * h = harmonics + 6 * (k * n_rows + s) + 3 * t;
+	    value[k] = h[0] + h[1] * c + h[2] * sn;
+	  }
+	  BandQuantiles(value, quantile + (task * 2 + t) * BANDS_N_QUANTILES);
+	}
+      });
+  }
+  catch(...) {
+    SharedFree(harmonics, n_harmonics);
+    SharedFree(quantile, n_rows * n_points * 2 * BANDS_N_QUANTILES);
+    for (int w = 0; w < n_workers; w++) delete bNu_worker[w];
+    throw;
+  }
+
+  result.quantile.assign(quantile, quantile + n_rows * n_points * 2 * BANDS_N_QUANTILES);
+  SharedFree(harmonics, n_harmonics);
+  SharedFree(quantile, n_rows * n_points * 2 * BANDS_N_QUANTILES);
+  for (int w = 0; w < n_workers; w++) delete bNu_worker[w];
+  return result;
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
@@ -0,0 +1,154 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+#ifndef _WorkerPool_
+#define _WorkerPool_
+
+// C includes
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// C++ includes
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+/* A minimal pool of parallel workers.
+
+   Prob3++ keeps the mixing matrix and the mass splittings of the last
+   SetMNS call in file-scope static variables (see mosc.c), so two
+   BargerPropagator objects living in the same process are NOT independent
+   and cannot be used from different threads. For this reason the workers
+   are forked processes: each one owns its own copy of the Prob3++ state and
+   of its propagator, and the results are written in memory shared with the
+   parent process (see SharedAlloc).
+
+   Tasks are handed out dynamically through a shared counter, but since every
+   task writes only its own slice of the output, the results depend neither
+   on the number of workers nor on the order of execution. The tasks are
+   counted in 64 bits, so their number is only limited by the memory. */
+
+#if ATOMIC_LLONG_LOCK_FREE != 2
+#error "std::atomic<long long> must be lock-free to be shared between processes"
+#endif
+
+/* Largest number of points of a task. The propagators take the size of a
+   batch as an int, so the points are split in tasks of at most this size
+   whatever their total number. */
+#define MAX_TASK_POINTS (1 << 20)
+
+// Allocate an array of n objects of type T visible to all the workers.
+// The memory is zero-initialized. Release it with SharedFree.
+template<class T>
+T * SharedAlloc(size_t n)
+{
+  void * p = mmap(NULL, n * sizeof(T), PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    throw std::runtime_error("cannot allocate shared memory for the workers");
+  return (T *) p;
+}
+
+template<class T>
+void SharedFree(T * p, size_t n)
+{
+  munmap((void *) p, n * sizeof(T));
+}
+
+/* Call job(worker, task) for every task in [0, n_tasks) using n_workers
+   parallel workers. The worker index is in [0, n_workers) and can be used to
+   select per-worker resources like a propagator. When n_workers is one the
+   tasks are run serially in the calling process, in increasing order.
+   An exception is thrown if any of the workers fails. */
+inline void ParallelFor(int n_workers, uint64_t n_tasks,
+			const std::function<void(int, uint64_t)> & job)
+{
+  uint64_t task;
+  int worker, status;
+  bool failed = false;
+
+  if ((uint64_t) n_workers > n_tasks) n_workers = n_tasks;
+  if (n_workers <= 1) {
+    for (task = 0; task < n_tasks; task++) job(0, task);
+    return;
+  }
+
+  std::atomic<unsigned long long> * next =
+    SharedAlloc<std::atomic<unsigned long long> >(1);
+  new (next) std::atomic<unsigned long long>(0);
+
+  // Otherwise the buffered output would be printed once per worker
+  std::cout.flush();
+  std::cerr.flush();
+  fflush(NULL);
+
+  std::vector<pid_t> pids;
+  for (worker = 0; worker < n_workers; worker++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      failed = true;
+      break;
+    }
+    if (pid == 0) {
+      int exit_code = 0;
+      try {
+	while ((task = next->fetch_add(1)) < n_tasks) job(worker, task);
+      }
+      catch(std::exception& e) {
+	std::cerr << "  Error in worker " << worker << ": " << e.what() << "\n";
+	exit_code = 1;
+      }
+      std::cout.flush();
+      std::cerr.flush();
+      fflush(NULL);
+      _exit(exit_code);
+    }
+    pids.push_back(pid);
+  }
+
+  for (size_t i = 0; i < pids.size(); i++) {
+    if (waitpid(pids[i], &status, 0) < 0 ||
+	!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      failed = true;
+  }
+
+  SharedFree(next, 1);
+  if (failed)
+    throw std::runtime_error("at least one of the parallel workers failed");
+}
+
+#endif
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
@@ -0,0 +1,396 @@
+/*
+ * nu-vs-antinu
+ * Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+ * Released under the GPLv3 license
+ *
+ * This file is part of nu-vs-antinu.
+ * nu-vs-antinu is a simple program that produces a graph to quickly estimate
+ * the sensibility of a given experiment to the neutrino mass hierarchy.
+ */
+
+// C includes
+#include <math.h>
+
+// C++ includes
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+
+// Prob3++ includes
+#include "BargerPropagator.h"
+
+// nu-vs-antinu includes
+#include "Scenario.h"
+#include "SpectrumScan.h"
+#include "ProbabilityTable.h"
+#include "Server.h" // JsonString
+
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+using namespace std;
+
+/* Benchmarks of the oscillation code and of the two programs.
+
+   Every benchmark is a function doing a fixed amount of work (calls of the
+   propagator, points of a scan) which is run once to warm up and then timed
+   --repeat times. For each one the mean and the standard deviation over the
+   repetitions of the time per call and of the throughput are reported, on
+   the terminal and optionally as JSON, so that the results of different
+   builds (Prob3++ version, compiler, flags) can be compared. */
+
+// The oscillation parameters of the default nu_vs_antinu table (T2K)
+#define BENCH_THETA12   0.320
+#define BENCH_THETA13   0.021
+#define BENCH_THETA23   0.46
+#define BENCH_DM21      7.55e-5
+#define BENCH_DM32      2.50e-3
+#define BENCH_DENSITY   2.70
+#define BENCH_ENERGY    0.600
+#define BENCH_DISTANCE  295
+
+struct Benchmark
+{
+  string name;
+  string unit;           // what a call is: "call", "point", ...
+  long long n_calls;     // calls per repetition
+  vector<double> time;   // seconds per repetition
+
+  double Mean() const
+  { double m = 0; for (size_t r = 0; r < time.size(); r++) m += time[r]; return m / time.size(); }
+  double StdDev() const
+  {
+    if (time.size() < 2) return 0;
+    double m = Mean(), v = 0;
+    for (size_t r = 0; r < time.size(); r++) v += (time[r] - m) * (time[r] - m);
+    return sqrt(v / (time.size() - 1));
+  }
+  double NsPerCall() const       { return 1e9 * Mean() / n_calls; }
+  double NsPerCallStdDev() const { return 1e9 * StdDev() / n_calls; }
+  double CallsPerSecond() const  { return n_calls / Mean(); }
+  // first order propagation of the spread of the time
+  double CallsPerSecondStdDev() const { return CallsPerSecond() * StdDev() / Mean(); }
+};
+
+Benchmark RunBenchmark(const string & name, const string & unit, long long n_calls,
+		       int n_repeat, const function<void()> & job)
+{
+  Benchmark b;
+  b.name = name;
+  b.unit = unit;
+  b.n_calls = n_calls;
+  job(); // warm up
+  for (int r = 0; r < n_repeat; r++) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    job();
+    b.time.push_back(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+  }
+  std::cout << "  " << left << setw(34) << name << right << setw(12) << fixed
+	    << setprecision(1) << b.NsPerCall() << " +- " << setw(8)
+	    << b.NsPerCallStdDev() << " ns/" << setw(6) << left << unit << right
+	    << setw(14) << setprecision(0) << b.CallsPerSecond() << " " << unit
+	    << "s/s" << std::endl;
+  std::cout.unsetf(ios::floatfield);
+  std::cout << setprecision(6);
+  return b;
+}
+
+void WriteJson(ostream & out, const vector<Benchmark> & results, int n_repeat,
+	       int n_threads)
+{
+  out << setprecision(9);
+  out << "{\n"
+      << "  \"compiler\": " << JsonString(__VERSION__) << ",\n"
+      << "  \"kernel_instruction_set\": " << JsonString(KernelInstructionSet()) << ",\n"
+      << "  \"repeat\": " << n_repeat << ",\n"
+      << "  \"threads\": " << n_threads << ",\n"
+      << "  \"timestamp\": " << (long long) time(NULL) << ",\n"
+      << "  \"benchmarks\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const Benchmark & b = results[i];
+    out << "    {\"name\": " << JsonString(b.name)
+	<< ", \"unit\": " << JsonString(b.unit)
+	<< ", \"calls\": " << b.n_calls
+	<< ", \"ns_per_call\": " << b.NsPerCall()
+	<< ", \"ns_per_call_stddev\": " << b.NsPerCallStdDev()
+	<< ", \"calls_per_second\": " << b.CallsPerSecond()
+	<< ", \"calls_per_second_stddev\": " << b.CallsPerSecondStdDev()
+	<< ", \"seconds\": [";
+    for (size_t r = 0; r < b.time.size(); r++)
+      out << (r ? ", " : "") << b.time[r];
+    out << "]}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  out << "  ]\n}\n";
+}
+
+int main(int argc, char * argv[] )
+{
+  int n_repeat = 10;
+  long long n_calls = 100000;
+  int n_threads = 1;
+  string json_file;
+  string only;
+
+  try {
+    po::options_description desc("Allowed options");
+    desc.add_options()
+      ("help", "produce help message")
+      ("repeat",  po::value<int>(&n_repeat)->default_value(10),
+       "Number of timed repetitions of every benchmark")
+      ("calls",   po::value<long long>(&n_calls)->default_value(100000),
+       "Calls per repetition of the single propagator benchmarks")
+      ("threads", po::value<int>(&n_threads)->default_value(1),
+       "Number of parallel workers of the ellipses and of the energy scan")
+      ("json",    po::value<string>(&json_file),
+       "Write the results to this JSON file (\"-\" for the standard output)")
+      ("only",    po::value<string>(&only),
+       "Run only the benchmarks whose name contains this string")
+      ;
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      std::cout << desc << "\n";
+      return 0;
+    }
+    if (n_repeat < 1 || n_calls < 1 || n_threads < 1)
+      throw std::runtime_error("--repeat, --calls and --threads must be positive");
+  }
+  catch(exception& e) {
+    cerr << "  Error: " << e.what() << "\n";
+    return 1;
+  }
+
+  // With --json - the table goes to the standard error
+  streambuf * cout_buffer = std::cout.rdbuf();
+  if (json_file == "-") std::cout.rdbuf(std::cerr.rdbuf());
+
+  std::cout << std::endl << "  Benchmarks (" << n_repeat << " repetitions, "
+	    << n_threads << " threads, kernel " << KernelInstructionSet() << ")"
+	    << std::endl << std::endl;
+
+  vector<Benchmark> results;
+  const long long n_path = max(1LL, n_calls / 10); // Earth paths are slower
+  BargerPropagator bNu;
+  bNu.UseMassEigenstates( false );
+  volatile double sink = 0;
+
+  // Energies cycled through by the single propagator benchmarks
+  vector<double> energy(1024);
+  for (size_t i = 0; i < energy.size(); i++)
+    energy[i] = 0.1 * pow(100.0, i / (double) energy.size());
+
+  /***** Prob3++ *****/
+
+  if (only.empty() || string("SetMNS").find(only) != string::npos)
+    results.push_back(RunBenchmark("SetMNS", "call", n_calls, n_repeat, [&]() {
+	  for (long long i = 0; i < n_calls; i++)
+	    bNu.SetMNS( BENCH_THETA12, BENCH_THETA13, BENCH_THETA23, BENCH_DM21,
+			BENCH_DM32, 0.0, energy[i & 1023], true, 1 );
+	}));
+
+  if (only.empty() || string("propagateLinear").find(only) != string::npos)
+    results.push_back(RunBenchmark("propagateLinear", "call", n_calls, n_repeat, [&]() {
+	  bNu.SetMNS( BENCH_THETA12, BENCH_THETA13, BENCH_THETA23, BENCH_DM21,
+		      BENCH_DM32, 0.0, BENCH_ENERGY, true, 1 );
+	  for (long long i = 0; i < n_calls; i++) {
+	    bNu.propagateLinear( 1, BENCH_DISTANCE + (i & 1023), BENCH_DENSITY );
+	    sink = sink + bNu.GetProb( 2, 1 );
+	  }
+	}));
+
+  if (only.empty() || string("SetMNS+propagateLinear").find(only) != string::npos)
+    results.push_back(RunBenchmark("SetMNS+propagateLinear", "call", n_calls, n_repeat, [&]() {
+	  for (long long i = 0; i < n_calls; i++) {
+	    bNu.SetMNS( BENCH_THETA12, BENCH_THETA13, BENCH_THETA23, BENCH_DM21,
+			BENCH_DM32, 0.0, energy[i & 1023], true, 1 );
+	    bNu.propagateLinear( 1, BENCH_DISTANCE, BENCH_DENSITY );
+	    sink = sink + bNu.GetProb( 2, 1 );
+	  }
+	}));
+
+  /* Atmospheric neutrinos through the Earth: cos(zenith) from -1 to 0 and
+     production height of 15 Km, as in the Prob3++ examples */
+  if (only.empty() || string("DefinePath+propagate").find(only) != string::npos)
+    results.push_back(RunBenchmark("DefinePath+propagate", "call", n_path, n_repeat, [&]() {
+	  bNu.SetMNS( BENCH_THETA12, BENCH_THETA13, BENCH_THETA23, BENCH_DM21,
+		      BENCH_DM32, 0.0, 5.0, true, 1 );
+	  for (long long i = 0; i < n_path; i++) {
+	    bNu.DefinePath( - (i % 1000 + 0.5) / 1000.0, 15.0 );
+	    bNu.propagate( 1 );
+	    sink = sink + bNu.GetProb( 2, 1 );
+	  }
+	}));
+
+  /***** Propagators specialised at compile time *****/
+
+  /* The same sequence of SetMNS+propagateLinear, with the beam type and the
+     angle convention fixed at compile time (StaticPropagator.h) */
+  if (only.empty() || string("static SetMNS+propagateLinear").find(only) != string::npos) {
+    StaticPropagator<1> sNu;
+    results.push_back(RunBenchmark("static SetMNS+propagateLinear", "call", n_calls, n_repeat, [&]() {
+	  for (long long i = 0; i < n_calls; i++) {
+	    sNu.SetMNS( BENCH_THETA12, BENCH_THETA13, BENCH_THETA23, BENCH_DM21,
+			BENCH_DM32, 0.0, energy[i & 1023] );
+	    sNu.propagateLinear( BENCH_DISTANCE, BENCH_DENSITY );
+	    sink = sink + sNu.GetProb( 2, 1 );
+	  }
+	}));
+  }
+
+  /***** Vectorized kernel *****/
+
+  if (only.empty() || string("PropagateLinearKernel").find(only) != string::npos) {
+    vector<double> e(n_calls), d(n_calls, 0.0), L(n_calls, BENCH_DISTANCE), p(n_calls);
+    vector<int> t(n_calls, 1);
+    for (long long i = 0; i < n_calls; i++) e[i] = energy[i & 1023];
+    BargerProbabilityBuffer buffer = {};
+    buffer.Prob[1][0] = &p[0];
+    results.push_back(RunBenchmark("PropagateLinearKernel", "point", n_calls, n_repeat, [&]() {
+	  PropagateLinearKernel( n_calls, BENCH_THETA12, BENCH_THETA13, BENCH_THETA23,
+				 BENCH_DM21, BENCH_DM32, true, &e[0], &d[0], &t[0],
+				 &L[0], BENCH_DENSITY, buffer );
+	}));
+  }
+
+  /***** The four ellipses of nu_vs_antinu *****/
+
+  vector<Scenario> table;
+  Scenario row;
+  row.theta12  = BENCH_THETA12;
+  row.theta13  = BENCH_THETA13;
+  row.DM21     = BENCH_DM21;
+  row.density  = BENCH_DENSITY;
+  row.energy   = BENCH_ENERGY;
+  row.distance = BENCH_DISTANCE;
+  for (int k = 0; k < 4; k++) row.markers.push_back(0.5 * k * M_PI);
+  for (int o = 0; o < 2; o++)
+    for (int h = 0; h < 2; h++) {
+      row.theta23 = o == 0 ? 0.46 : 0.59;
+      row.DM32 = h == 0 ? 2.50e-3 : -2.55e-3;
+      table.push_back(row);
+    }
+  const int n_delta_steps = 1000;
+  // the markers are on the grid of delta, so they are taken from the ellipse
+  const long long n_ellipse_points = 4 * 2 * (n_delta_steps + 1);
+
+  ScenarioEngine engine(n_threads);
+  // modes 0-2 are PropagatorKind, 3 the closed form with Prob3++
+  const char * ellipse_name[4] = { "ellipses", "ellipses (simd)", "ellipses (static)",
+				   "ellipses (analytic)" };
+  for (int mode = 0; mode < 4; mode++) {
+    if (!only.empty() && string(ellipse_name[mode]).find(only) == string::npos) continue;
+    results.push_back(RunBenchmark(ellipse_name[mode], "point", n_ellipse_points, n_repeat, [&]() {
+	  engine.SetKernel(mode == 3 ? PROPAGATOR_BARGER : mode);
+	  engine.Run(table, n_delta_steps, mode == 3);
+	}));
+  }
+
+  // The same path as 36 segments of alternating density (see DensityProfile.h)
+  if (only.empty() || string("ellipses (36 segments)").find(only) != string::npos) {
+    vector<DensitySegment> profile(36);
+    for (size_t k = 0; k < profile.size(); k++) {
+      profile[k].length = BENCH_DISTANCE / (double) profile.size();
+      profile[k].density = BENCH_DENSITY + (k % 2 == 0 ? 0.2 : -0.2);
+    }
+    ScenarioEngine profile_engine(n_threads);
+    profile_engine.SetDensityProfile(profile);
+    results.push_back(RunBenchmark("ellipses (36 segments)", "point", n_ellipse_points,
+				   n_repeat, [&]() {
+	  profile_engine.Run(table, n_delta_steps);
+	}));
+  }
+
+  /***** Lookup tables *****/
+
+  /* Queries of the table of the first ellipse from 0.1 to 10 GeV (see
+     ProbabilityTable.h), built once before the timing, at the energies of
+     the single propagator benchmarks and at 1024 values of delta */
+  const char * table_name[2] = { "table query", "table query (cos, sin given)" };
+  if (only.empty() || string(table_name[0]).find(only) != string::npos ||
+      string(table_name[1]).find(only) != string::npos) {
+    ProbabilityTable lookup(table[0], 0.1, 10, 256, 0, n_threads);
+    vector<double> delta(1024), cos_delta(1024), sin_delta(1024);
+    for (size_t i = 0; i < delta.size(); i++) {
+      delta[i] = 2 * M_PI * ((i * 337) % 1024) / 1024.0;
+      cos_delta[i] = cos(delta[i]);
+      sin_delta[i] = sin(delta[i]);
+    }
+    for (int mode = 0; mode < 2; mode++) {
+      if (!only.empty() && string(table_name[mode]).find(only) == string::npos) continue;
+      results.push_back(RunBenchmark(table_name[mode], "call", n_calls, n_repeat, [&]() {
+	    double sum = 0;
+	    for (long long i = 0; i < n_calls; i++)
+	      sum += mode == 0 ?
+		lookup.Eval(energy[i & 1023], delta[(i >> 10) & 1023], i & 1 ? -1 : 1) :
+		lookup.Eval(energy[i & 1023], cos_delta[(i >> 10) & 1023],
+			    sin_delta[(i >> 10) & 1023], i & 1 ? -1 : 1);
+	    sink = sink + sum;
+	  }));
+    }
+  }
+
+  /***** The energy scan of example *****/
+
+  const int n_bins = 100000;
+  vector<double> edges(n_bins + 1), scan_path(n_bins + 1, 810.0);
+  vector<double> content_e(n_bins + 2), content_mu(n_bins + 2), content_tau(n_bins + 2);
+  double * content[3] = { &content_e[0], &content_mu[0], &content_tau[0] };
+  for (int i = 0; i <= n_bins; i++) edges[i] = 1e-3 * pow(10.0, 4.0 * i / n_bins);
+  const char * scan_name[2] = { "example energy scan", "example energy scan (simd)" };
+  for (int mode = 0; mode < 2; mode++) {
+    if (!only.empty() && string(scan_name[mode]).find(only) == string::npos) continue;
+    SpectrumSetup setup = { BENCH_THETA12, BENCH_THETA13, BENCH_THETA23,
+			    BENCH_DM21, BENCH_DM32, 0.0, BENCH_DENSITY, true, 1,
+			    mode == 1 };
+    results.push_back(RunBenchmark(scan_name[mode], "point", n_bins + 1, n_repeat, [&]() {
+	  ParallelSpectrumScan( setup, n_bins + 1, &edges[0], &scan_path[0],
+				&edges[0], n_bins, &edges[0], n_threads, content );
+	}));
+  }
+
+  std::cout.rdbuf(cout_buffer);
+  if (!json_file.empty()) {
+    if (json_file == "-")
+      WriteJson(std::cout, results, n_repeat, n_threads);
+    else {
+      ofstream out(json_file.c_str());
+      if (!out.is_open()) {
+	cerr << "  Error: cannot open " << json_file << "\n";
+	return 1;
+      }
+      WriteJson(out, results, n_repeat, n_threads);
+      std::cout << std::endl << "  Results written to " << json_file << std::endl;
+    }
+  }
+  return 0;
+}
+
+/*  Copyright (C) 2018  Pintaudi Giorgio
+
+    This file is part of nu-vs-antinu.
+    nu-vs-antinu is a simple program that produces a graph to quickly estimate
+    the sensibility of a given experiment to the neutrino mass hierarchy.
+
+    nu-vs-antinu is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    nu-vs-antinu is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
+*/
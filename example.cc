@@ -18,13 +18,24 @@
 #include <ctime>
 #include <string>
 #include <sstream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
 
 // ROOT includes
 #include "TFile.h"
 #include "TH1D.h"
 
 // Prob3++ includes
-#include "/home/neo/Code/Prob3/BargerPropagator.h"
+#include "BargerPropagator.h"
+
+// nu-vs-antinu includes
+#include "ConstantDensityKernel.h"
+#include "ColumnArena.h"
+#include "SpectrumScan.h"
+#include "Profiler.h"
+#include "ColumnFile.h"
 
 /* Boost library includes
 
@@ -51,11 +62,21 @@ using namespace std;
 int main(int argc, char * argv[] )
 {
   int i, j;
+  const long long start_time = ProfileNow();
   
   /// Oscillation Parameters
   bool kSquared = true;   // Using sin^2(x) variables and not sin^2(2*x)
 
   int    mode = 1; // 1 for neutrino or -1 for anti-neutrino
+  bool   use_kernel = false; // vectorized kernel instead of Prob3++
+  string format = "root"; // "root" or "columns" (see ColumnFile.h)
+
+  //// Binning
+  int NBinsEnergy = 100000;
+  int NBinsPath   = 100000;
+
+  int  n_threads = 1;  // Number of parallel workers of the scans
+  bool speedup = false; // Time the scans from 1 to n_threads workers
 
   double theta23 = 0.46; // This is actually sin^2(42.7°) Lower Octant
   //  double theta23 = 0.59; // This is actually sin^2(50.2°) Upper Octant
@@ -88,6 +109,24 @@ int main(int argc, char * argv[] )
       ("theta23",   po::value<double>(), "Sin^2(theta23)")     
       ("beammode",  po::value<int>(), "\"1\": for neutrino mode or \"-1\""
        " for anti-neutrino mode")
+      ("energy-bins", po::value<int>(&NBinsEnergy)->default_value(100000),
+       "Number of bins of the energy scan")
+      ("path-bins",   po::value<int>(&NBinsPath)->default_value(100000),
+       "Number of bins of the baseline scan")
+      ("threads",   po::value<int>(&n_threads)->default_value(1),
+       "Number of parallel workers of the scans")
+      ("speedup",   "Time the scans with 1, 2, 4, ... up to --threads workers"
+       " and report the speedup")
+      ("kernel",    po::value<string>()->default_value("barger"),
+       "Oscillation code: \"barger\" for Prob3++ or \"simd\" for the"
+       " vectorized constant density kernel")
+      ("format",    po::value<string>(&format)->default_value("root"),
+       "Output format: \"root\" for example.root or \"columns\" for the"
+       " memory-mappable binary file example.nva (see ColumnFile.h)")
+      ("profile",   "Print the time spent in each phase of the run and the"
+       " number of calls at exit")
+      ("profile-json", po::value<string>(), "Same as --profile and also write"
+       " the table to this JSON file")
       ;
 
     /* The following three lines of code, create the object "vm" that will contain
@@ -97,6 +136,12 @@ int main(int argc, char * argv[] )
     po::store(po::parse_command_line(argc, argv, desc), vm);
     po::notify(vm);
 
+    if (vm.count("profile") || vm.count("profile-json")) {
+      ProfileEnable(start_time, vm.count("profile-json") ?
+		    vm["profile-json"].as<string>() : "");
+      ProfileAdd(PROFILE_OPTIONS, ProfileNow() - start_time);
+    }
+
     // The --help option produces the description of all the allowed options 
     if (vm.count("help")) {
       std::cout << desc << "\n";
@@ -132,6 +177,22 @@ int main(int argc, char * argv[] )
 	" is assumed to be " << theta23 << " .\n";
     }
 
+    if (NBinsEnergy < 1 || NBinsPath < 1)
+      throw std::runtime_error("the number of bins must be positive");
+    if (n_threads < 1)
+      throw std::runtime_error("the number of threads must be positive");
+    speedup = vm.count("speedup");
+
+    if (vm["kernel"].as<string>() == "simd")
+      use_kernel = true;
+    else if (vm["kernel"].as<string>() != "barger")
+      throw po::validation_error(po::validation_error::invalid_option_value,
+				 "kernel", vm["kernel"].as<string>());
+
+    if (format != "root" && format != "columns")
+      throw po::validation_error(po::validation_error::invalid_option_value,
+				 "format", format);
+
     if (vm.count("beammode")) {
       if (vm["beammode"].as<int>() == 1) {
 	std::cout << "  Beam mode was set to neutrino mode"
@@ -171,23 +232,39 @@ int main(int argc, char * argv[] )
             << "      theta23    " <<  theta23     << std::endl
             << "      theta13    " <<  theta13     << std::endl
             << "      theta12    " <<  theta12     << std::endl
-            << "      mode       " <<  mode        << std::endl;
+            << "      mode       " <<  mode        << std::endl
+            << "      bins       " <<  NBinsEnergy << " (energy) "
+            << NBinsPath << " (path)" << std::endl
+            << "      threads    " <<  n_threads   << std::endl
+            << "      kernel     " << (use_kernel ? KernelInstructionSet() :
+				      "Prob3++") << std::endl;
 
   /****************** End of summary ******************/
  
   /****************** Histograms ******************/
 
   stringstream ssE, ssL;
-  TH1D * histos[2][2];
+  TH1D * histos[3][2];
   double Entry;
   
-  //// Binning     
-  int NBinsEnergy = 100000;
-  int NBinsPath   = 100000; 
-  
+  /* All the arrays of the scans are columns of a single arena on the heap,
+     so the number of bins is only limited by the memory:
+       0: path length edges  1: energy edges  2-3: energy and path of the
+       points  4-6: bin contents of P(mu->e), P(mu->mu) and P(mu->tau) of the
+       energy scan  7-9: the same for the baseline scan */
+  int NPoints = max(NBinsEnergy, NBinsPath) + 2;
+  ColumnArena arena;
+  try {
+    arena.Reserve(10, NPoints);
+  }
+  catch(exception& e) {
+    cerr << "  Error: " << e.what() << "\n";
+    return 1;
+  }
+
   /***** Path Length *****/
   // The unit of measure is Km
-  double PathLengthEdge[NBinsPath+1];
+  double * PathLengthEdge = arena.Column(0);
   double BasePath = 810.0; // The T2K path length is approximately 295 Km and NOvA is 810 Km
   double path_start = 0;
   double path_end = 2000.0;
@@ -203,7 +280,7 @@ int main(int argc, char * argv[] )
 
   /***** Energy Range *****/
   // The unit of measure is GeV
-  double EnergyBins[NBinsEnergy+1];
+  double * EnergyBins = arena.Column(1);
   double BaseEnergy = 2; // T2K mean neutrino flux energy is 600 MeV  
   double e_start = 1.0e-3; // 1MeV 
   double e_end  =  10.0  ; // 10 GeV
@@ -219,6 +296,8 @@ int main(int argc, char * argv[] )
     }
 
   /***** Create the ROOT histograms for the neutrino oscillations *****/
+
+  ProfileScope setup_scope(PROFILE_SETUP);
   
   ///////////////////////////
   /// mu to E 
@@ -261,70 +340,141 @@ int main(int argc, char * argv[] )
 
   histos[2][0] = lmu2tauE; 
   histos[2][1] = lmu2tauL; 
+  setup_scope.Stop();
 
   /****************** End of histograms ******************/
 
-  double total_prob;
-  double path, energy;
-  BargerPropagator   * bNu;
-  bNu = new BargerPropagator( );
-  bNu->UseMassEigenstates( false );
-
-  /* The following loop spans all the energy range for Baseline given by
-     Base_Path. The energy is "scanned" logarithmically. */
-  
-  for ( i = 0 ; i <= NBinsEnergy ; i++ )
-    {
-      total_prob = 0.0;
-      energy = e_start*pow(10.0, double(i)*e_step);
-      bNu->SetMNS( theta12, theta13, theta23, DM21, DM32, delta,
-  		   energy, kSquared, mode ); 
-      bNu->propagateLinear( 1*mode, BasePath, Density );
-
-      for( j = 1; j <= 3; j++)
-  	total_prob += bNu->GetProb(2, j); // Normalize the Probabilities //
-
-      if ( total_prob >1.00001 || total_prob<0.99998 )
-  	{
-  	  std::cerr << "  ERROR (i = " << i << ") - Prob: " << total_prob
-  		    << " - Energy: "<< energy << " " << std::endl;
-  	  abort(); }
-
-      for( j = 1 ; j <= 3 ; j++ ) {
-      	histos[j-1][0]->Fill( energy, bNu->GetProb(2, j) );
-      	// std::cout << "     Energy = " << energy << " GeV - Prob (1, "
-      	// 	  << j << ") = " << bNu->GetProb(2, j) << std::endl;
-      }
-    } // End Energy Loop //
+  /* Both scans are split among the parallel workers (see SpectrumScan.h).
+     Each worker has its own propagator and its own bin buffers, and the
+     buffers are added up at the end. With --kernel simd the energy
+     independent part (mixing matrix, mass splittings and the vacuum
+     Hamiltonian for delta and the beam mode) is built once per worker, and
+     each point of the scans only adds the matter term. */
+  SpectrumSetup setup = { theta12, theta13, theta23, DM21, DM32, delta,
+			  Density, kSquared, mode, use_kernel };
+  double * batch_energy = arena.Column(2);
+  double * batch_path   = arena.Column(3);
+  double * content[3][2];
+  for( j = 0 ; j < 3 ; j++ ) {
+    content[j][0] = arena.Column(4 + j);
+    content[j][1] = arena.Column(7 + j);
+  }
+  double * energy_content[3] = { content[0][0], content[1][0], content[2][0] };
+  double * path_content[3]   = { content[0][1], content[1][1], content[2][1] };
+
+  /* The energy scan spans all the energy range for Baseline given by
+     Base_Path. The energy is "scanned" logarithmically. The baseline scan
+     spans the baseline for a energy given by BaseEnergy. The range is
+     "scanned" linearly. */
+  vector<int> workers;
+  for( int w = 1 ; speedup && w < n_threads ; w *= 2 ) workers.push_back(w);
+  workers.push_back(n_threads);
+
+  vector<double> wall_time(workers.size());
+  /* A failed worker makes ParallelSpectrumScan throw (see WorkerPool.h) */
+  try {
+    for( size_t t = 0 ; t < workers.size() ; t++ ) {
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+      for ( i = 0 ; i <= NBinsEnergy ; i++ )
+	{
+	  batch_energy[i] = e_start*pow(10.0, double(i)*e_step);
+	  batch_path[i]   = BasePath;
+	}
+      ParallelSpectrumScan( setup, NBinsEnergy + 1, batch_energy, batch_path,
+			    batch_energy, NBinsEnergy, EnergyBins, workers[t],
+			    energy_content );
+      ProfileScope energy_scope(PROFILE_GRAPHS, 3);
+      for( j = 0 ; j < 3 ; j++ ) {
+	for( int b = 0 ; b <= NBinsEnergy + 1 ; b++ )
+	  histos[j][0]->SetBinContent( b, content[j][0][b] );
+	histos[j][0]->SetEntries( NBinsEnergy + 1 );
+      } // End Energy Loop //
+      energy_scope.Stop();
+
+      for ( i = 0 ; i < NBinsPath ; i++ )
+	{
+	  batch_energy[i] = BaseEnergy;
+	  batch_path[i]   = path_start + double(i)*path_step;
+	}
+      ParallelSpectrumScan( setup, NBinsPath, batch_energy, batch_path,
+			    batch_path, NBinsPath, PathLengthEdge, workers[t],
+			    path_content );
+      ProfileScope path_scope(PROFILE_GRAPHS, 3);
+      for( j = 0 ; j < 3 ; j++ ) {
+	for( int b = 0 ; b <= NBinsPath + 1 ; b++ )
+	  histos[j][1]->SetBinContent( b, content[j][1][b] );
+	histos[j][1]->SetEntries( NBinsPath );
+      } // End Path Loop //
+      path_scope.Stop();
+
+      wall_time[t] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+  }
+  catch(exception& e) {
+    cerr << "  Error: " << e.what() << "\n";
+    return 1;
+  }
 
-  /* The following loop spans the baseline for a energy given by
-     BaseEnergy. The range is "scanned" linearly. */
-  
-  for ( i = 0 ; i < NBinsPath ; i++ ) 
-    {
-      path = path_start + double(i)*path_step;
-      bNu->SetMNS( theta12, theta13, theta23, DM21, DM32, delta,
-		   BaseEnergy, kSquared, mode ); 
-      bNu->propagateLinear( 1*mode, path, Density );
-
-      for( j = 1 ; j <= 3 ; j++ ) {
-        histos[j-1][1]->Fill( path , bNu->GetProb(2, j) );
-	// std::cout << "     Path = " << path << " Km - Prob (1, "
-	//  	  << j << ") = " << bNu->GetProb(2, j) << std::endl;
-      }
-    } // End Path Loop //
+  if ( speedup ) {
+    std::cout << std::endl << "  Scan time:" << std::endl
+	      << "      threads    time [s]   speedup" << std::endl;
+    for( size_t t = 0 ; t < workers.size() ; t++ )
+      std::cout << "      " << setw(7) << workers[t] << "  " << setw(10)
+		<< wall_time[t] << "  " << setw(8) << wall_time[0] / wall_time[t]
+		<< std::endl;
+  }
 
   /////
   // Write the output
+
+  /* In the columnar format every histogram is given by its edges and its
+     contents, written straight from the arena (see ColumnFile.h) */
+  if ( format == "columns" ) {
+    ProfileScope write_scope(PROFILE_FILE_WRITE);
+    ColumnFileWriter writer;
+    writer.AddParameter("theta12", theta12);
+    writer.AddParameter("theta13", theta13);
+    writer.AddParameter("theta23", theta23);
+    writer.AddParameter("DM21", DM21);
+    writer.AddParameter("DM32", DM32);
+    writer.AddParameter("delta", delta);
+    writer.AddParameter("density", Density);
+    writer.AddParameter("mode", mode);
+    writer.AddParameter("BasePath", BasePath);
+    writer.AddParameter("BaseEnergy", BaseEnergy);
+    try {
+      for( j = 0 ; j < 3 ; j++ ) {
+	string name = histos[j][0]->GetName();
+	writer.AddColumn( name + "/edges", EnergyBins, NBinsEnergy + 1 );
+	writer.AddColumn( name + "/content", content[j][0], NBinsEnergy + 2 );
+	name = histos[j][1]->GetName();
+	writer.AddColumn( name + "/edges", PathLengthEdge, NBinsPath + 1 );
+	writer.AddColumn( name + "/content", content[j][1], NBinsPath + 2 );
+      }
+      writer.Write( "example.nva" );
+    }
+    catch(exception& e) {
+      cerr << "  Error: " << e.what() << "\n";
+      return 1;
+    }
+    cout << endl<<"Done!" << endl;
+    return 0;
+  }
+
+  ProfileScope open_scope(PROFILE_FILE_OPEN);
   TFile *tmp = new TFile("example.root", "recreate");
   tmp->cd();
+  open_scope.Stop();
 
+  ProfileScope write_scope(PROFILE_FILE_WRITE);
   for( j = 0 ; j < 3 ; j++ ){
      histos[j][0]->Write();     
      histos[j][1]->Write();     
   }
 
   tmp->Close();
+  write_scope.Stop();
 
   cout << endl<<"Done!" << endl;
   
@@ -18,14 +18,61 @@
 #include <ctime>
 #include <string>
 #include <sstream>
+#include <vector>
+#include <algorithm>
+#include <memory>
 
-// ROOT includes
+/* ROOT includes
+
+   Compiled with -DWITHOUT_ROOT the program does not need ROOT, and only the
+   columnar output (--format columns) is available. */
+#ifndef WITHOUT_ROOT
 #include "TFile.h"
 #include "TGraph.h"
+#include "TGraphAsymmErrors.h"
+#include "TH2D.h"
+#include "TParameter.h"
+#endif
 
 // Prob3++ includes
 #include "BargerPropagator.h"
 
+// Table of scenarios and the engine computing their ellipses
+#include "Scenario.h"
+
+// Scan over a grid of parameters
+#include "GridScan.h"
+
+// Atmospheric oscillograms through the layered Earth
+#include "Oscillogram.h"
+
+// Timers and counters of --profile
+#include "Profiler.h"
+
+// ROOT-free output (--format columns)
+#include "ColumnFile.h"
+
+// Query server of --serve
+#include "Server.h"
+
+// Batch of experiments of --config
+#include "Experiments.h"
+
+// Separation between the ellipses of the hierarchies
+#include "Separation.h"
+
+// Search of the baseline and energy which separate best the hierarchies
+#include "Optimiser.h"
+
+// Chi^2 fit of a measured point
+#include "HierarchyFit.h"
+
+// Monte Carlo bands for the uncertainty on the oscillation parameters
+#include "UncertaintyBands.h"
+
+// Lookup tables of the probabilities in energy and delta
+#include "ProbabilityTable.h"
+
 /* Boost library includes
 
    "po" is a shorthand for the program-options library's namespace.
@@ -38,8 +85,24 @@
 #include <boost/program_options.hpp>
 namespace po = boost::program_options;
 
+// Default number of steps in delta of the ellipses (see --delta-steps)
 #define N_DELTA_STEPS 1000
 
+/* Maximum difference between the probabilities of the closed-form and of the
+   brute-force ellipses accepted by --check-analytic */
+#define ANALYTIC_TOLERANCE 1e-9
+
+/* Maximum difference between the vectorized and the scalar path of the
+   kernel in ConstantDensityKernel.h accepted by --check-kernel */
+#define KERNEL_TOLERANCE 1e-12
+
+/* Maximum difference between the kernel (or two segments) and Prob3++
+   accepted by --check-kernel, per radian of the largest oscillation phase
+   1.267 DM L / E of the scan. The two codes round the phases differently,
+   so they differ by a few units in the last place of the phase: about 3e-14
+   per radian, i.e. 3e-11 at 1 MeV over 295 Km and 8e-10 over 8000 Km. */
+#define PROB3_PHASE_TOLERANCE 1e-12
+
 using namespace std;
 
 // A redefition of the operator << to include the case of a string
@@ -50,12 +113,257 @@ ostream& operator<<(ostream& os, const vector<T>& v)
   return os;
 }
 
-int main(int argc, char * argv[] )
+/* Compare the vectorized and the scalar path of the kernel, and the static
+   propagators of StaticPropagator.h, for the ellipses of all the scenarios
+   and for a logarithmic energy scan (1 MeV - 10 GeV) at their distance, and
+   compare the kernel and the same path split in two segments with Prob3++
+   (see PROB3_PHASE_TOLERANCE). */
+bool CheckKernel(const vector<Scenario> & table, int n_delta_steps)
+{
+  const int n_energy = 100001;
+  const int n = max(2 * (n_delta_steps + 1), 2 * n_energy);
+  vector<double> energy(n), delta(n), path(n), kernel_mu2e(n), barger_mu2e(n);
+  vector<double> static_mu2e(n), segment_mu2e(n);
+  vector<int> type(n);
+  double deviation, max_deviation = 0, max_barger = 0, max_static = 0;
+  double max_segment = 0, max_per_phase = 0;
+  BargerPropagator bNu;
+  bNu.UseMassEigenstates( false );
+  SegmentedPropagator bNuSegments;
+
+  std::cout << std::endl << "  Kernel check (" << KernelInstructionSet()
+	    << "):" << std::endl;
+  for(size_t s = 0; s < table.size(); s++) {
+    const Scenario & row = table[s];
+    for(int scan = 0; scan < 2; scan++) { // 0: delta 1: energy
+      int m = scan == 0 ? n_delta_steps + 1 : n_energy;
+      for(int i = 0; i < m; i++) {
+	energy[i] = energy[m + i] = scan == 0 ? row.energy :
+	  1e-3 * pow(10.0, 4.0 * i / (double) (n_energy - 1));
+	delta[i] = delta[m + i] = scan == 0 ?
+	  - M_PI + i * 2 * M_PI / (double) n_delta_steps : 0;
+	path[i] = path[m + i] = row.distance;
+	type[i] = 1;
+	type[m + i] = -1;
+      }
+      deviation = KernelPathDeviation(2*m, row.theta12, row.theta13, row.theta23,
+				      row.DM21, row.DM32, true, &energy[0],
+				      &delta[0], &type[0], &path[0], row.density);
+      max_deviation = max(max_deviation, deviation);
+
+      BargerProbabilityBuffer kernel_buffer = {}, barger_buffer = {};
+      BargerProbabilityBuffer static_buffer = {}, segment_buffer = {};
+      kernel_buffer.Prob[1][0] = &kernel_mu2e[0];
+      barger_buffer.Prob[1][0] = &barger_mu2e[0];
+      static_buffer.Prob[1][0] = &static_mu2e[0];
+      segment_buffer.Prob[1][0] = &segment_mu2e[0];
+      PropagateLinearKernel(2*m, row.theta12, row.theta13, row.theta23,
+			    row.DM21, row.DM32, true, &energy[0], &delta[0],
+			    &type[0], &path[0], row.density, kernel_buffer);
+      bNu.propagateLinearBatch(2*m, row.theta12, row.theta13, row.theta23,
+			       row.DM21, row.DM32, true, &energy[0], &delta[0],
+			       &type[0], &path[0], row.density, barger_buffer);
+      PropagateLinearStatic(2*m, row.theta12, row.theta13, row.theta23,
+			    row.DM21, row.DM32, true, &energy[0], &delta[0],
+			    &type[0], &path[0], row.density, static_buffer);
+      // the same path split in two segments of different length
+      vector<DensitySegment> halves(2);
+      halves[0].length = .4 * row.distance;
+      halves[1].length = .6 * row.distance;
+      halves[0].density = halves[1].density = row.density;
+      bNuSegments.SetProfile(halves);
+      PropagateSegments(bNuSegments, 2*m, row.theta12, row.theta13, row.theta23,
+			row.DM21, row.DM32, true, &energy[0], &delta[0],
+			&type[0], segment_buffer);
+      double scan_barger = 0, scan_segment = 0;
+      for(int i = 0; i < 2*m; i++) {
+	scan_barger = max(scan_barger, fabs(kernel_mu2e[i] - barger_mu2e[i]));
+	max_static = max(max_static, fabs(kernel_mu2e[i] - static_mu2e[i]));
+	scan_segment = max(scan_segment, fabs(segment_mu2e[i] - barger_mu2e[i]));
+      }
+      max_barger = max(max_barger, scan_barger);
+      max_segment = max(max_segment, scan_segment);
+      const double phase = 1.267 * (fabs(row.DM32) + row.DM21) * row.distance /
+	*min_element(energy.begin(), energy.begin() + 2*m);
+      max_per_phase = max(max_per_phase, max(scan_barger, scan_segment) /
+			  max(phase, 1.0));
+
+      std::cout << "      " << row.label << (scan == 0 ? " delta " : " energy")
+		<< " scan: vectorized - scalar " << deviation << std::endl;
+    }
+  }
+  std::cout << "  Maximum deviation between the vectorized and the scalar"
+    " path: " << max_deviation << std::endl
+	    << "  Maximum deviation of P(mu->e) of the static propagators: "
+	    << max_static << std::endl
+	    << "  Maximum deviation of P(mu->e) from Prob3++: " << max_barger
+	    << std::endl
+	    << "  Maximum deviation of P(mu->e) of two segments (see"
+	    " DensityProfile.h) from Prob3++: " << max_segment << std::endl
+	    << "  Maximum deviation from Prob3++ per radian of phase: "
+	    << max_per_phase << std::endl;
+  max_deviation = max(max_deviation, max_static);
+  if (max_deviation > KERNEL_TOLERANCE) {
+    std::cerr << "  ERROR - the deviation exceeds the tolerance of "
+	      << KERNEL_TOLERANCE << std::endl;
+    return false;
+  }
+  if (max_per_phase > PROB3_PHASE_TOLERANCE) {
+    std::cerr << "  ERROR - the deviation from Prob3++ exceeds the tolerance of "
+	      << PROB3_PHASE_TOLERANCE << " per radian of phase" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/* The options of the query server itself: they cannot be used in a request
+   and they are not passed on to the requests */
+const char * const SERVER_OPTIONS[] = { "help", "output", "format", "threads",
+					"grid-scan", "oscillogram", "optimise",
+					"fit", "bands", "table", "cache", "config",
+					"serve", "profile", "profile-json" };
+
+bool IsServerOption(const string & name)
+{
+  for(size_t k = 0; k < sizeof(SERVER_OPTIONS) / sizeof(SERVER_OPTIONS[0]); k++)
+    if (name == SERVER_OPTIONS[k]) return true;
+  return false;
+}
+
+/* The options which cannot be used together: each option with the ones it
+   excludes, up to the first NULL */
+struct OptionConflict
+{
+  const char * option;
+  const char * excluded[9];
+};
+
+const OptionConflict OPTION_CONFLICTS[] = {
+  { "check-analytic",  { "adaptive" } },
+  { "oscillogram",     { "grid-scan" } },
+  { "optimise",        { "grid-scan", "oscillogram", "serve", "flux",
+			 "density-profile" } },
+  { "fit",             { "grid-scan", "oscillogram", "optimise", "serve", "flux",
+			 "density-profile" } },
+  { "bands",           { "grid-scan", "oscillogram", "optimise", "fit", "serve",
+			 "flux", "density-profile" } },
+  { "table",           { "grid-scan", "oscillogram", "optimise", "fit", "bands",
+			 "serve", "flux", "density-profile" } },
+  { "flux",            { "grid-scan", "oscillogram" } },
+  { "density-profile", { "grid-scan", "oscillogram" } },
+  { "config",          { "grid-scan", "oscillogram", "optimise", "fit", "serve" } }
+};
+
+// Throw if vm has two options which exclude each other
+void CheckOptionConflicts(const po::variables_map & vm)
+{
+  for(size_t c = 0; c < sizeof(OPTION_CONFLICTS) / sizeof(OPTION_CONFLICTS[0]); c++) {
+    const OptionConflict & conflict = OPTION_CONFLICTS[c];
+    if (!vm.count(conflict.option)) continue;
+    size_t n;
+    bool found = false;
+    for(n = 0; n < 9 && conflict.excluded[n]; n++)
+      if (vm.count(conflict.excluded[n])) found = true;
+    if (!found) continue;
+    string message = string("--") + conflict.option + " cannot be used with --"
+      + conflict.excluded[0];
+    for(size_t k = 1; k < n; k++)
+      message += (k + 1 < n ? ", --" : " or --") + string(conflict.excluded[k]);
+    throw std::runtime_error(message);
+  }
+}
+
+#ifndef WITHOUT_ROOT
+/* Edges of the bins centred on the points of axis, in units of unit. With a
+   single point the bin is one thousandth of its value wide (of 1 at zero).
+   The bins of a logarithmic axis (see LogAxisValue) have the same width in
+   log(value). */
+vector<double> CentredEdges(const GridAxis & axis, double unit = 1,
+			    bool logarithmic = false)
 {
-  int i, j;
+  vector<double> edge(axis.n + 1);
+  if (logarithmic) {
+    const double step = axis.n > 1 ? log(axis.max / axis.min) / (axis.n - 1) : 1e-3;
+    for(size_t k = 0; k <= axis.n; k++)
+      edge[k] = axis.min * exp((k - .5) * step) / unit;
+  }
+  else {
+    const double step = axis.n > 1 ? (axis.max - axis.min) / (axis.n - 1) :
+      1e-3 * (axis.min != 0 ? fabs(axis.min) : 1);
+    for(size_t k = 0; k <= axis.n; k++)
+      edge[k] = (axis.min + (k - .5) * step) / unit;
+  }
+  return edge;
+}
+
+/* Write object under name, or in a directory of file when the name has the
+   form <directory>/<name> (the experiments of --config) */
+void WriteInDirectory(TFile * file, TObject * object, const string & name)
+{
+  const size_t slash = name.find('/');
+  TDirectory * directory = file;
+  if (slash != string::npos) {
+    directory = file->GetDirectory(name.substr(0, slash).c_str());
+    if (!directory) directory = file->mkdir(name.substr(0, slash).c_str());
+  }
+  directory->cd();
+  object->Write(slash == string::npos ? name.c_str() : name.substr(slash + 1).c_str());
+}
+
+/* The objects of a ROOT output file, with the same interface of
+   ColumnFileWriter: they are owned by the writer and written by Write, each
+   one under its name (see WriteInDirectory), in a new file. */
+class RootFileWriter
+{
+public:
+  void AddObject(const string & name, TObject * object)
+  {
+    objects.push_back(unique_ptr<TObject>(object));
+    names.push_back(name);
+  }
+
+  void AddParameter(const string & name, double value)
+  { AddObject(name, new TParameter<double>(name.c_str(), value)); }
+
+  void Write(const string & file_name)
+  {
+    ProfileScope open_scope(PROFILE_FILE_OPEN);
+    unique_ptr<TFile> file(new TFile(file_name.c_str(), "recreate"));
+    file->cd();
+    open_scope.Stop();
+
+    ProfileScope write_scope(PROFILE_FILE_WRITE);
+    for(size_t k = 0; k < objects.size(); k++)
+      WriteInDirectory(file.get(), objects[k].get(), names[k]);
+    file->Close();
+  }
+
+private:
+  vector<unique_ptr<TObject> > objects;
+  vector<string> names;
+};
+#endif
+
+/* The whole program for the options in argv. The query server (--serve)
+   calls it again for every request with its own engine, the options of the
+   server in argv and those of the request in overrides, and then the
+   ellipses and the markers are returned in reply (the members of a JSON
+   object) instead of being written to a file. stdout_buffer is the real
+   standard output, where the replies of "--serve -" go.
+
+   For the experiments of --config it is called again with their options in
+   overrides, which replace those of argv, and then it only builds their
+   table of scenarios and returns it in collected. */
+int RunProgram(int argc, char * argv[], std::streambuf * stdout_buffer,
+	       ScenarioEngine * served = NULL, string * reply = NULL,
+	       const vector<string> * overrides = NULL,
+	       vector<Scenario> * collected = NULL)
+{
+  size_t s, k;
+  const long long start_time = ProfileNow();
   
   /// Oscillation Parameters
-  bool kSquared = true;   // Using sin^2(x) variables and not sin^2(2*x)
+  // All the angles are sin^2(x) variables and not sin^2(2*x)
 
   double theta12 = 0.320; // This is actually sin^2(34.5°)
   double theta13 = 0.021; /* This is actually sin^2(8.32°),
@@ -67,8 +375,6 @@ int main(int argc, char * argv[] )
   double DM32_NH = 2.50e-3; // in eV^2 - Normal Hierarchy
   double DM32_IH = -2.55e-3; // in eV^2 - Inverted Hierarchy
   
-  double delta; // CP violation phase expressed in radiants
-
   // Continental crust desity. The unit of measure is grams over cubic centimeters
   double density = 2.70; // Average density of continental crust is 2.7 g/cm^3
 
@@ -76,7 +382,70 @@ int main(int argc, char * argv[] )
 
   double distance = 295; // Distance to SK far detector in Km
 
-  string output; // ROOT output file name
+  string output; // Output file name
+  string format; // "root" or "columns" (see ColumnFile.h)
+
+  int n_threads = 1; // Number of parallel workers for the delta scan
+
+  string kernel; /* "barger" (Prob3++), "simd" (ConstantDensityKernel.h) or
+		    "static" (StaticPropagator.h) */
+  int propagator = PROPAGATOR_BARGER;
+  bool check_kernel = false;
+
+  string scenario_file; // Table of scenarios (see Scenario.h)
+  vector<Scenario> table;
+
+  string grid_file;   // Output of the grid scan (see GridScan.h)
+  GridAxis grid_axes[5];
+  unsigned long long grid_chunk = 4194304; // Points per chunk of the grid scan
+
+  bool oscillogram = false; // cos(zenith) x energy maps (see Oscillogram.h)
+  GridAxis osc_axes[3];     // cos(zenith), energy and delta
+  double osc_height = 15;   // Production height in Km
+
+  bool analytic = false;       // Closed-form delta_CP dependence
+  bool check_analytic = false; // Compare it with the brute-force one
+
+  int n_delta_steps = N_DELTA_STEPS; // Steps in delta of the ellipses
+  double adaptive_tolerance = 0; // Adaptive sampling of delta if positive
+
+  string flux_file;   // Flux spectrum (see FluxSpectrum.h)
+  int flux_nodes = 4; // Gauss-Legendre nodes per bin of the flux
+  FluxQuadrature flux;
+
+  string density_file; // Density profile of the baseline (see DensityProfile.h)
+  vector<DensitySegment> density_profile;
+
+  string cache_dir; // Results of the previous runs (see ResultCache.h)
+
+  string serve_path; // Socket of the query server, "-" for stdin/stdout
+  vector<string> serve_args; // Options of the command line passed to the requests
+
+  string config_file; // Batch of experiments (see Experiments.h)
+  vector<Experiment> experiments;
+
+  double degeneracy = 1e-3; // Resolution of the separation metrics
+
+  bool optimise = false;  // distance x energy search (see Optimiser.h)
+  GridAxis opt_axes[2];   // distance and energy
+  int opt_levels = 6;     // Refinements of the grid
+  double opt_tolerance = 1e-5; // Least gain of separation worth a refinement
+
+  bool fit = false;         // delta x theta23 x DM32 fit (see HierarchyFit.h)
+  FitMeasurement measured;  // The point to fit
+  GridAxis fit_axes[2];     // delta and theta23
+  GridAxis fit_DM32[2];     // DM32 of the normal and of the inverted hierarchy
+
+  unsigned long long n_band_samples = 0; // Samples of the bands (see UncertaintyBands.h)
+  int band_steps = 100;                  // Steps in delta of the bands
+  unsigned long long band_seed = 1;      // Key of the random numbers
+  BandPrior band_prior[BANDS_N_PARAMETERS];
+
+  string table_file;          // Lookup tables (see ProbabilityTable.h)
+  GridAxis table_energy;      // Energy range and number of intervals
+  double table_tolerance = 0; // Largest estimated error of the tables if positive
+
+  string profile_json; // JSON copy of the --profile table
   
   try {
 
@@ -102,21 +471,203 @@ int main(int argc, char * argv[] )
       ("distance",  po::value<double>(), "Distance to Far Detector in Km")
       ("output,o",  po::value<string>(&output)->default_value("output.root"),
        "Output ROOT file name")
+      ("format",    po::value<string>(&format)->default_value("root"),
+       "Output format: \"root\" for a ROOT file with the graphs or \"columns\""
+       " for a memory-mappable binary file of double columns (output.nva by"
+       " default, see ColumnFile.h)")
+      ("threads",   po::value<int>(&n_threads)->default_value(1),
+       "Number of parallel workers for the delta scan")
+      ("analytic",  "Compute the ellipses from the closed-form delta_CP"
+       " dependence (three propagations per beam type)")
+      ("check-analytic", "Same as --analytic but also compare the result with"
+       " the brute-force computation")
+      ("kernel",    po::value<string>(&kernel)->default_value("barger"),
+       "Oscillation code: \"barger\" for Prob3++, \"simd\" for the"
+       " vectorized constant density kernel or \"static\" for the"
+       " propagators specialised at compile time")
+      ("check-kernel", "Check that the vectorized and the scalar paths of the"
+       " simd kernel and the static propagators agree, and compare them with"
+       " Prob3++")
+      ("delta-steps", po::value<int>(&n_delta_steps)->default_value(N_DELTA_STEPS),
+       "Number of equal steps in delta of the ellipses")
+      ("adaptive",  po::value<double>(&adaptive_tolerance), "Sample delta"
+       " adaptively, until every ellipse is closer than this to its chords in"
+       " the (P, P_bar) plane, instead of in --delta-steps equal steps")
+      ("flux",      po::value<string>(&flux_file), "Average the probabilities"
+       " over a flux spectrum instead of using the single --energy: either a"
+       " two-column text file (energy in GeV, flux) or file.root:histogram")
+      ("flux-nodes", po::value<int>(&flux_nodes)->default_value(4),
+       "Number of quadrature nodes per bin of the flux spectrum")
+      ("density-profile", po::value<string>(&density_file), "Text file of"
+       " (length in Km, density in g/cm^3) segments from the source to the"
+       " detector which replaces --density and --distance (see"
+       " DensityProfile.h)")
+      ("scenarios", po::value<string>(&scenario_file), "Text file with the"
+       " table of ellipses to draw (see Scenario.h). By default the four"
+       " hierarchy/octant combinations are drawn")
+      ("grid-scan", po::value<string>(&grid_file), "Scan a grid of parameters"
+       " instead of drawing the ellipses, and write it to this binary file"
+       " (see GridScan.h). Each axis is given as min:max:n or as a single"
+       " value, the default being the value of the corresponding option")
+      ("grid-theta23",  po::value<string>(), "Sin^2(theta23) axis of the grid")
+      ("grid-DM32",     po::value<string>(), "DeltaM^2_32 axis of the grid in"
+       " 10^-3 eV^2")
+      ("grid-delta",    po::value<string>()->default_value("0"), "delta_CP axis"
+       " of the grid in units of pi")
+      ("grid-energy",   po::value<string>(), "Energy axis of the grid in GeV")
+      ("grid-distance", po::value<string>(), "Distance axis of the grid in Km")
+      ("grid-chunk",    po::value<unsigned long long>(&grid_chunk)->default_value(4194304),
+       "Number of grid points kept in memory and written at once")
+      ("oscillogram", "Draw the atmospheric oscillograms of the scenarios,"
+       " P(mu->e) and P(mu_bar->e_bar) as a function of cos(zenith) and energy"
+       " through the layered Earth, instead of the ellipses (see Oscillogram.h)")
+      ("osc-cos-zenith", po::value<string>()->default_value("-1:0:101"),
+       "Cos(zenith) axis of the oscillograms as min:max:n")
+      ("osc-energy", po::value<string>()->default_value("0.5:20:200"),
+       "Energy axis of the oscillograms in GeV as min:max:n, in logarithmic"
+       " steps")
+      ("osc-delta", po::value<string>()->default_value("0"), "delta_CP axis of"
+       " the oscillograms in units of pi, one map per value")
+      ("osc-height", po::value<double>(&osc_height)->default_value(15),
+       "Production height of the atmospheric neutrinos in Km")
+      ("cache",     po::value<string>(&cache_dir), "Keep the ellipses of every"
+       " scenario in this directory and read them back, instead of computing"
+       " them again, in the later runs with the same parameters (see"
+       " ResultCache.h)")
+      ("degeneracy", po::value<double>(&degeneracy)->default_value(1e-3),
+       "Distance in the (P, P_bar) plane below which a point of an ellipse is"
+       " degenerate with the ellipses of the other hierarchy (see"
+       " Separation.h)")
+      ("optimise",  "Search the distance and the energy with the largest"
+       " separation between the ellipses of the first two groups of"
+       " scenarios (NH and IH by default), through constant density matter,"
+       " instead of drawing the ellipses (see Optimiser.h)")
+      ("opt-distance", po::value<string>()->default_value("100:3000:30"),
+       "Distance axis of the search in Km as min:max:n")
+      ("opt-energy", po::value<string>()->default_value("0.2:5:25"),
+       "Energy axis of the search in GeV as min:max:n")
+      ("opt-levels", po::value<int>(&opt_levels)->default_value(6),
+       "Number of refinements of the grid around the best points")
+      ("opt-tolerance",
+       po::value<double>(&opt_tolerance)->default_value(1e-5, "1e-05"),
+       "Least gain of separation over the best point for which a cell of the"
+       " search is refined")
+      ("fit",       po::value<string>(), "Fit the measured point"
+       " x:y:sigma_x:sigma_y, i.e. P(mu->e) and P(mu_bar->e_bar) with their"
+       " errors, on a grid of delta x theta23 x DM32 for both hierarchies"
+       " instead of drawing the ellipses (see HierarchyFit.h)")
+      ("fit-delta", po::value<string>()->default_value("-1:1:361"),
+       "delta_CP axis of the fit in units of pi")
+      ("fit-theta23", po::value<string>()->default_value("0.3:0.7:81"),
+       "Sin^2(theta23) axis of the fit")
+      ("fit-DM32",  po::value<string>(), "|DeltaM^2_32| axis of the fit in"
+       " 10^-3 eV^2, the same for both hierarchies. By default the values of"
+       " --DM32NH and --DM32IH")
+      ("bands",     po::value<unsigned long long>(&n_band_samples), "Also draw"
+       " the 1 and 2 sigma bands of the ellipses from this number of samples"
+       " of the oscillation parameters (see UncertaintyBands.h)")
+      ("band-priors", po::value<string>(), "Text file with the priors of the"
+       " samples, \"parameter gauss|flat|none width\" on each line, replacing"
+       " the default Gaussian ones")
+      ("band-steps", po::value<int>(&band_steps)->default_value(100),
+       "Number of equal steps in delta of the bands")
+      ("band-seed", po::value<unsigned long long>(&band_seed)->default_value(1),
+       "Seed of the samples of the bands")
+      ("table",     po::value<string>(&table_file), "Tabulate P(mu->e) and"
+       " P(mu_bar->e_bar) of every scenario as a function of the energy and"
+       " of delta_CP, through constant density matter, and write the tables"
+       " to this column file instead of drawing the ellipses (see"
+       " ProbabilityTable.h)")
+      ("table-energy", po::value<string>()->default_value("0.1:10:256"),
+       "Energy range of the tables in GeV and number of intervals, in"
+       " logarithmic steps, as min:max:n")
+      ("table-tolerance", po::value<double>(&table_tolerance)->default_value(0),
+       "Largest estimated error of the tables: if positive, the intervals are"
+       " doubled until the estimate is below it")
+      ("config",    po::value<string>(&config_file), "INI file of experiments"
+       " overriding some of these options, all computed together and written"
+       " to the same output in one directory each (see Experiments.h)")
+      ("serve",     po::value<string>(&serve_path), "Run as a query server"
+       " on this Unix domain socket, or on the standard input and output"
+       " with \"-\", answering JSON requests made of these options with the"
+       " ellipses (see Server.h)")
+      ("profile",   "Print the time spent in each phase of the run and the"
+       " number of calls at exit")
+      ("profile-json", po::value<string>(&profile_json), "Same as --profile"
+       " and also write the table to this JSON file")
       ;
 
     /* The following three lines of code, create the object "vm" that will contain
        the command line arguments.
        These are read through the method "parse_command_line" */
     po::variables_map vm;        
-    po::store(po::parse_command_line(argc, argv, desc), vm);
+    if (overrides)
+      po::store(po::command_line_parser(*overrides).options(desc).run(), vm);
+    po::parsed_options parsed = po::parse_command_line(argc, argv, desc);
+    po::store(parsed, vm);
     po::notify(vm);
 
+    /* The requests to the server only compute ellipses, with the workers
+       and the cache of the server */
+    if (served) {
+      for(k = 0; k < sizeof(SERVER_OPTIONS) / sizeof(SERVER_OPTIONS[0]); k++)
+	if (vm.count(SERVER_OPTIONS[k]) && !vm[SERVER_OPTIONS[k]].defaulted())
+	  throw std::runtime_error(string("--") + SERVER_OPTIONS[k] +
+				   " cannot be used in a request");
+    }
+
+    /* The other options of the server are the defaults of its requests,
+       with their original spelling */
+    if (vm.count("serve") && !served)
+      for(k = 0; k < parsed.options.size(); k++)
+	if (!IsServerOption(parsed.options[k].string_key))
+	  serve_args.insert(serve_args.end(),
+			    parsed.options[k].original_tokens.begin(),
+			    parsed.options[k].original_tokens.end());
+
+    if (vm.count("profile") || vm.count("profile-json")) {
+      ProfileEnable(start_time, profile_json);
+      ProfileAdd(PROFILE_OPTIONS, ProfileNow() - start_time);
+    }
+
     // The --help option produces the description of all the allowed options 
     if (vm.count("help")) {
       std::cout << desc << "\n";
       return 0;
     }
 
+#ifdef WITHOUT_ROOT
+    if (vm["format"].defaulted()) format = "columns";
+    if (format == "root")
+      throw std::runtime_error("compiled without ROOT: only --format columns"
+			       " is available");
+#endif
+    if (format != "root" && format != "columns")
+      throw po::validation_error(po::validation_error::invalid_option_value,
+				 "format", format);
+    if (format == "columns" && vm["output"].defaulted())
+      output = "output.nva";
+
+    check_kernel = vm.count("check-kernel");
+    if (kernel == "simd")
+      propagator = PROPAGATOR_SIMD;
+    else if (kernel == "static")
+      propagator = PROPAGATOR_STATIC;
+    else if (kernel != "barger")
+      throw po::validation_error(po::validation_error::invalid_option_value,
+				 "kernel", kernel);
+
+    check_analytic = vm.count("check-analytic");
+    analytic = vm.count("analytic") || check_analytic;
+
+    CheckOptionConflicts(vm);
+    if (n_delta_steps < 1)
+      throw std::runtime_error("--delta-steps must be positive");
+    if (vm.count("adaptive") && adaptive_tolerance <= 0)
+      throw std::runtime_error("the tolerance of --adaptive must be positive");
+    if (degeneracy < 0)
+      throw std::runtime_error("--degeneracy cannot be negative");
+
     /****************** Summary of all the oscillation parameters ******************/
 
     std::cout << std::endl;
@@ -209,6 +760,181 @@ int main(int argc, char * argv[] )
       std::cout << "  The distance to the far detector"
 	" is assumed to be " << distance << " Km.\n";
     }
+
+    /* The default table contains the four hierarchy/octant combinations,
+       each with the delta = 0, pi/2, pi, 3/2 pi markers */
+    Scenario row;
+    row.theta12  = theta12;
+    row.theta13  = theta13;
+    row.DM21     = DM21;
+    row.density  = density;
+    row.energy   = energy;
+    row.distance = distance;
+    row.markers.push_back(0);
+    row.markers.push_back(.5 * M_PI);
+    row.markers.push_back(M_PI);
+    row.markers.push_back(1.5 * M_PI);
+
+    row.label = "LO_NH"; row.group = "NH";
+    row.theta23 = theta23_LO; row.DM32 = DM32_NH; table.push_back(row);
+    row.label = "UO_NH"; row.group = "NH";
+    row.theta23 = theta23_UO; row.DM32 = DM32_NH; table.push_back(row);
+    row.label = "LO_IH"; row.group = "IH";
+    row.theta23 = theta23_LO; row.DM32 = DM32_IH; table.push_back(row);
+    row.label = "UO_IH"; row.group = "IH";
+    row.theta23 = theta23_UO; row.DM32 = DM32_IH; table.push_back(row);
+
+    /* The missing values ("-") of the table read from file are taken from
+       the command line (lower octant and normal hierarchy for theta23 and
+       DM32) */
+    if (vm.count("scenarios")) {
+      std::cout << "  The table of scenarios is read from "
+		<< scenario_file << " .\n";
+      ProfileScope scope(PROFILE_SETUP);
+      table = ReadScenarioTable(scenario_file, table[0]);
+    }
+    for(s = 0; s < table.size(); s++) CheckScenario(table[s]);
+
+    /* The axes of the grid. DM32 and delta are converted to eV^2 and
+       radiants respectively. */
+    if (vm.count("grid-scan")) {
+      stringstream ss;
+      ss << theta23_LO;
+      grid_axes[0] = ParseGridAxis("theta23", vm.count("grid-theta23") ?
+				   vm["grid-theta23"].as<string>() : ss.str());
+      ss.str(""); ss << DM32_NH * 1e3;
+      grid_axes[1] = ParseGridAxis("DM32", vm.count("grid-DM32") ?
+				   vm["grid-DM32"].as<string>() : ss.str());
+      grid_axes[2] = ParseGridAxis("delta", vm["grid-delta"].as<string>());
+      ss.str(""); ss << energy;
+      grid_axes[3] = ParseGridAxis("energy", vm.count("grid-energy") ?
+				   vm["grid-energy"].as<string>() : ss.str());
+      ss.str(""); ss << distance;
+      grid_axes[4] = ParseGridAxis("distance", vm.count("grid-distance") ?
+				   vm["grid-distance"].as<string>() : ss.str());
+      grid_axes[1].min *= 1e-3;  grid_axes[1].max *= 1e-3;
+      grid_axes[2].min *= M_PI;  grid_axes[2].max *= M_PI;
+    }
+
+    /* The oscillograms go through the layered Earth of Prob3++, so the
+       other kernels, which only know constant density, cannot be used */
+    oscillogram = vm.count("oscillogram");
+    if (oscillogram) {
+      if (propagator != PROPAGATOR_BARGER)
+	throw std::runtime_error("--oscillogram needs --kernel barger");
+      osc_axes[0] = ParseGridAxis("cos_zenith", vm["osc-cos-zenith"].as<string>());
+      osc_axes[1] = ParseGridAxis("energy", vm["osc-energy"].as<string>());
+      osc_axes[2] = ParseGridAxis("delta", vm["osc-delta"].as<string>());
+      osc_axes[2].min *= M_PI;  osc_axes[2].max *= M_PI;
+    }
+
+    /* The search moves every row of the table through constant density
+       matter at its own distance and energy */
+    optimise = vm.count("optimise");
+    if (optimise) {
+      if (propagator != PROPAGATOR_BARGER)
+	throw std::runtime_error("--optimise needs --kernel barger");
+      if (opt_tolerance < 0)
+	throw std::runtime_error("--opt-tolerance cannot be negative");
+      opt_axes[0] = ParseGridAxis("distance", vm["opt-distance"].as<string>());
+      opt_axes[1] = ParseGridAxis("energy", vm["opt-energy"].as<string>());
+    }
+
+    /* The fit uses the parameters of the command line, with the axes of
+       delta and DM32 converted to radiants and eV^2 */
+    fit = vm.count("fit");
+    if (fit) {
+      if (propagator != PROPAGATOR_BARGER)
+	throw std::runtime_error("--fit needs --kernel barger");
+      string point = vm["fit"].as<string>();
+      std::replace(point.begin(), point.end(), ':', ' ');
+      istringstream ss(point);
+      string rest;
+      if (!(ss >> measured.x >> measured.y >> measured.sigma_x >> measured.sigma_y)
+	  || ss >> rest)
+	throw std::runtime_error("--fit must be x:y:sigma_x:sigma_y");
+      fit_axes[0] = ParseGridAxis("delta", vm["fit-delta"].as<string>());
+      fit_axes[0].min *= M_PI;  fit_axes[0].max *= M_PI;
+      fit_axes[1] = ParseGridAxis("theta23", vm["fit-theta23"].as<string>());
+      stringstream dm;
+      dm << DM32_NH * 1e3;
+      fit_DM32[0] = ParseGridAxis("DM32", vm.count("fit-DM32") ?
+				  vm["fit-DM32"].as<string>() : dm.str());
+      dm.str(""); dm << -DM32_IH * 1e3;
+      fit_DM32[1] = ParseGridAxis("DM32", vm.count("fit-DM32") ?
+				  vm["fit-DM32"].as<string>() : dm.str());
+      fit_DM32[0].min *= 1e-3;  fit_DM32[0].max *= 1e-3;
+      fit_DM32[1].min *= -1e-3; fit_DM32[1].max *= -1e-3;
+    }
+
+    /* The samples of the bands go through constant density matter with
+       the closed-form delta dependence, with any kernel */
+    if (vm.count("bands")) {
+      if (n_band_samples < 2)
+	throw std::runtime_error("--bands needs at least two samples");
+      if (band_steps < 1)
+	throw std::runtime_error("--band-steps must be positive");
+      DefaultBandPriors(band_prior);
+      if (vm.count("band-priors")) {
+	std::cout << "  The priors of the bands are read from "
+		  << vm["band-priors"].as<string>() << " .\n";
+	ReadBandPriors(vm["band-priors"].as<string>(), band_prior);
+      }
+    }
+
+    /* The tables go through constant density matter at the distance of each
+       row, with any kernel */
+    if (vm.count("table")) {
+      if (table_tolerance < 0)
+	throw std::runtime_error("--table-tolerance cannot be negative");
+      table_energy = ParseGridAxis("energy", vm["table-energy"].as<string>());
+    }
+
+    /* The quadrature of the flux is shared by all the scenarios */
+    if (vm.count("flux")) {
+      std::cout << "  The flux spectrum is read from " << flux_file << " .\n";
+      ProfileScope scope(PROFILE_SETUP);
+      flux = LoadFluxSpectrum(flux_file, flux_nodes);
+    }
+
+    /* The profile replaces the path of every row. The distance and the
+       density become the total length and the mean density of the profile,
+       only used in the summary and in the parameters of the output. */
+    if (vm.count("density-profile")) {
+      std::cout << "  The density profile is read from " << density_file << " .\n";
+      ProfileScope scope(PROFILE_SETUP);
+      density_profile = ReadDensityProfile(density_file);
+      distance = ProfileLength(density_profile);
+      density = ProfileMeanDensity(density_profile);
+      for(s = 0; s < table.size(); s++) {
+	table[s].distance = distance;
+	table[s].density = density;
+      }
+    }
+
+    /* The tables of the experiments are built by RunProgram itself, after
+       the summary */
+    if (vm.count("config") && !collected) {
+      std::cout << "  The experiments are read from " << config_file << " .\n";
+      experiments = ReadExperimentFile(config_file);
+      /* The flux replaces the energy and the profile the density and the
+	 distance of every row, so an experiment setting them would be
+	 silently ignored */
+      for(size_t e = 0; e < experiments.size(); e++)
+	for(k = 0; k < experiments[e].options.size(); k += 2) {
+	  const string & option = experiments[e].options[k];
+	  const char * replaced_by = NULL;
+	  if (option == "--energy" && vm.count("flux"))
+	    replaced_by = "--flux";
+	  if ((option == "--density" || option == "--distance") &&
+	      vm.count("density-profile"))
+	    replaced_by = "--density-profile";
+	  if (replaced_by)
+	    throw std::runtime_error("the experiment " + experiments[e].name +
+				     " sets " + option.substr(2) + ", which is"
+				     " replaced by " + replaced_by);
+	}
+    }
   }
   
   // If any exception is found the program is terminated with an error.
@@ -221,6 +947,11 @@ int main(int argc, char * argv[] )
     return 1;
   }
 
+  if (collected) {
+    *collected = table;
+    return 0;
+  }
+
   std::cout << std::endl;
   std::cout << "  Summary:       " <<                              std::endl
 	    << "      DM21       " <<  DM21       << " eV^2" <<   std::endl
@@ -232,179 +963,553 @@ int main(int argc, char * argv[] )
 	    << "      theta23_UO " <<  theta23_UO <<               std::endl
 	    << "      density    " <<  density    << " g/cm^3" <<  std::endl
     	    << "      energy     " <<  energy     << " GeV"   <<  std::endl
-    	    << "      distance   " <<  distance   << " Km"     <<  std::endl;
+    	    << "      distance   " <<  distance   << " Km"     <<  std::endl
+	    << "      threads    " <<  n_threads  <<               std::endl
+	    << "      kernel     " <<  kernel;
+  if (kernel == "simd") std::cout << " (" << KernelInstructionSet() << ")";
+  std::cout << std::endl;
+  if (flux.GetNNodes() > 0)
+    std::cout << "      flux       " << flux.GetNNodes() << " nodes, mean energy "
+	      << flux.GetMeanEnergy() << " GeV (replaces energy)" << std::endl;
+  if (!density_profile.empty())
+    std::cout << "      profile    " << density_profile.size() << " segments, "
+	      << ProfileLength(density_profile) << " Km (replaces density and"
+	      " distance)" << std::endl;
 
   /****************** End of summary ******************/
- 
-  /***** Calculate the neutrino oscillation points *****/
 
-  double total_prob;
-  double delta_step = 2 * M_PI / (double) N_DELTA_STEPS;
-  double mu2e_LO_NH[2][N_DELTA_STEPS+1];
-  double mu2e_UO_NH[2][N_DELTA_STEPS+1];
-  double mu2e_LO_IH[2][N_DELTA_STEPS+1];
-  double mu2e_UO_IH[2][N_DELTA_STEPS+1];
-  BargerPropagator * bNu;
-  bNu = new BargerPropagator( );
-  bNu->UseMassEigenstates( false );
-  
-  /************ NORMAL HIERARCHY - LOWER OCTANT ************/
+  /***** Query server mode *****/
+
+  /* Every request is run through RunProgram with the same engine, so the
+     workers and the propagators stay warm and the ellipses of the last
+     RESULT_CACHE_MEMORY rows are kept in memory (see ResultCache.h): a
+     repeated request is answered without propagating. Its members are the
+     overrides of the options the server was started with (but the server
+     options). The output of the requests is discarded and their errors are
+     returned in the reply. */
+  if (!serve_path.empty()) {
+    ScenarioEngine server_engine(n_threads);
+    long long n_requests = 0;
+    auto handler = [&](const string & line) -> string {
+      const long long request_start = ProfileNow();
+      string id = "null";
+      vector<string> args(1, argv[0]), request_args;
+      args.insert(args.end(), serve_args.begin(), serve_args.end());
+      try {
+	vector<JsonMember> members = ParseJsonObject(line);
+	for(size_t m = 0; m < members.size(); m++) {
+	  const JsonMember & member = members[m];
+	  // the unquoted values are already valid JSON (see ParseJsonObject)
+	  if (member.name == "id")
+	    id = member.quoted ? JsonString(member.value) : member.value;
+	  else if (!member.quoted && member.value == "true")
+	    request_args.push_back("--" + member.name);
+	  else if (member.quoted || (member.value != "false" && member.value != "null")) {
+	    request_args.push_back("--" + member.name);
+	    request_args.push_back(member.value);
+	  }
+	}
+      }
+      catch(exception& e) {
+	return "{\"id\":null,\"error\":" + JsonString(e.what()) + "}";
+      }
+
+      vector<char *> request_argv;
+      for(size_t a = 0; a < args.size(); a++)
+	request_argv.push_back(&args[a][0]);
+      string request_reply;
+      ostringstream errors;
+      std::streambuf * cout_buffer = std::cout.rdbuf(NULL);
+      std::streambuf * cerr_buffer = std::cerr.rdbuf(errors.rdbuf());
+      int status = RunProgram(request_argv.size(), &request_argv[0], stdout_buffer,
+			      &server_engine, &request_reply, &request_args);
+      std::cout.rdbuf(cout_buffer);
+      std::cout.clear();
+      std::cerr.rdbuf(cerr_buffer);
+
+      n_requests++;
+      std::cerr << "  Request " << n_requests << " (id " << id << "): "
+		<< (status == 0 ? "done" : "failed") << " in "
+		<< (ProfileNow() - request_start) * 1e-6 << " ms" << std::endl;
+      if (status != 0) {
+	// the last message, without the "  Error: " in front
+	string message = errors.str();
+	while (!message.empty() && message[message.size() - 1] == '\n')
+	  message.erase(message.size() - 1);
+	message = message.substr(message.find_last_of('\n') + 1);
+	if (message.find("  Error: ") == 0) message.erase(0, 9);
+	return "{\"id\":" + id + ",\"error\":" + JsonString(message) + "}";
+      }
+      return "{\"id\":" + id + "," + request_reply + "}";
+    };
+
+    try {
+      server_engine.SetCache(cache_dir);
+      server_engine.SetMemoryCache(RESULT_CACHE_MEMORY);
+      if (serve_path == "-") {
+	std::cerr << std::endl << "  Serving the standard input" << std::endl;
+	std::ostream replies(stdout_buffer);
+	ServeStream(std::cin, replies, handler);
+      }
+      else {
+	std::cerr << std::endl << "  Serving " << serve_path << std::endl;
+	ServeUnixSocket(serve_path, handler);
+      }
+    }
+    catch(exception& e) {
+      cerr << "  Error: " << e.what() << "\n";
+      return 1;
+    }
+    std::cerr << "  " << n_requests << " requests served" << std::endl;
+    return 0;
+  }
 
-  for(i = 0; i <= N_DELTA_STEPS; i++) {
-    delta = - M_PI + i*delta_step;
-    
-    // neutrino beam
-    bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_NH, delta,
-		 energy, kSquared, 1 ); 
-    bNu->propagateLinear( 1, distance, density );
-
-    total_prob = 0;
-    for( j = 1; j <= 3; j++) total_prob += bNu->GetProb(2, j);
-    if ( total_prob >1.00001 || total_prob<0.99998 )
-      {
-	std::cerr << "  ERROR (i = " << i << ") - Prob: " << total_prob
-		  << " - Energy: "<< energy << std::endl;
-	abort(); }
-
-    mu2e_LO_NH[0][i] = bNu->GetProb(2, 1); // Fill the array
-
-    // anti-neutrino beam
-    bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_NH, delta,
-		 energy, kSquared, -1 ); 
-    bNu->propagateLinear( -1, distance, density );
-
-    total_prob = 0;
-    for( j = -1; j >= -3; j--) total_prob += bNu->GetProb(-2, j);
-    if ( total_prob >1.00001 || total_prob<0.99998 )
-      {
-	std::cerr << "  ERROR (i = " << i << ") - Prob: " << total_prob
-		  << " - Energy: "<< energy << std::endl;
-	abort(); }
-      
-    mu2e_LO_NH[1][i] = bNu->GetProb(-2, -1);
-
-    // std::cout << "  Delta = " << delta << " - mu2e = " << mu2e_LO_NH[0][i] 
-    // 	      << " - mu2e_bar = " << mu2e_LO_NH[1][i] << std::endl;
+  /***** Batch of experiments *****/
+
+  /* The table of every experiment is built from the options of the command
+     line with those of the experiment on top. The tables are joined in one,
+     with the name of the experiment in front of the labels and of the
+     groups ("NOvA/LO_NH", markers "NOvA/NH_0"), so that all the ellipses
+     are computed as a single batch shared by the workers, and the graphs of
+     each experiment end up in its own directory of the output. */
+  if (!experiments.empty()) {
+    vector<Scenario> batch;
+    std::cout << std::endl << "  Experiments:" << std::endl;
+    for(size_t e = 0; e < experiments.size(); e++) {
+      vector<Scenario> rows;
+      std::streambuf * cout_buffer = std::cout.rdbuf(NULL);
+      int status = RunProgram(argc, argv, stdout_buffer, NULL, NULL,
+			      &experiments[e].options, &rows);
+      std::cout.rdbuf(cout_buffer);
+      std::cout.clear();
+      if (status != 0) {
+	cerr << "  Error: in the experiment " << experiments[e].name << "\n";
+	return 1;
+      }
+      std::cout << "      " << experiments[e].name << ":";
+      for(k = 0; k < experiments[e].options.size(); k++)
+	std::cout << " " << experiments[e].options[k];
+      std::cout << std::endl;
+      for(s = 0; s < rows.size(); s++) {
+	rows[s].label = experiments[e].name + "/" + rows[s].label;
+	rows[s].group = experiments[e].name + "/" + rows[s].group;
+	batch.push_back(rows[s]);
+      }
+    }
+    table = batch;
   }
 
-  /************ NORMAL HIERARCHY - UPPER OCTANT ************/
-  delta = 0;
-  for(i = 0; i <= N_DELTA_STEPS; i++) {
-    delta = - M_PI + i*delta_step;
-	
-    // neutrino beam
-    bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_NH, delta,
-		 energy, kSquared, 1 ); 
-    bNu->propagateLinear( 1, distance, density );
-
-    total_prob = 0;
-    for( j = 1; j <= 3; j++) total_prob += bNu->GetProb(2, j);
-    if ( total_prob >1.00001 || total_prob<0.99998 )
-      {
-	std::cerr << "  ERROR (i = " << i << ") - Prob: " << total_prob
-		  << " - Energy: "<< energy << std::endl;
-	abort(); }
-
-    mu2e_UO_NH[0][i] = bNu->GetProb(2, 1); // Fill the array
-
-    // anti-neutrino beam
-    bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_NH, delta,
-		 energy, kSquared, -1 ); 
-    bNu->propagateLinear( -1, distance, density );
-
-    total_prob = 0;
-    for( j = -1; j >= -3; j--) total_prob += bNu->GetProb(-2, j);
-    if ( total_prob >1.00001 || total_prob<0.99998 )
-      {
-	std::cerr << "  ERROR (i = " << i << ") - Prob: " << total_prob
-		  << " - Energy: "<< energy << std::endl;
-	abort(); }
-      
-    mu2e_UO_NH[1][i] = bNu->GetProb(-2, -1);
+  /***** Grid scan mode *****/
+
+  if (!grid_file.empty()) {
+    std::cout << std::endl << "  Grid scan:" << std::endl;
+    for(k = 0; k < 5; k++)
+      std::cout << "      " << grid_axes[k].name << " from " << grid_axes[k].min
+		<< " to " << grid_axes[k].max << " in " << grid_axes[k].n
+		<< " points" << std::endl;
+    try {
+      RunGridScan(table[0], grid_axes, grid_chunk, n_threads, grid_file,
+		  propagator);
+    }
+    catch(exception& e) {
+      cerr << "  Error: " << e.what() << "\n";
+      return 1;
+    }
+    cout << endl<<"Done!" << endl;
+    return 0;
   }
 
-  /************ INVERTED HIERARCHY - LOWER OCTANT ************/
-  delta = 0;
-  for(i = 0; i <= N_DELTA_STEPS; i++) {
-    delta = - M_PI + i*delta_step;
-    
-    // neutrino beam
-    bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_IH, delta,
-		 energy, kSquared, 1 ); 
-    bNu->propagateLinear( 1, distance, density );
-
-    total_prob = 0;
-    for( j = 1; j <= 3; j++) total_prob += bNu->GetProb(2, j);
-    if ( total_prob >1.00001 || total_prob<0.99998 )
-      {
-	std::cerr << "  ERROR (i = " << i << ") - Prob: " << total_prob
-		  << " - Energy: "<< energy << std::endl;
-	abort(); }
-
-    mu2e_LO_IH[0][i] = bNu->GetProb(2, 1); // Fill the array
-
-    // anti-neutrino beam
-    bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_IH, delta,
-		 energy, kSquared, -1 ); 
-    bNu->propagateLinear( -1, distance, density );
-
-    total_prob = 0;
-    for( j = -1; j >= -3; j--) total_prob += bNu->GetProb(-2, j);
-    if ( total_prob >1.00001 || total_prob<0.99998 )
-      {
-	std::cerr << "  ERROR (i = " << i << ") - Prob: " << total_prob
-		  << " - Energy: "<< energy << std::endl;
-	abort(); }
-      
-    mu2e_LO_IH[1][i] = bNu->GetProb(-2, -1);
+  /***** Lookup table mode *****/
+
+  /* One table per row of the table of scenarios, all in the same column
+     file. The queries are timed by the benchmark program. */
+  if (!table_file.empty()) {
+    std::cout << std::endl << "  Lookup tables:" << std::endl
+	      << "      energy from " << table_energy.min << " to "
+	      << table_energy.max << " GeV in " << table_energy.n
+	      << " logarithmic intervals" << std::endl;
+    try {
+      // the writer keeps pointers to the coefficients until Write
+      vector<unique_ptr<ProbabilityTable> > tables;
+      ColumnFileWriter writer;
+      for(s = 0; s < table.size(); s++) {
+	tables.push_back(unique_ptr<ProbabilityTable>(
+	  new ProbabilityTable(table[s], table_energy.min, table_energy.max,
+			       min<uint64_t>(table_energy.n, TABLE_MAX_INTERVALS + 1),
+			       table_tolerance, n_threads, propagator)));
+	std::cout << "      " << table[s].label << ": "
+		  << tables.back()->GetNIntervals() << " intervals, estimated error "
+		  << tables.back()->GetErrorEstimate() << std::endl;
+	tables.back()->AddToFile(writer);
+      }
+      writer.Write(table_file);
+      std::cout << "  Tables written to " << table_file << std::endl;
+    }
+    catch(exception& e) {
+      cerr << "  Error: " << e.what() << "\n";
+      return 1;
+    }
+    cout << endl<<"Done!" << endl;
+    return 0;
   }
 
-  /************ INVERTED HIERARCHY - UPPER OCTANT ************/
-  delta = 0;
-  for(i = 0; i <= N_DELTA_STEPS; i++) {
-    delta = - M_PI + i*delta_step;
-    
-    // neutrino beam
-    bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_IH, delta,
-		 energy, kSquared, 1 ); 
-    bNu->propagateLinear( 1, distance, density );
-
-    total_prob = 0;
-    for( j = 1; j <= 3; j++) total_prob += bNu->GetProb(2, j);
-    if ( total_prob >1.00001 || total_prob<0.99998 )
-      {
-	std::cerr << "  ERROR (i = " << i << ") - Prob: " << total_prob
-		  << " - Energy: "<< energy << std::endl;
-	abort(); }
-
-    mu2e_UO_IH[0][i] = bNu->GetProb(2, 1); // Fill the array
-
-    // anti-neutrino beam
-    bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_IH, delta,
-		 energy, kSquared, -1 ); 
-    bNu->propagateLinear( -1, distance, density );
-
-    total_prob = 0;
-    for( j = -1; j >= -3; j--) total_prob += bNu->GetProb(-2, j);
-    if ( total_prob >1.00001 || total_prob<0.99998 )
-      {
-	std::cerr << "  ERROR (i = " << i << ") - Prob: " << total_prob
-		  << " - Energy: "<< energy << std::endl;
-	abort(); }
-      
-    mu2e_UO_IH[1][i] = bNu->GetProb(-2, -1);
+  /***** Optimisation mode *****/
+
+  /* The heat map of the grid is the column "separation" (energy fastest) of
+     the column file, with the "distance" and "energy" axes, and the histogram
+     "separation" (energy on x, distance on y) of the ROOT file. All the
+     points of the search are kept in the columns "points/...". */
+  if (optimise) {
+    vector<string> groups;
+    for(s = 0; s < table.size(); s++)
+      if (find(groups.begin(), groups.end(), table[s].group) == groups.end())
+	groups.push_back(table[s].group);
+    if (groups.size() < 2) {
+      cerr << "  Error: --optimise needs two groups of scenarios\n";
+      return 1;
+    }
+
+    std::cout << std::endl << "  Optimisation of " << groups[0] << "-" << groups[1]
+	      << ":" << std::endl;
+    for(k = 0; k < 2; k++)
+      std::cout << "      " << opt_axes[k].name << " from " << opt_axes[k].min
+		<< " to " << opt_axes[k].max << (k == 0 ? " Km" : " GeV") << " in "
+		<< opt_axes[k].n << " points" << std::endl;
+    std::cout << "      levels " << opt_levels << ", tolerance " << opt_tolerance
+	      << std::endl;
+
+    try {
+      OptimiserResult opt = OptimiseBaseline(table, &groups[0], opt_axes[0],
+					     opt_axes[1], opt_levels, opt_tolerance,
+					     n_delta_steps, n_threads);
+      for(k = 0; k < opt.n_refined.size(); k++)
+	std::cout << "      level " << k + 1 << ": " << opt.n_refined[k]
+		  << " cells refined, " << opt.n_pruned[k] << " dropped" << std::endl;
+      std::cout << "  Optimum: distance " << opt.best.distance << " Km, energy "
+		<< opt.best.energy << " GeV, separation " << opt.best.separation
+		<< " (" << opt.points.size() << " points)" << std::endl;
+
+      const size_t n_d = opt_axes[0].n, n_e = opt_axes[1].n;
+      vector<double> d_value(n_d), e_value(n_e);
+      for(k = 0; k < n_d; k++) d_value[k] = opt_axes[0].Value(k);
+      for(k = 0; k < n_e; k++) e_value[k] = opt_axes[1].Value(k);
+
+      if (format == "columns") {
+	ProfileScope write_scope(PROFILE_FILE_WRITE);
+	const size_t n_points = opt.points.size();
+	vector<double> point_column(4 * n_points);
+	for(k = 0; k < n_points; k++) {
+	  point_column[k]                = opt.points[k].distance;
+	  point_column[n_points + k]     = opt.points[k].energy;
+	  point_column[2 * n_points + k] = opt.points[k].separation;
+	  point_column[3 * n_points + k] = opt.points[k].level;
+	}
+	ColumnFileWriter writer;
+	writer.AddParameter("levels", opt_levels);
+	writer.AddParameter("tolerance", opt_tolerance);
+	writer.AddParameter("optimum/distance", opt.best.distance);
+	writer.AddParameter("optimum/energy", opt.best.energy);
+	writer.AddParameter("optimum/separation", opt.best.separation);
+	writer.AddColumn("distance", &d_value[0], n_d);
+	writer.AddColumn("energy", &e_value[0], n_e);
+	writer.AddColumn("separation", &opt.map[0], n_d * n_e);
+	writer.AddColumn("points/distance", &point_column[0], n_points);
+	writer.AddColumn("points/energy", &point_column[n_points], n_points);
+	writer.AddColumn("points/separation", &point_column[2 * n_points], n_points);
+	writer.AddColumn("points/level", &point_column[3 * n_points], n_points);
+	writer.Write(output);
+      }
+#ifndef WITHOUT_ROOT
+      else {
+	// The bins are centred on the points of the grid
+	const vector<double> d_edge = CentredEdges(opt_axes[0]);
+	const vector<double> e_edge = CentredEdges(opt_axes[1]);
+
+	ProfileScope graph_scope(PROFILE_GRAPHS);
+	RootFileWriter writer;
+	TH2D * h_map = new TH2D("separation", (groups[0] + "-" + groups[1]).c_str(),
+				n_e, &e_edge[0], n_d, &d_edge[0]);
+	writer.AddObject("separation", h_map);
+	for(size_t d = 0; d < n_d; d++)
+	  for(size_t e = 0; e < n_e; e++)
+	    h_map->SetBinContent(e + 1, d + 1, opt.map[d * n_e + e]);
+	writer.AddObject("optimum", new TGraph(1, &opt.best.energy, &opt.best.distance));
+	writer.AddParameter("optimum_separation", opt.best.separation);
+	graph_scope.Stop();
+	writer.Write(output);
+      }
+#endif
+    }
+    catch(exception& e) {
+      cerr << "  Error: " << e.what() << "\n";
+      return 1;
+    }
+    cout << endl<<"Done!" << endl;
+    return 0;
   }
 
-  /***** Create the ROOT graph for the neutrino oscillations *****/
+  /***** Fit mode *****/
+
+  /* The surfaces are Delta chi^2 from the best fit of both hierarchies, as
+     a function of delta and theta23 and minimised over DM32: the columns
+     "NH/delta_chi2" and "IH/delta_chi2" (theta23 rows of delta, with the
+     DM32 of the minimum in "NH/DM32" and "IH/DM32") of the column file and
+     the histograms NH_delta_chi2 and IH_delta_chi2 (delta in units of pi on
+     x, theta23 on y) of the ROOT file. */
+  if (fit) {
+    const char * hierarchy[2] = { "NH", "IH" };
+    std::cout << std::endl << "  Fit of (" << measured.x << " +- "
+	      << measured.sigma_x << ", " << measured.y << " +- "
+	      << measured.sigma_y << "):" << std::endl
+	      << "      delta from " << fit_axes[0].min / M_PI << " pi to "
+	      << fit_axes[0].max / M_PI << " pi in " << fit_axes[0].n
+	      << " points" << std::endl
+	      << "      theta23 from " << fit_axes[1].min << " to " << fit_axes[1].max
+	      << " in " << fit_axes[1].n << " points" << std::endl;
+    for(k = 0; k < 2; k++)
+      std::cout << "      " << hierarchy[k] << " DM32 from " << fit_DM32[k].min
+		<< " to " << fit_DM32[k].max << " eV^2 in " << fit_DM32[k].n
+		<< " points" << std::endl;
+
+    Scenario fixed;
+    fixed.theta12  = theta12;
+    fixed.theta13  = theta13;
+    fixed.DM21     = DM21;
+    fixed.density  = density;
+    fixed.energy   = energy;
+    fixed.distance = distance;
+
+    try {
+      FitResult result = RunHierarchyFit(fixed, measured, fit_axes[0], fit_axes[1],
+					 fit_DM32, n_threads);
+      const size_t n_d = fit_axes[0].n, n_t = fit_axes[1].n;
+      const double chi2_min = std::min(result.chi2[result.best[0]],
+				       result.chi2[result.best[1]]);
+      double best_delta[2], best_theta23[2], best_DM32[2], best_chi2[2];
+      for(k = 0; k < 2; k++) {
+	const size_t b = result.best[k];
+	best_delta[k] = fit_axes[0].Value(b % n_d);
+	best_theta23[k] = fit_axes[1].Value(b / n_d % n_t);
+	best_DM32[k] = result.DM32[b];
+	best_chi2[k] = result.chi2[b];
+	std::cout << "  Best fit " << hierarchy[k] << ": chi2 = " << best_chi2[k]
+		  << " at delta = " << best_delta[k] / M_PI << " pi, theta23 = "
+		  << best_theta23[k] << ", DM32 = " << best_DM32[k] << " eV^2"
+		  << std::endl;
+      }
+      std::cout << "  Delta chi2 (IH - NH) = " << best_chi2[1] - best_chi2[0]
+		<< std::endl;
+
+      vector<double> delta_chi2(result.chi2.size());
+      for(k = 0; k < delta_chi2.size(); k++)
+	delta_chi2[k] = result.chi2[k] - chi2_min;
+
+      if (format == "columns") {
+	ProfileScope write_scope(PROFILE_FILE_WRITE);
+	vector<double> d_value(n_d), t_value(n_t);
+	for(k = 0; k < n_d; k++) d_value[k] = fit_axes[0].Value(k);
+	for(k = 0; k < n_t; k++) t_value[k] = fit_axes[1].Value(k);
+	ColumnFileWriter writer;
+	writer.AddParameter("x", measured.x);
+	writer.AddParameter("y", measured.y);
+	writer.AddParameter("sigma_x", measured.sigma_x);
+	writer.AddParameter("sigma_y", measured.sigma_y);
+	for(k = 0; k < 2; k++) {
+	  const string h = hierarchy[k];
+	  writer.AddParameter(h + "/chi2_min", best_chi2[k]);
+	  writer.AddParameter(h + "/delta", best_delta[k]);
+	  writer.AddParameter(h + "/theta23", best_theta23[k]);
+	  writer.AddParameter(h + "/DM32", best_DM32[k]);
+	}
+	writer.AddColumn("delta", &d_value[0], n_d);
+	writer.AddColumn("theta23", &t_value[0], n_t);
+	for(k = 0; k < 2; k++) {
+	  const string h = hierarchy[k];
+	  writer.AddColumn(h + "/delta_chi2", &delta_chi2[k * n_t * n_d], n_t * n_d);
+	  writer.AddColumn(h + "/DM32", &result.DM32[k * n_t * n_d], n_t * n_d);
+	}
+	writer.Write(output);
+      }
+#ifndef WITHOUT_ROOT
+      else {
+	// The bins are centred on the points of the grid, delta in units of pi
+	const vector<double> d_edge = CentredEdges(fit_axes[0], M_PI);
+	const vector<double> t_edge = CentredEdges(fit_axes[1]);
+
+	ProfileScope graph_scope(PROFILE_GRAPHS);
+	RootFileWriter writer;
+	for(k = 0; k < 2; k++) {
+	  const string h = hierarchy[k];
+	  TH2D * h_chi2 = new TH2D((h + "_delta_chi2").c_str(), (h + "_delta_chi2").c_str(),
+				   n_d, &d_edge[0], n_t, &t_edge[0]);
+	  writer.AddObject(h + "_delta_chi2", h_chi2);
+	  for(size_t t = 0; t < n_t; t++)
+	    for(size_t d = 0; d < n_d; d++)
+	      h_chi2->SetBinContent(d + 1, t + 1, delta_chi2[(k * n_t + t) * n_d + d]);
+	  const double best_x = best_delta[k] / M_PI;
+	  writer.AddObject(h + "_best", new TGraph(1, &best_x, &best_theta23[k]));
+	  writer.AddParameter(h + "_chi2_min", best_chi2[k]);
+	  writer.AddParameter(h + "_DM32", best_DM32[k]);
+	}
+	graph_scope.Stop();
+	writer.Write(output);
+      }
+#endif
+    }
+    catch(exception& e) {
+      cerr << "  Error: " << e.what() << "\n";
+      return 1;
+    }
+    cout << endl<<"Done!" << endl;
+    return 0;
+  }
+
+  /***** Oscillogram mode *****/
+
+  /* One map per scenario, value of delta and beam type. They are named after
+     the scenario, "<label>/nu" and "<label>/nubar" in the column file and
+     <label>_nu, <label>_nubar in the ROOT file, with the index of delta
+     appended when there is more than one. */
+  if (oscillogram) {
+    std::cout << std::endl << "  Oscillograms:" << std::endl
+	      << "      cos_zenith from " << osc_axes[0].min << " to "
+	      << osc_axes[0].max << " in " << osc_axes[0].n << " points" << std::endl
+	      << "      energy from " << osc_axes[1].min << " to " << osc_axes[1].max
+	      << " GeV in " << osc_axes[1].n << " logarithmic points" << std::endl
+	      << "      delta from " << osc_axes[2].min << " to " << osc_axes[2].max
+	      << " in " << osc_axes[2].n << " points" << std::endl
+	      << "      height " << osc_height << " Km" << std::endl;
+
+    const size_t n_cz = osc_axes[0].n, n_e = osc_axes[1].n, n_d = osc_axes[2].n;
+    ColumnArena maps(true);
+    vector<double> cz_value(n_cz), e_value(n_e);
+    vector<string> map_name(2 * table.size() * n_d);
+    for(k = 0; k < n_cz; k++) cz_value[k] = osc_axes[0].Value(k);
+    for(k = 0; k < n_e; k++) e_value[k] = LogAxisValue(osc_axes[1], k);
+    for(s = 0; s < table.size(); s++)
+      for(k = 0; k < n_d; k++) {
+	stringstream suffix;
+	if (n_d > 1) suffix << "_" << k;
+	map_name[(s * n_d + k) * 2]     = table[s].label + (format == "columns" ?
+							    "/nu" : "_nu") + suffix.str();
+	map_name[(s * n_d + k) * 2 + 1] = table[s].label + (format == "columns" ?
+							    "/nubar" : "_nubar") + suffix.str();
+      }
+
+    try {
+      RunOscillogram(table, osc_axes[0], osc_axes[1], osc_axes[2], osc_height,
+		     n_threads, maps);
+
+      if (format == "columns") {
+	ProfileScope write_scope(PROFILE_FILE_WRITE);
+	ColumnFileWriter writer;
+	writer.AddParameter("height", osc_height);
+	for(k = 0; k < n_d; k++) {
+	  stringstream name;
+	  name << "delta_" << k;
+	  writer.AddParameter(name.str(), osc_axes[2].Value(k));
+	}
+	for(s = 0; s < table.size(); s++) {
+	  writer.AddParameter(table[s].label + "/theta23", table[s].theta23);
+	  writer.AddParameter(table[s].label + "/DM32", table[s].DM32);
+	}
+	writer.AddColumn("cos_zenith", &cz_value[0], n_cz);
+	writer.AddColumn("energy", &e_value[0], n_e);
+	for(k = 0; k < map_name.size(); k++)
+	  writer.AddColumn(map_name[k], maps.Column(k), n_cz * n_e);
+	writer.Write(output);
+      }
+#ifndef WITHOUT_ROOT
+      else {
+	/* The bins are centred on the points of the maps, in logarithmic
+	   steps along the energy */
+	const vector<double> cz_edge = CentredEdges(osc_axes[0]);
+	const vector<double> e_edge = CentredEdges(osc_axes[1], 1, true);
+
+	ProfileScope graph_scope(PROFILE_GRAPHS);
+	RootFileWriter writer;
+	for(size_t m = 0; m < map_name.size(); m++) {
+	  TH2D * h_map = new TH2D(map_name[m].c_str(), map_name[m].c_str(),
+				  n_e, &e_edge[0], n_cz, &cz_edge[0]);
+	  writer.AddObject(map_name[m], h_map);
+	  const double * map = maps.Column(m);
+	  for(size_t c = 0; c < n_cz; c++)
+	    for(size_t e = 0; e < n_e; e++)
+	      h_map->SetBinContent(e + 1, c + 1, map[c * n_e + e]);
+	}
+	graph_scope.Stop();
+	writer.Write(output);
+      }
+#endif
+    }
+    catch(exception& e) {
+      cerr << "  Error: " << e.what() << "\n";
+      return 1;
+    }
+    cout << endl<<"Done!" << endl;
+    return 0;
+  }
+ 
+  std::cout << std::endl << "  Scenarios:" << std::endl;
+  for(s = 0; s < table.size(); s++)
+    std::cout << "      " << table[s].label << " (" << table[s].group << ")"
+	      << " theta23 = " << table[s].theta23
+	      << " DM32 = " << table[s].DM32 << " eV^2"
+	      << " density = " << table[s].density << " g/cm^3"
+	      << " energy = " << table[s].energy << " GeV"
+	      << " distance = " << table[s].distance << " Km"
+	      << " markers = " << table[s].markers.size() << std::endl;
 
-  TGraph *gr_LO_NH = new TGraph(N_DELTA_STEPS+1, mu2e_LO_NH[0], mu2e_LO_NH[1]);
-  TGraph *gr_UO_NH = new TGraph(N_DELTA_STEPS+1, mu2e_UO_NH[0], mu2e_UO_NH[1]);
-  TGraph *gr_LO_IH = new TGraph(N_DELTA_STEPS+1, mu2e_LO_IH[0], mu2e_LO_IH[1]);
-  TGraph *gr_UO_IH = new TGraph(N_DELTA_STEPS+1, mu2e_UO_IH[0], mu2e_UO_IH[1]);
+  /***** Calculate the neutrino oscillation points *****/
 
-  double x[2], y[2];
+  /* All the rows of the table are computed together as a single batch of
+     work shared among the parallel workers (see Scenario.h) */
+  if (check_kernel && !CheckKernel(table, n_delta_steps)) return 1;
 
-  /* The following code just creates 8 graphs each containing only 2 points.
+  ScenarioEngine local_engine(served ? 1 : n_threads);
+  ScenarioEngine & engine = served ? *served : local_engine;
+  engine.SetKernel(propagator);
+  engine.SetFlux(flux);
+  engine.SetDensityProfile(density_profile);
+  try {
+    if (!served) engine.SetCache(cache_dir);
+  }
+  catch(exception& e) {
+    cerr << "  Error: " << e.what() << "\n";
+    return 1;
+  }
+  try {
+    if (adaptive_tolerance > 0)
+      engine.RunAdaptive(table, adaptive_tolerance, analytic);
+    else
+      engine.Run(table, n_delta_steps, analytic, check_analytic);
+  }
+  catch(exception& e) {
+    cerr << "  Error: " << e.what() << "\n";
+    return 1;
+  }
+  std::cout << std::endl << "  Ellipse points:";
+  for(s = 0; s < table.size(); s++)
+    std::cout << " " << table[s].label << " " << engine.GetNEllipsePoints(s);
+  std::cout << std::endl << "  Propagations: " << engine.GetNPropagations()
+	    << std::endl;
+  if (engine.GetCache().Enabled())
+    std::cout << "  Cache: " << engine.GetCache().GetNHits() << " scenarios read, "
+	      << engine.GetCache().GetNMisses() << " computed" << std::endl;
+
+  if (check_analytic) {
+    std::cout << "  Maximum deviation between the closed-form and the"
+      " brute-force ellipses: " << engine.GetMaxDeviation() << std::endl;
+    if (engine.GetMaxDeviation() > ANALYTIC_TOLERANCE) {
+      std::cerr << "  ERROR - the deviation exceeds the tolerance of "
+		<< ANALYTIC_TOLERANCE << std::endl;
+      return 1;
+    }
+  }
+
+  /* The markers are grouped in one graph for each marker of each group of
+     scenarios. The graph <group>_<k> contains the k-th marker of all the rows
+     of the group. By default there are 8 graphs each containing only 2 points.
      These points correspond to the values of delta: 0, 1/2 pi, pi, 3/2 pi.
      Each graph is in common with the lower and upper octants.
      Actually the Prob3++ defines delta as going from -pi to pi so, to recover
@@ -412,190 +1517,274 @@ int main(int argc, char * argv[] )
      phase when drawing the graph.
 */
 
-  // delta = 0 - Normal hierarchy
-  
-  bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_NH, 0,
-	       energy, kSquared, 1 ); 
-  bNu->propagateLinear( 1, distance, density );
-  x[0] = bNu->GetProb(2, 1);
-  bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_NH, 0,
-	       energy, kSquared, -1 ); 
-  bNu->propagateLinear( -1, distance, density );
-  y[0] = bNu->GetProb(-2, -1);
-  bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_NH, 0,
-	       energy, kSquared, 1 ); 
-  bNu->propagateLinear( 1, distance, density );
-  x[1] = bNu->GetProb(2, 1);
-  bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_NH, 0,
-	       energy, kSquared, -1 ); 
-  bNu->propagateLinear( -1, distance, density );
-  y[1] = bNu->GetProb(-2, -1);
-  TGraph *gr_NH_0 = new TGraph(2, x, y);
-
-  // delta = 1/2 pi - Normal hierarchy
-  
-  bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_NH, .5 * M_PI,
-	       energy, kSquared, 1 ); 
-  bNu->propagateLinear( 1, distance, density );
-  x[0] = bNu->GetProb(2, 1);
-  bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_NH, .5 * M_PI,
-	       energy, kSquared, -1 ); 
-  bNu->propagateLinear( -1, distance, density );
-  y[0] = bNu->GetProb(-2, -1);
-  bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_NH, .5 * M_PI,
-	       energy, kSquared, 1 ); 
-  bNu->propagateLinear( 1, distance, density );
-  x[1] = bNu->GetProb(2, 1);
-  bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_NH, .5 * M_PI,
-	       energy, kSquared, -1 ); 
-  bNu->propagateLinear( -1, distance, density );
-  y[1] = bNu->GetProb(-2, -1);
-  TGraph *gr_NH_1 = new TGraph(2, x, y);
-
-  // delta = pi - Normal hierarchy
-  
-  bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_NH, M_PI,
-	       energy, kSquared, 1 ); 
-  bNu->propagateLinear( 1, distance, density );
-  x[0] = bNu->GetProb(2, 1);
-  bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_NH, M_PI,
-	       energy, kSquared, -1 ); 
-  bNu->propagateLinear( -1, distance, density );
-  y[0] = bNu->GetProb(-2, -1);
-  bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_NH, M_PI,
-	       energy, kSquared, 1 ); 
-  bNu->propagateLinear( 1, distance, density );
-  x[1] = bNu->GetProb(2, 1);
-  bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_NH, M_PI,
-	       energy, kSquared, -1 ); 
-  bNu->propagateLinear( -1, distance, density );
-  y[1] = bNu->GetProb(-2, -1);
-  TGraph *gr_NH_2 = new TGraph(2, x, y);
-
-  // delta = 3/2 pi - Normal hierarchy
-  
-  bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_NH, 1.5 * M_PI,
-	       energy, kSquared, 1 ); 
-  bNu->propagateLinear( 1, distance, density );
-  x[0] = bNu->GetProb(2, 1);
-  bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_NH, 1.5 * M_PI,
-	       energy, kSquared, -1 ); 
-  bNu->propagateLinear( -1, distance, density );
-  y[0] = bNu->GetProb(-2, -1);
-  bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_NH, 1.5 * M_PI,
-	       energy, kSquared, 1 ); 
-  bNu->propagateLinear( 1, distance, density );
-  x[1] = bNu->GetProb(2, 1);
-  bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_NH, 1.5 * M_PI,
-	       energy, kSquared, -1 ); 
-  bNu->propagateLinear( -1, distance, density );
-  y[1] = bNu->GetProb(-2, -1);
-  TGraph *gr_NH_3 = new TGraph(2, x, y);
-
-  // delta = 0 - Inverted hierarchy
-  
-  bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_IH, 0,
-	       energy, kSquared, 1 ); 
-  bNu->propagateLinear( 1, distance, density );
-  x[0] = bNu->GetProb(2, 1);
-  bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_IH, 0,
-	       energy, kSquared, -1 ); 
-  bNu->propagateLinear( -1, distance, density );
-  y[0] = bNu->GetProb(-2, -1);
-  bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_IH, 0,
-	       energy, kSquared, 1 ); 
-  bNu->propagateLinear( 1, distance, density );
-  x[1] = bNu->GetProb(2, 1);
-  bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_IH, 0,
-	       energy, kSquared, -1 ); 
-  bNu->propagateLinear( -1, distance, density );
-  y[1] = bNu->GetProb(-2, -1);
-  TGraph *gr_IH_0 = new TGraph(2, x, y);
-
-  // delta = 1/2 pi - Inverted hierarchy
-  
-  bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_IH, .5 * M_PI,
-	       energy, kSquared, 1 ); 
-  bNu->propagateLinear( 1, distance, density );
-  x[0] = bNu->GetProb(2, 1);
-  bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_IH, .5 * M_PI,
-	       energy, kSquared, -1 ); 
-  bNu->propagateLinear( -1, distance, density );
-  y[0] = bNu->GetProb(-2, -1);
-  bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_IH, .5 * M_PI,
-	       energy, kSquared, 1 ); 
-  bNu->propagateLinear( 1, distance, density );
-  x[1] = bNu->GetProb(2, 1);
-  bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_IH, .5 * M_PI,
-	       energy, kSquared, -1 ); 
-  bNu->propagateLinear( -1, distance, density );
-  y[1] = bNu->GetProb(-2, -1);
-  TGraph *gr_IH_1 = new TGraph(2, x, y);
-
-  // delta = pi - Inverted hierarchy
-  
-  bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_IH, M_PI,
-	       energy, kSquared, 1 ); 
-  bNu->propagateLinear( 1, distance, density );
-  x[0] = bNu->GetProb(2, 1);
-  bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_IH, M_PI,
-	       energy, kSquared, -1 ); 
-  bNu->propagateLinear( -1, distance, density );
-  y[0] = bNu->GetProb(-2, -1);
-  bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_IH, M_PI,
-	       energy, kSquared, 1 ); 
-  bNu->propagateLinear( 1, distance, density );
-  x[1] = bNu->GetProb(2, 1);
-  bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_IH, M_PI,
-	       energy, kSquared, -1 ); 
-  bNu->propagateLinear( -1, distance, density );
-  y[1] = bNu->GetProb(-2, -1);
-  TGraph *gr_IH_2 = new TGraph(2, x, y);
-
-  // delta = 3/2 pi - Inverted hierarchy
-  
-  bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_IH, 1.5 * M_PI,
-	       energy, kSquared, 1 ); 
-  bNu->propagateLinear( 1, distance, density );
-  x[0] = bNu->GetProb(2, 1);
-  bNu->SetMNS( theta12, theta13, theta23_LO, DM21, DM32_IH, 1.5 * M_PI,
-	       energy, kSquared, -1 ); 
-  bNu->propagateLinear( -1, distance, density );
-  y[0] = bNu->GetProb(-2, -1);
-  bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_IH, 1.5 * M_PI,
-	       energy, kSquared, 1 ); 
-  bNu->propagateLinear( 1, distance, density );
-  x[1] = bNu->GetProb(2, 1);
-  bNu->SetMNS( theta12, theta13, theta23_UO, DM21, DM32_IH, 1.5 * M_PI,
-	       energy, kSquared, -1 ); 
-  bNu->propagateLinear( -1, distance, density );
-  y[1] = bNu->GetProb(-2, -1);
-  TGraph *gr_IH_3 = new TGraph(2, x, y);
-  
+  vector<string> groups;
+  vector<vector<double> > marker_x, marker_y;
+  vector<string> gr_marker_name;
+  for(s = 0; s < table.size(); s++)
+    if (find(groups.begin(), groups.end(), table[s].group) == groups.end())
+      groups.push_back(table[s].group);
+
+  for(size_t g = 0; g < groups.size(); g++) {
+    for(k = 0; ; k++) {
+      vector<double> x, y;
+      for(s = 0; s < table.size(); s++) {
+	if (table[s].group != groups[g] || k >= table[s].markers.size()) continue;
+	x.push_back(engine.GetMarker(s, k, 1));
+	y.push_back(engine.GetMarker(s, k, -1));
+      }
+      if (x.empty()) break;
+      stringstream name;
+      name << groups[g] << "_" << k;
+      marker_x.push_back(x);
+      marker_y.push_back(y);
+      gr_marker_name.push_back(name.str());
+    }
+  }
+
+  /***** Separation of the hierarchies *****/
+
+  /* Between every two groups of the same experiment, by default NH and IH,
+     named <group>-<other group> ("NH-IH", "NOvA/NH-IH" for --config). Each
+     group contributes the ellipses of all its rows (both octants). */
+  vector<string> separation_name;
+  vector<string> separation_group[2];
+  vector<SeparationMetrics> separation;
+  {
+    ProfileScope scope(PROFILE_SEPARATION);
+    for(size_t g = 0; g < groups.size(); g++)
+      for(size_t h = g + 1; h < groups.size(); h++) {
+	const size_t prefix = groups[g].rfind('/') + 1; // 0 without experiment
+	if (groups[h].rfind('/') + 1 != prefix ||
+	    groups[h].compare(0, prefix, groups[g], 0, prefix) != 0) continue;
+	vector<SeparationCurve> curves[2];
+	for(s = 0; s < table.size(); s++) {
+	  if (table[s].group != groups[g] && table[s].group != groups[h]) continue;
+	  SeparationCurve curve = { engine.GetEllipse(s, 1), engine.GetEllipse(s, -1),
+				    engine.GetEllipseDelta(s),
+				    (size_t) engine.GetNEllipsePoints(s) };
+	  curves[table[s].group == groups[g] ? 0 : 1].push_back(curve);
+	}
+	separation.push_back(ComputeSeparation(curves[0], curves[1], degeneracy,
+					       served ? 1 : n_threads));
+	separation_name.push_back(groups[g] + "-" + groups[h].substr(prefix));
+	separation_group[0].push_back(groups[g].substr(prefix));
+	separation_group[1].push_back(groups[h].substr(prefix));
+      }
+  }
+  if (!separation.empty())
+    std::cout << "  Separation (degenerate within " << degeneracy << "):" << std::endl;
+  for(k = 0; k < separation.size(); k++)
+    std::cout << "      " << separation_name[k] << ": minimum distance "
+	      << separation[k].min_distance << ", overlap area "
+	      << separation[k].overlap_area << ", degenerate delta "
+	      << separation_group[0][k] << " " << 100 * separation[k].degenerate[0]
+	      << "% " << separation_group[1][k] << " "
+	      << 100 * separation[k].degenerate[1] << "%" << std::endl;
+
+  /***** Uncertainty bands *****/
+
+  BandResult bands;
+  if (n_band_samples > 0) {
+    try {
+      bands = RunUncertaintyBands(table, band_prior, n_band_samples, band_steps,
+				  band_seed, n_threads, propagator);
+    }
+    catch(exception& e) {
+      cerr << "  Error: " << e.what() << "\n";
+      return 1;
+    }
+    std::cout << "  Bands: " << n_band_samples << " samples (seed " << band_seed
+	      << "), " << bands.n_propagations << " propagations, priors";
+    bool varied = false;
+    for(k = 0; k < BANDS_N_PARAMETERS; k++)
+      if (band_prior[k].kind != BAND_FIXED) {
+	std::cout << " " << BandParameterName(k)
+		  << (band_prior[k].kind == BAND_GAUSS ? " +-" : " flat +-")
+		  << band_prior[k].width / BandParameterUnit(k);
+	varied = true;
+      }
+    std::cout << (varied ? "" : " none") << std::endl;
+  }
+  const size_t n_band_points = bands.delta.size();
+
+  /***** Reply of the query server *****/
+
+  if (reply) {
+    ostringstream out;
+    out << "\"propagations\":" << engine.GetNPropagations() << ",\"ellipses\":{";
+    for(s = 0; s < table.size(); s++) {
+      const int n = engine.GetNEllipsePoints(s);
+      out << (s > 0 ? "," : "") << JsonString(table[s].label) << ":{\"group\":"
+	  << JsonString(table[s].group)
+	  << ",\"delta\":" << JsonArray(engine.GetEllipseDelta(s), n)
+	  << ",\"nu\":" << JsonArray(engine.GetEllipse(s, 1), n)
+	  << ",\"nubar\":" << JsonArray(engine.GetEllipse(s, -1), n) << "}";
+    }
+    out << "},\"markers\":{";
+    for(k = 0; k < gr_marker_name.size(); k++)
+      out << (k > 0 ? "," : "") << JsonString(gr_marker_name[k])
+	  << ":{\"x\":" << JsonArray(&marker_x[k][0], marker_x[k].size())
+	  << ",\"y\":" << JsonArray(&marker_y[k][0], marker_y[k].size()) << "}";
+    out << "},\"separation\":{";
+    out.precision(17);
+    for(k = 0; k < separation.size(); k++)
+      out << (k > 0 ? "," : "") << JsonString(separation_name[k])
+	  << ":{\"min_distance\":" << separation[k].min_distance
+	  << ",\"overlap_area\":" << separation[k].overlap_area
+	  << ",\"degenerate\":" << JsonArray(separation[k].degenerate, 2) << "}";
+    out << "}";
+    *reply = out.str();
+    return 0;
+  }
+
+  /***** Columnar output *****/
+
+  /* The same graphs as columns <graph>/x and <graph>/y, plus the delta values
+     of the ellipses and all the parameters (see ColumnFile.h). The columns
+     of the ellipses are written straight from the engine. */
+  if (format == "columns") {
+    ProfileScope write_scope(PROFILE_FILE_WRITE);
+    ColumnFileWriter writer;
+    /* With --config every experiment has its own values, which are only in
+       the parameters of its rows */
+    if (experiments.empty()) {
+      writer.AddParameter("theta12", theta12);
+      writer.AddParameter("theta13", theta13);
+      writer.AddParameter("theta23_LO", theta23_LO);
+      writer.AddParameter("theta23_UO", theta23_UO);
+      writer.AddParameter("DM21", DM21);
+      writer.AddParameter("DM32_NH", DM32_NH);
+      writer.AddParameter("DM32_IH", DM32_IH);
+      writer.AddParameter("density", density);
+      writer.AddParameter("energy", flux.GetNNodes() > 0 ? flux.GetMeanEnergy() : energy);
+      writer.AddParameter("distance", distance);
+    }
+    writer.AddParameter("degeneracy", degeneracy);
+    for(k = 0; k < separation.size(); k++) {
+      writer.AddParameter(separation_name[k] + "/min_distance",
+			  separation[k].min_distance);
+      writer.AddParameter(separation_name[k] + "/overlap_area",
+			  separation[k].overlap_area);
+      writer.AddParameter(separation_name[k] + "/degenerate_" + separation_group[0][k],
+			  separation[k].degenerate[0]);
+      writer.AddParameter(separation_name[k] + "/degenerate_" + separation_group[1][k],
+			  separation[k].degenerate[1]);
+    }
+    for(s = 0; s < table.size(); s++) {
+      const Scenario & row = table[s];
+      writer.AddParameter(row.label + "/theta12", row.theta12);
+      writer.AddParameter(row.label + "/theta13", row.theta13);
+      writer.AddParameter(row.label + "/theta23", row.theta23);
+      writer.AddParameter(row.label + "/DM21", row.DM21);
+      writer.AddParameter(row.label + "/DM32", row.DM32);
+      writer.AddParameter(row.label + "/density", row.density);
+      writer.AddParameter(row.label + "/energy", row.energy);
+      writer.AddParameter(row.label + "/distance", row.distance);
+    }
+    try {
+      for(s = 0; s < table.size(); s++) {
+	writer.AddColumn(table[s].label + "/x", engine.GetEllipse(s, 1),
+			 engine.GetNEllipsePoints(s));
+	writer.AddColumn(table[s].label + "/y", engine.GetEllipse(s, -1),
+			 engine.GetNEllipsePoints(s));
+	writer.AddColumn(table[s].label + "/delta", engine.GetEllipseDelta(s),
+			 engine.GetNEllipsePoints(s));
+      }
+      for(k = 0; k < gr_marker_name.size(); k++) {
+	writer.AddColumn(gr_marker_name[k] + "/x", &marker_x[k][0], marker_x[k].size());
+	writer.AddColumn(gr_marker_name[k] + "/y", &marker_y[k][0], marker_y[k].size());
+      }
+      /* The quantiles of the bands as the columns <label>/band/x_lo2, x_lo1,
+	 x_median, x_hi1, x_hi2 and the same for y, -2 to +2 sigma */
+      const char * quantile_name[BANDS_N_QUANTILES] = { "lo2", "lo1", "median",
+							"hi1", "hi2" };
+      vector<double> band_column(n_band_points * table.size() * 2 * BANDS_N_QUANTILES);
+      for(s = 0; s < table.size() && n_band_points > 0; s++) {
+	writer.AddColumn(table[s].label + "/band/delta", &bands.delta[0], n_band_points);
+	for(int t = 0; t < 2; t++)
+	  for(int q = 0; q < BANDS_N_QUANTILES; q++) {
+	    double * column = &band_column[((s * 2 + t) * BANDS_N_QUANTILES + q) *
+					   n_band_points];
+	    for(size_t d = 0; d < n_band_points; d++)
+	      column[d] = bands.quantile[((s * n_band_points + d) * 2 + t) *
+					 BANDS_N_QUANTILES + q];
+	    writer.AddColumn(table[s].label + "/band/" + (t == 0 ? "x_" : "y_") +
+			     quantile_name[q], column, n_band_points);
+	  }
+      }
+      writer.Write(output);
+    }
+    catch(exception& e) {
+      cerr << "  Error: " << e.what() << "\n";
+      return 1;
+    }
+    cout << endl<<"Done!" << endl;
+    return 0;
+  }
+
+#ifndef WITHOUT_ROOT
+  /***** Create the ROOT graph for the neutrino oscillations *****/
+
+  ProfileScope graph_scope(PROFILE_GRAPHS);
+  RootFileWriter writer;
+  for(s = 0; s < table.size(); s++)
+    writer.AddObject(table[s].label,
+		     new TGraph(engine.GetNEllipsePoints(s), engine.GetEllipse(s, 1),
+				engine.GetEllipse(s, -1)));
+  for(k = 0; k < gr_marker_name.size(); k++)
+    writer.AddObject(gr_marker_name[k], new TGraph(marker_x[k].size(), &marker_x[k][0],
+						   &marker_y[k][0]));
+  /* The bands as <label>_band1 (1 sigma) and <label>_band2 (2 sigma), with
+     the points on the medians */
+  for(s = 0; s < table.size() && n_band_points > 0; s++)
+    for(int sigma = 1; sigma <= 2; sigma++) {
+      TGraphAsymmErrors * band = new TGraphAsymmErrors(n_band_points);
+      for(size_t d = 0; d < n_band_points; d++) {
+	const double * x = &bands.quantile[(s * n_band_points + d) * 2 * BANDS_N_QUANTILES];
+	const double * y = x + BANDS_N_QUANTILES;
+	band->SetPoint(d, x[2], y[2]);
+	band->SetPointError(d, x[2] - x[2 - sigma], x[2 + sigma] - x[2],
+			    y[2] - y[2 - sigma], y[2 + sigma] - y[2]);
+      }
+      stringstream name;
+      name << table[s].label << "_band" << sigma;
+      writer.AddObject(name.str(), band);
+    }
+  for(k = 0; k < separation.size(); k++) {
+    const double value[4] = { separation[k].min_distance, separation[k].overlap_area,
+			      separation[k].degenerate[0], separation[k].degenerate[1] };
+    const string name[4] = { "min_distance", "overlap_area",
+			     "degenerate_" + separation_group[0][k],
+			     "degenerate_" + separation_group[1][k] };
+    for(int m = 0; m < 4; m++)
+      writer.AddParameter(separation_name[k] + "_" + name[m], value[m]);
+  }
+  graph_scope.Stop();
+
   // Write the output
-  TFile *tmp = new TFile(output.c_str(), "recreate");
-  tmp->cd();
-
-  gr_LO_NH->Write("LO_NH");
-  gr_UO_NH->Write("UO_NH");
-  gr_LO_IH->Write("LO_IH");
-  gr_UO_IH->Write("UO_IH");
-  gr_NH_0->Write("NH_0");
-  gr_NH_1->Write("NH_1");
-  gr_NH_2->Write("NH_2");
-  gr_NH_3->Write("NH_3");
-  gr_IH_0->Write("IH_0");
-  gr_IH_1->Write("IH_1");
-  gr_IH_2->Write("IH_2");
-  gr_IH_3->Write("IH_3");
-  
-  tmp->Close();
+  writer.Write(output);
+#endif
 
   cout << endl<<"Done!" << endl;
   
   return 0;
 }
 
+int main(int argc, char * argv[] )
+{
+  /* With "--serve -" the standard output carries the replies of the server,
+     so everything else is printed on the standard error */
+  std::streambuf * stdout_buffer = std::cout.rdbuf();
+  for(int i = 1; i < argc; i++)
+    if (string(argv[i]) == "--serve=-" ||
+	(string(argv[i]) == "--serve" && i + 1 < argc && string(argv[i + 1]) == "-"))
+      std::cout.rdbuf(std::cerr.rdbuf());
+
+  int status = RunProgram(argc, argv, stdout_buffer);
+  std::cout.rdbuf(stdout_buffer);
+  return status;
+}
+
 /*  Copyright (C) 2018  Pintaudi Giorgio
 
     This file is part of nu-vs-antinu.
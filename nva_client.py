@@ -0,0 +1,115 @@
+#
+# nu-vs-antinu
+# Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+# Released under the GPLv3 license
+#
+# This file is part of nu-vs-antinu.
+# nu-vs-antinu is a simple program that produces a graph to quickly estimate
+# the sensibility of a given experiment to the neutrino mass hierarchy.
+#
+
+"""Client of the query server of nu_vs_antinu (--serve, see Server.h).
+
+    from nva_client import Client
+    client = Client("/tmp/nva.sock")
+    reply = client.query(energy=2, distance=810, analytic=True)
+    plt.plot(reply["ellipses"]["LO_NH"]["nu"], reply["ellipses"]["LO_NH"]["nubar"])
+
+The keyword arguments are the command line options of nu_vs_antinu, with
+"_" in place of "-" (delta_steps=200 is --delta-steps 200). From the command
+line
+
+    python nva_client.py /tmp/nva.sock --energy 2 --distance 810 --analytic
+
+sends one request and prints a summary of the reply, with the time it took.
+A server is started with "nu_vs_antinu --serve /tmp/nva.sock".
+"""
+
+import json
+import socket
+import sys
+import time
+
+
+class Client(object):
+    """One connection to the server, which can send any number of requests"""
+
+    def __init__(self, socket_path):
+        self.connection = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.connection.connect(socket_path)
+        self.reader = self.connection.makefile("r")
+        self.n_requests = 0
+
+    def query(self, **options):
+        """Send the options as a request and return the reply as a dict"""
+        self.n_requests += 1
+        request = dict((key.replace("_", "-"), value) for key, value in options.items())
+        request["id"] = self.n_requests
+        self.connection.sendall((json.dumps(request) + "\n").encode())
+        reply = json.loads(self.reader.readline())
+        if "error" in reply:
+            raise RuntimeError(reply["error"])
+        return reply
+
+    def close(self):
+        self.reader.close()
+        self.connection.close()
+
+
+def parse_options(arguments):
+    """--name value pairs (or a lone --flag) to a dict of options"""
+    options = {}
+    i = 0
+    while i < len(arguments):
+        if not arguments[i].startswith("--"):
+            raise ValueError("unexpected argument " + arguments[i])
+        name = arguments[i][2:].replace("-", "_")
+        if i + 1 < len(arguments) and not arguments[i + 1].startswith("--"):
+            value = arguments[i + 1]
+            try:
+                value = float(value)
+            except ValueError:
+                pass
+            options[name] = value
+            i += 2
+        else:
+            options[name] = True
+            i += 1
+    return options
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        sys.exit("usage: python nva_client.py socket [--option value ...]")
+    client = Client(sys.argv[1])
+    start = time.time()
+    reply = client.query(**parse_options(sys.argv[2:]))
+    elapsed = time.time() - start
+    for label, ellipse in reply["ellipses"].items():
+        print("  %-8s %6d points  P in [%.5f, %.5f]  P_bar in [%.5f, %.5f]" %
+              (label, len(ellipse["nu"]), min(ellipse["nu"]), max(ellipse["nu"]),
+               min(ellipse["nubar"]), max(ellipse["nubar"])))
+    for name, marker in reply["markers"].items():
+        print("  %-8s %s" % (name, " ".join("(%.5f, %.5f)" % point
+                                          for point in zip(marker["x"], marker["y"]))))
+    print("  %d propagations, %.2f ms" % (reply["propagations"], 1e3 * elapsed))
+    client.close()
+
+#  Copyright (C) 2018  Pintaudi Giorgio
+#
+#  This file is part of nu-vs-antinu.
+#  nu-vs-antinu is a simple program that produces a graph to quickly estimate
+#  the sensibility of a given experiment to the neutrino mass hierarchy.
+#
+#  nu-vs-antinu is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  any later version.
+#
+#  nu-vs-antinu is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.
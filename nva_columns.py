@@ -0,0 +1,81 @@
+#
+# nu-vs-antinu
+# Copyright (C) 2018 by Pintaudi Giorgio <giorgio-pintaudi-kx@ynu.jp>
+# Released under the GPLv3 license
+#
+# This file is part of nu-vs-antinu.
+# nu-vs-antinu is a simple program that produces a graph to quickly estimate
+# the sensibility of a given experiment to the neutrino mass hierarchy.
+#
+
+"""Zero-copy numpy reader of the columnar files written with --format columns.
+
+The file is mapped in memory and every column is a read-only numpy array
+pointing into the mapping, so nothing is read from disk until it is used.
+The layout is described in ColumnFile.h.
+
+    from nva_columns import load
+    parameters, columns = load("output.nva")
+    plt.plot(columns["LO_NH/x"], columns["LO_NH/y"])
+
+or, from the command line, "python nva_columns.py output.nva" prints the
+parameters and the columns of a file.
+"""
+
+import mmap
+import sys
+
+import numpy as np
+
+HEADER = np.dtype([("magic", "S8"), ("version", "=u8"), ("n_parameters", "=u8"),
+                   ("n_columns", "=u8"), ("padding", "S32")])
+PARAMETER = np.dtype([("name", "S56"), ("value", "=f8")])
+COLUMN = np.dtype([("name", "S48"), ("offset", "=u8"), ("n", "=u8")])
+
+
+def load(file_name):
+    """Return the parameters (name -> float) and the columns (name -> array)"""
+    with open(file_name, "rb") as f:
+        buffer = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    header = np.frombuffer(buffer, HEADER, 1)[0]
+    if header["magic"] != b"NVACOLS" or header["version"] != 1:
+        raise ValueError(file_name + " is not a column file")
+    n_parameters = int(header["n_parameters"])
+    n_columns = int(header["n_columns"])
+    parameters = np.frombuffer(buffer, PARAMETER, n_parameters, HEADER.itemsize)
+    table = np.frombuffer(buffer, COLUMN, n_columns,
+                          HEADER.itemsize + n_parameters * PARAMETER.itemsize)
+    # the arrays keep a reference to the mapping, which stays open with them
+    columns = dict((c["name"].decode(),
+                    np.frombuffer(buffer, np.float64, int(c["n"]), int(c["offset"])))
+                   for c in table)
+    return dict((p["name"].decode(), float(p["value"])) for p in parameters), columns
+
+
+if __name__ == "__main__":
+    for name in sys.argv[1:]:
+        parameters, columns = load(name)
+        print(name)
+        for key, value in parameters.items():
+            print("  %-24s %.10g" % (key, value))
+        for key, value in columns.items():
+            print("  %-24s %d values" % (key, value.size))
+
+#  Copyright (C) 2018  Pintaudi Giorgio
+#
+#  This file is part of nu-vs-antinu.
+#  nu-vs-antinu is a simple program that produces a graph to quickly estimate
+#  the sensibility of a given experiment to the neutrino mass hierarchy.
+#
+#  nu-vs-antinu is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  any later version.
+#
+#  nu-vs-antinu is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with nu-vs-antinu.  If not, see <https://www.gnu.org/licenses/>.